@@ -0,0 +1,203 @@
+// Frontend and VM microbenchmarks over synthetic workloads. Results are
+// written as JSON to stdout.
+//
+//     psharp_bench [--size BYTES] [--iters N] [--workload NAME]
+//     psharp_bench --generate NAME [--size BYTES]     write a workload to stdout
+#include "../src/compiler/include/codegen.h"
+#include "../src/compiler/include/lexer.h"
+#include "../src/compiler/include/parser.h"
+#include "../src/compiler/include/peephole.h"
+#include "../src/compiler/include/sema.h"
+#include "../src/vm/include/opcodes.h"
+#include "../src/vm/include/profiler.h"
+#include "../src/vm/include/vm.h"
+#include "workloads.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct Result {
+    std::string workload;
+    std::string phase;
+    size_t iterations;
+    double best;
+    double median;
+    double items;           // bytes, tokens, nodes or instructions per iteration
+    const char *unit;
+};
+
+// Runs `setup` untimed and `body` timed `iters` times
+template<typename Setup, typename Body>
+static std::pair<double, double> measure(size_t iters, Setup&& setup, Body&& body) {
+    std::vector<double> times;
+    for (size_t i = 0; i < iters; i++) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        times.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(times.begin(), times.end());
+    return {times.front(), times[times.size() / 2]};
+}
+
+static void bench_workload(const std::string& name, const std::string& src, size_t iters, std::vector<Result>& results) {
+    auto none = [] {};
+    std::string file_name = name + ".ps";
+
+    std::vector<Token> tokens;
+    auto [lex_best, lex_median] = measure(iters, none, [&] {
+        Lexer lex(src, file_name);
+        tokens = lex.tokenize();
+    });
+    results.push_back({name, "lexer", iters, lex_best, lex_median, (double)src.size(), "bytes"});
+
+    size_t stmt_count = 0;
+    auto [parse_best, parse_median] = measure(iters, none, [&] {
+        ASTContext ctx;
+        Parser parser(file_name, tokens, ctx);
+        stmt_count = parser.parse().size();
+    });
+    results.push_back({name, "parser", iters, parse_best, parse_median, (double)tokens.size(), "tokens"});
+
+    // Sema and codegen rewrite or consume the tree, so each run parses afresh
+    ASTContext *ctx = nullptr;
+    std::vector<ASTNodePtr> stmts;
+    auto parse = [&] {
+        delete ctx;
+        ctx = new ASTContext();
+        Parser parser(file_name, tokens, *ctx);
+        stmts = parser.parse();
+    };
+    auto [sema_best, sema_median] = measure(iters, parse, [&] {
+        Sema sema(file_name, stmts, *ctx);
+        stmts = sema.analyze();
+    });
+    results.push_back({name, "sema", iters, sema_best, sema_median, (double)stmt_count, "statements"});
+
+    // CodeGen reads the declarations Sema collected
+    Chunk *chunk = nullptr;
+    Sema *sema = nullptr;
+    auto analyzed = [&] {
+        parse();
+        delete sema;
+        sema = new Sema(file_name, stmts, *ctx);
+        stmts = sema->analyze();
+    };
+    auto [gen_best, gen_median] = measure(iters, analyzed, [&] {
+        CodeGen codegen(file_name, stmts, *ctx, *sema);
+        delete chunk;
+        chunk = codegen.generate();
+    });
+    results.push_back({name, "codegen", iters, gen_best, gen_median, (double)stmt_count, "statements"});
+
+    // The VM takes ownership of its chunk, so every run gets a fresh one
+    VM *vm = nullptr;
+    auto compiled = [&] {
+        delete vm;
+        analyzed();
+        CodeGen codegen(file_name, stmts, *ctx, *sema);
+        Chunk *c = codegen.generate();
+        Peephole(*c).run();
+        vm = new VM(c);
+    };
+    auto [vm_best, vm_median] = measure(iters, compiled, [&] {
+        vm->execute();
+    });
+
+    // One profiled run counts the instructions actually executed
+    compiled();
+    Profiler profiler;
+    vm->profiler = &profiler;
+    vm->execute();
+    uint64_t instructions = 0;
+    for (size_t op = 0; op < 256; op++) {
+        instructions += op == OP_HALT ? 0 : profiler.op_counts[op];
+    }
+    results.push_back({name, "vm", iters, vm_best, vm_median, (double)instructions, "instructions"});
+
+    // Same program through the JIT, translation included; skipped for
+    // chunks the JIT declines
+    auto native = [&] {
+        compiled();
+        vm->jit = true;
+    };
+    auto [jit_best, jit_median] = measure(iters, native, [&] {
+        vm->execute();
+    });
+    if (vm->jit_code != nullptr) {
+        results.push_back({name, "jit", iters, jit_best, jit_median, (double)instructions, "instructions"});
+    }
+
+    delete vm;
+    delete chunk;
+    delete sema;
+    delete ctx;
+}
+
+static void print_json(const std::vector<Result>& results, size_t size) {
+    std::cout << "{\n  \"size\": " << size << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        auto& r = results[i];
+        std::cout << "    {\"workload\": \"" << r.workload << "\", \"phase\": \"" << r.phase
+                  << "\", \"iterations\": " << r.iterations
+                  << ", \"best_ns\": " << (uint64_t)(r.best * 1e9)
+                  << ", \"median_ns\": " << (uint64_t)(r.median * 1e9)
+                  << ", \"items\": " << (uint64_t)r.items
+                  << ", \"unit\": \"" << r.unit << "\""
+                  << ", \"items_per_s\": " << (uint64_t)(r.items / r.best);
+        if (r.phase == "lexer") {
+            std::cout << ", \"mb_per_s\": " << r.items / r.best / 1e6;
+        }
+        std::cout << "}" << (i + 1 < results.size() ? "," : "") << '\n';
+    }
+    std::cout << "  ]\n}\n";
+}
+
+int main(int argc, char **argv) {
+    size_t size = 1 << 20;
+    size_t iters = 5;
+    std::vector<std::string> workloads = {"let_chain", "deep_expr", "arith_mix", "calls", "strings"};
+    const char *generate = nullptr;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            size = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--iters" && i + 1 < argc) {
+            iters = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--workload" && i + 1 < argc) {
+            workloads = {argv[++i]};
+        }
+        else if (arg == "--generate" && i + 1 < argc) {
+            generate = argv[++i];
+        }
+        else {
+            std::cerr << "\033[31mUsage: psharp_bench [--size BYTES] [--iters N] [--workload NAME] [--generate NAME]\033[0m\n";
+            return 1;
+        }
+    }
+
+    std::string src;
+    if (generate != nullptr) {
+        if (!generate_workload(generate, size, src)) {
+            std::cerr << "\033[31mUnknown workload: " << generate << "\033[0m\n";
+            return 1;
+        }
+        std::cout << src;
+        return 0;
+    }
+
+    std::vector<Result> results;
+    for (auto& name : workloads) {
+        if (!generate_workload(name, size, src)) {
+            std::cerr << "\033[31mUnknown workload: " << name << "\033[0m\n";
+            return 1;
+        }
+        bench_workload(name, src, iters, results);
+    }
+    print_json(results, size);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Synthetic .ps workloads. Every generator is deterministic and produces a
+// script of at least `size` bytes that compiles and runs.
+
+// Long chain of declarations, each depending on the previous one
+inline std::string generate_let_chain(size_t size) {
+    std::string src;
+    src.reserve(size + 128);
+    for (size_t i = 0; src.size() < size; i++) {
+        std::string name = "variable_" + std::to_string(i);
+        if (i % 16 == 0) {
+            src += "// declaration block " + std::to_string(i / 16) + "\n";
+        }
+        if (i == 0) {
+            src += "let i64 " + name + " = " + std::to_string(i) + ";\n";
+        }
+        else {
+            std::string prev = "variable_" + std::to_string(i - 1);
+            src += "let i64 " + name + " = (" + prev + " + " + std::to_string(i * 7) + ") * 3 - " + prev + " / 2;\n";
+        }
+    }
+    return src;
+}
+
+// Balanced expression trees over earlier variables and literals
+inline std::string generate_deep_expr(size_t size, int depth = 10) {
+    std::string src = "let i64 leaf0 = 1;\nlet i64 leaf1 = 2;\nlet i64 leaf2 = 3;\n";
+    src.reserve(size + 4096);
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    auto next = [&] {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        return seed;
+    };
+    auto tree = [&](auto& self, int d) -> std::string {
+        if (d == 0) {
+            uint64_t r = next();
+            return r & 1 ? "leaf" + std::to_string(r % 3) : std::to_string(r % 100 + 1);
+        }
+        static const char ops[] = {'+', '-', '*', '+'};
+        return "(" + self(self, d - 1) + " " + ops[next() % 4] + " " + self(self, d - 1) + ")";
+    };
+    for (size_t i = 0; src.size() < size; i++) {
+        src += "let i64 tree" + std::to_string(i) + " = " + tree(tree, depth) + ";\n";
+    }
+    return src;
+}
+
+// Arithmetic-heavy mix of integer and floating point declarations
+inline std::string generate_arith_mix(size_t size) {
+    std::string src = "let i64 ival0 = 3;\nlet f64 fval0 = 1.5;\n";
+    src.reserve(size + 128);
+    for (size_t i = 1; src.size() < size; i++) {
+        std::string n = std::to_string(i);
+        std::string p = std::to_string(i - 1);
+        src += "let i64 ival" + n + " = ival" + p + " * " + std::to_string(i % 13 + 1) + " + ival" + p + " % 7 - " + std::to_string(i % 5) + ";\n";
+        src += "let f64 fval" + n + " = fval" + p + " * 0.5 + fval" + p + " / 3.0 - 1.25;\n";
+    }
+    return src;
+}
+
+// Small functions called from every declaration, including tail calls
+inline std::string generate_calls(size_t size) {
+    std::string src =
+        "fun i64 add(i64 a, i64 b) {\n    return a + b;\n}\n"
+        "fun i64 mix(i64 a, i64 b, i64 c) {\n    return add(a * b, c);\n}\n"
+        "let i64 acc0 = 1;\n";
+    src.reserve(size + 128);
+    for (size_t i = 1; src.size() < size; i++) {
+        std::string p = "acc" + std::to_string(i - 1);
+        src += "let i64 acc" + std::to_string(i) + " = mix(" + p + ", " + std::to_string(i % 7 + 1) + ", add(" + p + ", " + std::to_string(i) + "));\n";
+    }
+    return src;
+}
+
+// String building and comparison in blocks, so most results die young
+inline std::string generate_strings(size_t size) {
+    std::string src =
+        "fun str tag(str name, str body) {\n    return \"<\" + name + \">\" + body + \"</\" + name + \">\";\n}\n"
+        "let str title = \"benchmark results\";\n";
+    src.reserve(size + 256);
+    for (size_t i = 0; src.size() < size; i++) {
+        std::string n = std::to_string(i);
+        src += "{ let str row = tag(\"td\", title + \" " + n + "\"); let str page = tag(\"tr\", row + row + row); "
+               "let bool same = page == tag(\"tr\", row + row + row); }\n";
+    }
+    return src;
+}
+
+inline bool generate_workload(std::string_view name, size_t size, std::string& out) {
+    if (name == "let_chain") {
+        out = generate_let_chain(size);
+    }
+    else if (name == "deep_expr") {
+        out = generate_deep_expr(size);
+    }
+    else if (name == "arith_mix") {
+        out = generate_arith_mix(size);
+    }
+    else if (name == "calls") {
+        out = generate_calls(size);
+    }
+    else if (name == "strings") {
+        out = generate_strings(size);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
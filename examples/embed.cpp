@@ -0,0 +1,55 @@
+// Runs a P# script from C++ through libpsharp: the script is compiled once,
+// calls back into the host and is then run many times.
+//
+//     psharp_embed [runs]
+#include "../src/embed/include/psharp.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+static int64_t request = 0;
+
+static int64_t request_id() {
+    return request;
+}
+
+static double price(int64_t id, double qty) {
+    return (id % 7 + 1) * 1.5 * qty;
+}
+
+static const char *SOURCE = R"(
+fun f64 total(i64 id) {
+    return price(id, 3.0) + price(id + 1, 2.0);
+}
+let i64 id = request_id();
+let f64 due = total(id) * 2.0;
+)";
+
+int main(int argc, char **argv) {
+    long runs = argc > 1 ? std::atol(argv[1]) : 100000;
+
+    psharp::Engine engine(false);
+    engine.bind<&request_id>("request_id");
+    engine.bind<&price>("price");
+    auto script = engine.compile(SOURCE, "embed.ps");
+    if (script == nullptr) {
+        std::cerr << engine.error() << '\n';
+        return 1;
+    }
+    psharp::Global<double> due;
+    if (!script->global("due", due)) {
+        std::cerr << "no global 'due'\n";
+        return 1;
+    }
+
+    psharp::Instance instance(script);
+    double sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < runs; i++) {
+        request = i;
+        instance.run();
+        sum += instance.get(due);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << runs << " runs, sum " << sum << ", " << elapsed.count() / runs << " ns per run\n";
+}
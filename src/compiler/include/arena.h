@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+// Bump allocator. Everything allocated from an arena is released at once
+// when the arena is destroyed, so objects must be trivially destructible.
+class Arena {
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    std::vector<void*> blocks;
+    uint8_t *cur;
+    uint8_t *end;
+
+public:
+    Arena() : cur(nullptr), end(nullptr) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    ~Arena() {
+        for (auto block : blocks) {
+            std::free(block);
+        }
+    }
+
+    void *alloc(size_t size, size_t align) {
+        uint8_t *p = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(uintptr_t)(align - 1));
+        if (cur == nullptr || p + size > end) {
+            size_t block_size = size + align > BLOCK_SIZE ? size + align : BLOCK_SIZE;
+            cur = static_cast<uint8_t*>(std::malloc(block_size));
+            if (cur == nullptr) {
+                throw std::bad_alloc();
+            }
+            blocks.push_back(cur);
+            end = cur + block_size;
+            p = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(uintptr_t)(align - 1));
+        }
+        cur = p + size;
+        return p;
+    }
+
+    template<typename T, typename... Args>
+    T *make(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return new (alloc(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template<typename T>
+    T *make_array(size_t count) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+        return static_cast<T*>(alloc(sizeof(T) * count, alignof(T)));
+    }
+};
+
+// Identifier and type names, interned once and referred to by index.
+// Symbol 0 is the empty name.
+using Symbol = uint32_t;
+
+class SymbolTable {
+    Arena storage;
+    std::vector<std::string_view> names;
+    std::unordered_map<std::string_view, Symbol> ids;
+
+public:
+    SymbolTable() {
+        intern("");
+    }
+
+    Symbol intern(std::string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) {
+            return it->second;
+        }
+        char *copy = storage.make_array<char>(name.size() + 1);
+        std::copy(name.begin(), name.end(), copy);
+        copy[name.size()] = '\0';
+        std::string_view stored(copy, name.size());
+        Symbol id = names.size();
+        names.push_back(stored);
+        ids.emplace(stored, id);
+        return id;
+    }
+
+    std::string_view name(Symbol id) const {
+        return names[id];
+    }
+
+    size_t size() const {
+        return names.size();
+    }
+};
+
+// Owns everything a parsed program points into: the nodes and the names.
+struct ASTContext {
+    Arena arena;
+    SymbolTable symbols;
+
+    template<typename T, typename... Args>
+    T *make(Args&&... args) {
+        return arena.make<T>(std::forward<Args>(args)...);
+    }
+};
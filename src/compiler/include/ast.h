@@ -1,23 +1,29 @@
 #pragma once
+#include "arena.h"
 #include "location.h"
-#include "to_str.h"
 #include "token.h"
 #include <cmath>
-#include <memory>
 #include <uchar.h>
 
 #define LOC Location p
 #define AST ASTNode(p, get_type())
+#define EXPR ExprNode(p, get_type())
 
 enum NodeType : uint8_t {
     NODE_UNKNOWN,
 
     NODE_VDS,           // variable definition statement
+    NODE_FDS,           // function definition statement
+    NODE_RS,            // return statement
+    NODE_BS,            // block statement
+    NODE_IS,            // import statement
 
     NODE_BE,            // binary expression
     NODE_UE,            // unary expression
     NODE_LE,            // literal expression
     NODE_VE,            // variable expression
+    NODE_CE,            // call expression
+    NODE_CVE,           // conversion expression, inserted by Sema
 };
 
 enum TypeValue {
@@ -33,23 +39,26 @@ enum TypeValue {
     TYPE_CLASS
 };
 
-struct Type : ToStringable {
+// Trivially copyable handle. Built-in types are fully described by `type`;
+// class types also carry their interned name.
+struct Type {
     TypeValue type;
-    std::string name;
     bool is_const;
+    Symbol name;
 
-    Type(TypeValue t, std::string n, bool ic) : type(t), name(n), is_const(ic) {}
+    Type(TypeValue t, bool ic, Symbol n = 0) : type(t), is_const(ic), name(n) {}
 
-    bool operator==(Type& other) {
+    bool operator==(const Type& other) const {
         return type == other.type && name == other.name && is_const == other.is_const;
     }
 
-    bool operator!=(Type& other) {
+    bool operator!=(const Type& other) const {
         return !(*this == other);
     }
 
-    std::string to_str() const override {
-        return (is_const ? "const " : "") + name;
+    std::string to_str(const SymbolTable& symbols) const {
+        static const char *names[] = {"bool", "char", "i16", "i32", "i64", "f32", "f64", "noth", "str"};
+        return (is_const ? "const " : "") + std::string(type == TYPE_CLASS ? symbols.name(name) : names[type]);
     }
 };
 
@@ -63,26 +72,32 @@ struct Value {
         int64_t  l;
         float_t  f;
         double_t d;
+        Symbol   str;
     };
-    std::string str;
-    
-    Value(bool v)               : type(TYPE_BOOL, "bool", false),  b(v) {}
-    Value(char8_t v)            : type(TYPE_CHAR, "char", false),  c(v) {}
-    Value(int16_t v)            : type(TYPE_SHORT, "i16", false),  s(v) {}
-    Value(int32_t v)            : type(TYPE_INT, "i32", false),    i(v) {}
-    Value(int64_t v)            : type(TYPE_LONG, "i64", false),   l(v) {}
-    Value(float_t v)            : type(TYPE_FLOAT, "f32", false),  f(v) {}
-    Value(double_t v)           : type(TYPE_DOUBLE, "f64", false), d(v) {}
-    Value(const std::string& v) : type(TYPE_STR, "str", false),    str(v) {}
-    ~Value() = default;
+
+    Value(bool v)     : type(TYPE_BOOL, false),   b(v) {}
+    Value(char8_t v)  : type(TYPE_CHAR, false),   c(v) {}
+    Value(int16_t v)  : type(TYPE_SHORT, false),  s(v) {}
+    Value(int32_t v)  : type(TYPE_INT, false),    i(v) {}
+    Value(int64_t v)  : type(TYPE_LONG, false),   l(v) {}
+    Value(float_t v)  : type(TYPE_FLOAT, false),  f(v) {}
+    Value(double_t v) : type(TYPE_DOUBLE, false), d(v) {}
+
+    static Value string(Symbol v) {
+        Value val(false);
+        val.type = Type(TYPE_STR, false);
+        val.str = v;
+        return val;
+    }
 };
 
+// Nodes live in an ASTContext arena and are never destroyed one by one, so
+// they must stay trivially destructible.
 struct ASTNode {
     Location pos;
     NodeType type;
-    
+
     ASTNode(LOC, NodeType t) : pos(p), type(t) {}
-    virtual ~ASTNode() = default;
 
     template<typename T>
     T *as() {
@@ -101,57 +116,161 @@ struct ASTNode {
     }
 };
 
-using ASTNodePtr = std::shared_ptr<ASTNode>;
+using ASTNodePtr = ASTNode*;
+
+// What Sema resolved a variable to: a global index, or a frame slot of the
+// function or top-level block it appears in
+enum VarKind : uint8_t {
+    VAR_UNRESOLVED,
+    VAR_GLOBAL,
+    VAR_LOCAL,
+};
+
+// What Sema resolved a call to: a function index, or an index into the
+// host's native table
+enum FuncKind : uint8_t {
+    FUNC_UNRESOLVED,
+    FUNC_SCRIPT,
+    FUNC_NATIVE,
+};
+
+// Sema sets `value_type` on every expression it checks; CodeGen never
+// computes a type itself.
+struct ExprNode : ASTNode {
+    Type value_type = Type(TYPE_NOTH, false);
+
+    ExprNode(LOC, NodeType t) : ASTNode(p, t) {}
+};
+
+inline const Type& expr_type(const ASTNode& expr) {
+    return static_cast<const ExprNode&>(expr).value_type;
+}
 
 struct VDSNode : ASTNode {
-    std::string name;
+    Symbol name;
     Type type;
-    ASTNodePtr expr;
+    ASTNodePtr expr;            // converted to `type` by Sema
+    VarKind kind = VAR_UNRESOLVED;
+    uint32_t index = 0;         // global index or frame slot
 
     static NodeType get_type() { return NODE_VDS; }
 
-    VDSNode(Type t, std::string n, ASTNodePtr e, LOC) : type(t), name(n), expr(e), AST {}
-    ~VDSNode() override = default;
+    VDSNode(Type t, Symbol n, ASTNodePtr e, LOC) : type(t), name(n), expr(e), AST {}
+};
+
+struct Param {
+    Type type;
+    Symbol name;
 };
 
-struct BENode : ASTNode {
+struct FDSNode : ASTNode {
+    Type type;                  // return type
+    Symbol name;
+    Param *params;
+    uint32_t param_count;
+    ASTNodePtr *body;
+    uint32_t body_count;
+
+    static NodeType get_type() { return NODE_FDS; }
+
+    FDSNode(Type t, Symbol n, Param *ps, uint32_t pc, ASTNodePtr *b, uint32_t bc, LOC) : type(t), name(n), params(ps), param_count(pc), body(b), body_count(bc), AST {}
+};
+
+struct RSNode : ASTNode {
+    ASTNodePtr expr;
+    bool tail = false;          // a call to a function of the same type, which can reuse the frame
+
+    static NodeType get_type() { return NODE_RS; }
+
+    RSNode(ASTNodePtr e, LOC) : expr(e), AST {}
+};
+
+struct BSNode : ASTNode {
+    ASTNodePtr *stmts;
+    uint32_t stmt_count;
+
+    static NodeType get_type() { return NODE_BS; }
+
+    BSNode(ASTNodePtr *s, uint32_t sc, LOC) : stmts(s), stmt_count(sc), AST {}
+};
+
+// Resolved by the module builder (see module.h); the rest of the frontend
+// skips it
+struct ISNode : ASTNode {
+    Symbol path;                // as written, relative to the importing file
+
+    static NodeType get_type() { return NODE_IS; }
+
+    ISNode(Symbol pa, LOC) : path(pa), AST {}
+};
+
+// Both operands have the same type once Sema is done
+struct BENode : ExprNode {
     TokenType op;
     ASTNodePtr LHS;
     ASTNodePtr RHS;
 
     static NodeType get_type() { return NODE_BE; }
 
-    BENode(TokenType op, ASTNodePtr LHS, ASTNodePtr RHS, LOC) : op(op), LHS(LHS), RHS(RHS), AST {}
-    ~BENode() override = default;
+    BENode(TokenType op, ASTNodePtr LHS, ASTNodePtr RHS, LOC) : op(op), LHS(LHS), RHS(RHS), EXPR {}
 };
 
-struct UENode : ASTNode {
+struct UENode : ExprNode {
     TokenType op;
     ASTNodePtr expr;
 
     static NodeType get_type() { return NODE_UE; }
 
-    UENode(TokenType op, ASTNodePtr e, LOC) : op(op), expr(e), AST {}
-    ~UENode() override = default;
+    UENode(TokenType op, ASTNodePtr e, LOC) : op(op), expr(e), EXPR {}
 };
 
-struct LENode : ASTNode {
+struct LENode : ExprNode {
     Value val;
 
     static NodeType get_type() { return NODE_LE; }
 
-    LENode(Value v, LOC) : val(v), AST {}
-    ~LENode() override = default;
+    LENode(Value v, LOC) : val(v), EXPR {
+        value_type = v.type;
+    }
 };
 
-struct VENode : ASTNode {
-    std::string name;
+struct VENode : ExprNode {
+    Symbol name;
+    VarKind kind = VAR_UNRESOLVED;
+    uint32_t index = 0;         // global index or frame slot
 
     static NodeType get_type() { return NODE_VE; }
 
-    VENode(std::string n, LOC) : name(n), AST {}
-    ~VENode() override = default;
+    VENode(Symbol n, LOC) : name(n), EXPR {}
 };
 
+// Arguments are converted to the parameter types by Sema
+struct CENode : ExprNode {
+    Symbol name;
+    ASTNodePtr *args;
+    uint32_t arg_count;
+    FuncKind kind = FUNC_UNRESOLVED;
+    uint32_t index = 0;         // function or native index
+
+    static NodeType get_type() { return NODE_CE; }
+
+    CENode(Symbol n, ASTNodePtr *a, uint32_t ac, LOC) : name(n), args(a), arg_count(ac), EXPR {}
+};
+
+// Widens `expr` to `value_type`. Only integer to floating point conversions
+// change the bits; the others keep the value as it is.
+struct CVENode : ExprNode {
+    ASTNodePtr expr;
+
+    static NodeType get_type() { return NODE_CVE; }
+
+    CVENode(ASTNodePtr e, Type to, LOC) : expr(e), EXPR {
+        value_type = to;
+    }
+};
+
+static_assert(std::is_trivially_copyable_v<Type> && std::is_trivially_copyable_v<Value>, "types and values are passed by value");
+
+#undef EXPR
 #undef AST
 #undef LOC
\ No newline at end of file
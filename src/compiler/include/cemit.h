@@ -0,0 +1,61 @@
+#pragma once
+#include "../../vm/include/vm.h"
+#include "ast.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Translates a finished stack chunk into a standalone C program. The operand
+// stack is replayed at translation time, so every statement becomes a single
+// C statement over nested expressions and the arithmetic lands as plain C
+// operators. Globals and functions keep the source names and C types from
+// the chunk's symbol table (see LinkTable); without one their values become
+// untyped 64-bit slots.
+//
+// The output needs -fwrapv for the VM's wrapping integer arithmetic. Calls
+// nest at most VM::DEFAULT_FRAME_COUNT deep, as in the VM, and end the
+// program with its "Call stack overflow" error beyond that.
+class CEmitter {
+    // How a value is represented: int64_t, double, the Slot union, or a
+    // constant whose type only its user knows
+    enum Kind : uint8_t { KIND_INT, KIND_FLOAT, KIND_SLOT, KIND_CONST };
+
+    struct Value {
+        std::string text;
+        Kind kind;
+        int64_t bits = 0;           // KIND_CONST
+    };
+    struct Var {
+        std::string name;
+        Kind kind;
+        std::string label;          // source name, for the globals dump
+    };
+    struct Func {
+        std::string name;
+        Kind ret;
+        std::vector<Kind> params;
+    };
+
+    const Chunk& chunk;
+    std::vector<Var> globals;
+    std::vector<Func> functions;
+    std::vector<Value> stack;
+    uint32_t next_temp = 0;
+
+public:
+    CEmitter(const Chunk& c);
+
+    // False, with nothing written, for register chunks and chunks that use
+    // strings, which would need the VM's heap
+    bool emit(std::ostream& out);
+
+private:
+    bool supported() const;
+    void emit_body(size_t start, uint32_t num_slots, const Func *fn, std::ostream& out);
+    void store(const Var& var, const Value& val, std::ostream& out);
+    void spill(std::ostream& out);
+    Value pop();
+
+    static const char *c_type(Kind kind);
+    static std::string render(const Value& val, Kind want);
+};
@@ -1,38 +1,79 @@
 #pragma once
 #include "../../vm/include/vm.h"
 #include "ast.h"
-#include <unordered_map>
-#include <utility>
+#include "sema.h"
 #include <vector>
 
+enum Backend : uint8_t {
+    BACKEND_STACK,      // OpCodes
+    BACKEND_REG,        // RegOpCodes
+};
+
+// Walks the tree Sema resolved and typed (see sema.h): variables, calls and
+// conversions carry everything needed to emit them.
 class CodeGen {
     std::string_view file_name;
     std::vector<ASTNodePtr> stmts;
+    const ASTContext& ctx;
+    const Sema& sema;
     Chunk *c_chunk;
-    
-    struct GlobVar {
-        Type type;
-        StackSlot val;
-        size_t index;
-    };
-    std::unordered_map<std::string, GlobVar> global_vars;
-    static std::unordered_map<TypeValue, std::vector<TypeValue>> implicitly_cast_allowed_types;
+    Backend backend;
+    uint32_t next_temp;
+
+    // Function bodies are generated into their own buffer and appended after
+    // the top-level code.
+    std::vector<uint8_t> func_code;
+    uint32_t max_slots;             // of the current function or the top level
+    std::vector<uint32_t> string_literals;      // pool offsets by Symbol, UINT32_MAX if not laid out
 
 public:
-    CodeGen(std::string_view fn, std::vector<ASTNodePtr>& s) : file_name(fn), stmts(s) {}
+    CodeGen(std::string_view fn, std::vector<ASTNodePtr>& s, const ASTContext& c, const Sema& se, Backend b = BACKEND_STACK) : file_name(fn), stmts(s), ctx(c), sema(se), backend(b), next_temp(0), max_slots(0) {}
 
+    // Imported functions (see Sema::import_function) get placeholder entries
+    // for the linker
     Chunk *generate();
 
+    // Incremental generation for the REPL, stack backend only. extend()
+    // generates further top-level statements into the chunk generate() or an
+    // earlier extend() returned, and returns the offset of their top-level
+    // code. Both extend() and revert(), which undoes an extend() that failed
+    // with a CompileError, take the mark() from before Sema analyzed the
+    // statements, so that it does not count the globals they define.
+    struct Mark {
+        size_t code, constants, functions, strings;
+        uint32_t globals, slots;
+    };
+    Mark mark(const Chunk& chunk) const;
+    uint32_t extend(Chunk& chunk, std::vector<ASTNodePtr> more, const Mark& m);
+    void revert(Chunk& chunk, const Mark& m);
+
 private:
+    void finish_stack_code(uint32_t first_func, uint32_t old_globals);
     void generate_stmt(const ASTNode& stmt);
     void generate_vds_stmt(const VDSNode& vds);
+    void generate_fds_stmt(const FDSNode& fds);
+    void generate_rs_stmt(const RSNode& rs);
+    void generate_block(ASTNodePtr *stmts, uint32_t count);
+    void push_local_op(uint8_t op, uint8_t short_op, uint8_t slot);
+    void push_str(Symbol value, Location pos);
+
+    void generate_expr(const ASTNode& expr);
+    void generate_be_expr(const BENode& be);
+    void generate_ue_expr(const UENode& ue);
+    void generate_le_expr(const LENode& le);
+    void generate_ve_expr(const VENode& ve);
+    void generate_ce_expr(const CENode& ce, bool tail = false);
+    void generate_cve_expr(const CVENode& cve);
+
+    // Register backend. Operands are tagged with their register file section
+    // while generating and relocated once all sections are sized.
+    void generate_reg_vds_stmt(const VDSNode& vds);
+    void generate_reg_expr(const ASTNode& expr, uint32_t& operand, uint32_t dst);
+    uint32_t add_reg_const(StackSlot slot);
+    void relocate_reg_operands();
 
-    Type generate_expr(const ASTNode& expr);
-    Type generate_be_expr(const BENode& be);
-    Type generate_ue_expr(const UENode& ue);
-    Type generate_le_expr(const LENode& le);
-    Type generate_ve_expr(const VENode& ve);
+    void push_index(uint32_t index);
 
-    bool has_common_type(Type LHS, Type RHS);
-    Type get_common_type(Type LHS, Type RHS, Location pos);
-};
\ No newline at end of file
+    static bool is_ref(Type type) { return type.type == TYPE_STR || type.type == TYPE_CLASS; }
+    static bool is_int(Type type) { return type.type <= TYPE_LONG; }
+};
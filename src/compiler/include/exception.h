@@ -3,9 +3,20 @@
 #include <iostream>
 #include <sstream>
 
+// Thrown by error() on threads that set error_throws, such as the REPL's,
+// which must survive a bad entry, and the embedding API's. Everywhere else
+// errors are printed and exit.
+struct CompileError {
+    std::string message;        // as it would have been printed
+};
+inline thread_local bool error_throws = false;
+
 inline void error(std::string_view file_name, std::string_view msg, Location loc) {
     std::stringstream ss;
     ss << "\033[31mCompilation error at: \033[0m" << file_name << ':' << loc.to_str() << ":\033[31m\n" << msg << "\033[0m\n";
+    if (error_throws) {
+        throw CompileError{ss.str()};
+    }
     std::cerr << ss.str();
     exit(1);
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+#include "../../vm/include/vm.h"
+#include <cstdint>
+#include <vector>
+
+// Typed SSA form of stack code, for the optimizer. P# has no control flow,
+// so the top-level code and every function body are single basic blocks and
+// no value ever needs a phi. Frame slots are written once per definition, so
+// a slot load names the value stored into it and slots disappear entirely;
+// lowering allocates new ones only for values it cannot keep on the stack.
+enum IRType : uint8_t {
+    IR_VOID,            // no result
+    IR_INT,
+    IR_FLOAT,
+    IR_REF,             // string, including short ones held in a constant
+    IR_WORD,            // an integer or a double: globals, parameters and results of those types, and constants until used
+};
+
+// One instruction, and the value it defines. `op` is a base OpCode or one of
+// the optimizer's strength-reduced forms. OP_LDLOC stands for a parameter as
+// the block received it; the other slot and superinstruction opcodes never
+// appear.
+struct IRInst {
+    uint8_t op;
+    IRType type;
+    bool live = true;
+    uint32_t imm = 0;               // constant, global, function, string or native index, parameter slot or shift count
+    std::vector<uint32_t> args;     // values, by index in the block
+};
+
+struct IRBlock {
+    std::vector<IRInst> insts;      // in execution order
+    uint32_t arity = 0;             // frame slots that are parameters
+};
+
+namespace ir {
+    // Lifts the body of function `func`, or the top-level code for
+    // UINT32_MAX, up to its RET, TAILCALL or HALT, and sets `end` past it.
+    // False if the code is not plain compiler output (superinstructions,
+    // operands that mix references and scalars, an unbalanced stack).
+    bool lift(const Chunk& chunk, uint32_t func, IRBlock& block, size_t& end);
+
+    // Appends stack code for the live instructions to `code` and sets
+    // `num_slots` to the frame size it needs, parameters included. False if
+    // that would exceed the 256 slots a frame can address.
+    bool lower(const IRBlock& block, std::vector<uint8_t>& code, uint32_t& num_slots);
+
+    // No effect besides the value, so an unused instance may be dropped and
+    // two with the same operands merged
+    bool is_pure(uint8_t op);
+}
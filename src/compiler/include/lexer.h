@@ -1,20 +1,21 @@
 #pragma once
 #include "token.h"
-#include <unordered_map>
 #include <cstdint>
 #include <vector>
 
+// The lexer does not copy its input: `s` must outlive the lexer and every
+// token it produces.
 class Lexer {
-    std::string src;
+    std::string_view src;
     std::string_view file_name;
     uint64_t pos;
     Location loc;
-    static std::unordered_map<std::string_view, TokenType> spec_symbols;
 
 public:
     Lexer(const std::string_view s, const std::string_view fn) : src(s), file_name(fn), pos(0), loc(1, 1) {}
 
     std::vector<Token> tokenize();
+    Token next();           // TOK_EOF once the input is exhausted
 
 private:
     Token tokenize_num();
@@ -23,6 +24,8 @@ private:
     Token tokenize_id();
     Token tokenize_op();
     void skip_comments();
+    void skip_spaces();
+    void advance_to(uint64_t new_pos);
     const char peek(uint64_t rpos = 0) const;
     const char advance();
 };
\ No newline at end of file
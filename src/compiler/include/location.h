@@ -1,14 +1,13 @@
 #pragma once
-#include "to_str.h"
 #include <cstdint>
 #include <string>
 
-struct Location : ToStringable {
-    uint64_t line, column;
+struct Location {
+    uint32_t line, column;
 
-    Location(uint64_t l, uint64_t c) : line(l), column(c) {}
+    Location(uint32_t l, uint32_t c) : line(l), column(c) {}
 
-    std::string to_str() const override {
+    std::string to_str() const {
         return std::to_string(line) + ":" + std::to_string(column);
     }
-};
\ No newline at end of file
+};
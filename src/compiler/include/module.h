@@ -0,0 +1,92 @@
+#pragma once
+#include "../../vm/include/bytecode.h"
+#include "../../vm/include/vm.h"
+#include "ast.h"
+#include "codegen.h"
+#include "source.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Names and types behind a chunk's global and function indices, in index
+// order. A module's imports come first; they are placeholders that the
+// linker binds to the module defining them. Stored in Chunk::symbols.
+struct LinkTable {
+    struct Global {
+        std::string name;
+        TypeValue type;
+        bool is_const;
+    };
+    struct Function {
+        std::string name;
+        TypeValue ret;
+        std::vector<TypeValue> params;
+    };
+    std::vector<Global> globals;
+    std::vector<Function> functions;
+    uint32_t imported_globals = 0;
+    uint32_t imported_functions = 0;
+
+    std::vector<uint8_t> encode() const;
+
+    // False on malformed input
+    bool decode(const uint8_t *data, size_t size);
+};
+
+// One source file of a program
+struct Module {
+    std::string path;                   // canonical
+    SourceBuffer source;
+    std::vector<std::pair<uint32_t, Location>> imports;    // module and import statement
+    std::vector<uint32_t> importers;
+    std::atomic<uint32_t> waiting{0};   // imports not compiled yet
+    SourceKey key;                      // source, options and the imports' keys
+    Chunk *chunk = nullptr;
+    LinkTable table;
+};
+
+// Builds the program rooted at one file. The import graph is scanned first;
+// then every module is compiled on its own on a thread pool, as soon as the
+// modules it imports are, and the chunks are linked into one. Module chunks
+// are cached unlinked and unoptimized, keyed by their source and the keys of their imports,
+// so an edit recompiles only the edited file and its importers.
+//
+// Imports are not transitive: a file sees the globals and functions defined
+// by the files it imports itself. All names share one program-wide
+// namespace, so two modules cannot define the same name. Top-level code runs
+// module by module, every import before its importers.
+class ModuleBuilder {
+    Backend backend;
+    bool use_cache;
+    size_t threads;
+    uint8_t opt_level;
+    SourceKey options_key;
+    std::vector<LinkTable::Function> natives;              // by OP_NCALL index
+    std::vector<std::unique_ptr<Module>> modules;          // imports before importers
+    std::unordered_map<std::string, uint32_t> module_index;
+    std::vector<std::string> import_chain;                  // files being scanned, outermost first
+
+public:
+    // 0 threads means one per hardware thread. Every module sees the host
+    // functions `n` (see psharp.h) as if it had imported them. The linked
+    // program is optimized at `level` (see optimizer.h).
+    ModuleBuilder(Backend b, bool cache, size_t t = 0, std::vector<LinkTable::Function> n = {}, uint8_t level = 1);
+    ~ModuleBuilder();
+
+    // nullptr if the root file cannot be opened; compilation and link errors
+    // exit like the rest of the frontend, or throw CompileError on a thread
+    // that set error_throws. `text`, when given, is the root file's source in
+    // place of its contents on disk.
+    Chunk *build(const std::string& path, const std::string *text = nullptr);
+
+    // Identifies the program build() returned: every source and the options
+    SourceKey program_key() const;
+
+private:
+    uint32_t scan(const std::string& path, const std::string *text = nullptr);
+    void compile(Module& module);
+    Chunk *link();
+    Chunk *optimize(Chunk *chunk);
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include "../../vm/include/vm.h"
+#include "ir.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Optimizes a linked stack chunk in SSA form (see ir.h), before Peephole
+// fuses what is left into superinstructions.
+//
+//     -O0  nothing
+//     -O1  per block: store-to-load forwarding and algebraic identities,
+//          constant folding, strength reduction, value numbering, dead code
+//     -O2  also drops stores to globals no code reads; such globals stay 0
+//          for anyone reading them from outside (the REPL, psharp::Instance)
+class Optimizer {
+    Chunk& chunk;
+    uint8_t level;
+    std::unordered_map<int64_t, uint32_t> constant_index;  // by bits
+
+public:
+    Optimizer(Chunk& c, uint8_t l) : chunk(c), level(l) {}
+
+    // Leaves the chunk as it is if any block cannot be lifted or lowered
+    void run();
+
+private:
+    uint32_t constant(int64_t bits);
+    bool constant_of(const IRBlock& block, uint32_t val, int64_t& bits) const;
+    void propagate_copies(IRBlock& block);
+    void reduce_strength(IRBlock& block);
+    void number_values(IRBlock& block);
+    void eliminate_dead(IRBlock& block, const std::vector<uint8_t>& read_globals);
+};
@@ -2,21 +2,38 @@
 #include "location.h"
 #include "token.h"
 #include "ast.h"
+#include "lexer.h"
+#include <deque>
 #include <vector>
 
+// Tokens are pulled from the lexer on demand, so only the lookahead window
+// is ever materialized. A prebuilt token list is accepted as well.
 class Parser {
     std::string_view file_name;
+    Lexer *lex;
     std::vector<Token> tokens;
-    uint32_t pos;
+    uint32_t pos;                   // next unread index into `tokens`
+    Token previous;
+    std::deque<Token> lookahead;
+    ASTContext& ctx;
 
 public:
-    Parser(std::string_view fn, std::vector<Token> t) : file_name(fn), tokens(std::move(t)), pos(0) {}
+    Parser(std::string_view fn, Lexer& l, ASTContext& c) : file_name(fn), lex(&l), pos(0), previous(TOK_EOF, {0, 0}), ctx(c) {}
+    Parser(std::string_view fn, std::vector<Token> t, ASTContext& c) : file_name(fn), lex(nullptr), tokens(std::move(t)), pos(0), previous(TOK_EOF, {0, 0}), ctx(c) {}
 
     std::vector<ASTNodePtr> parse();
 
+    // Only the import statements, which must come first in a file
+    std::vector<ASTNodePtr> parse_imports();
+
 private:
     ASTNodePtr parse_stmt();
     ASTNodePtr parse_vds_stmt();
+    ASTNodePtr parse_fds_stmt();
+    ASTNodePtr parse_rs_stmt();
+    ASTNodePtr parse_bs_stmt();
+    ASTNodePtr parse_is_stmt();
+    std::vector<ASTNodePtr> parse_block();
 
     ASTNodePtr parse_expr();
     ASTNodePtr parse_land_expr();
@@ -27,8 +44,14 @@ private:
     ASTNodePtr parse_multiplicative_expr();
     ASTNodePtr parse_unary_expr();
     ASTNodePtr parse_primary_expr();
+    ASTNodePtr parse_call_expr(const Token& name);
+
+    template<typename T>
+    T *to_arena(const std::vector<T>& items);
 
-    const Token peek(uint32_t rpos = 0) const;
+    const Token& peek(int32_t rpos = 0);
+    void advance();
+    Token pull();
     bool match(TokenType type);
     Token consume(TokenType type, std::string_view err, Location pos);
     void consume_semicolon();
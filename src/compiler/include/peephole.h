@@ -0,0 +1,19 @@
+#pragma once
+#include "../../vm/include/vm.h"
+
+// Rewrites common instruction sequences of a finished stack chunk into the
+// superinstructions at the end of OpCodes. Chunks have no jumps; the only
+// addresses to fix up are the function entries.
+class Peephole {
+    Chunk& chunk;
+
+public:
+    Peephole(Chunk& c) : chunk(c) {}
+
+    // Only the code from `start` on, whose first function is `first_func`;
+    // the code before it is left alone (see CodeGen::extend)
+    void run(size_t start = 0, size_t first_func = 0);
+
+private:
+    size_t match(const uint8_t *code, size_t pos, size_t size, std::vector<uint8_t>& out) const;
+};
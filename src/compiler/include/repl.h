@@ -0,0 +1,41 @@
+#pragma once
+#include "../../vm/include/vm.h"
+#include "ast.h"
+#include "codegen.h"
+#include "sema.h"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Interactive session over one live chunk. Every entry is compiled against
+// the symbol tables of the entries before it and appended to the chunk, and
+// only the new code runs; globals keep their values in the session's VM. The
+// cost of an entry depends on its size, not on the length of the session.
+//
+// Stack backend only. The VM shares the chunk, which is written only
+// between executions; its string pool is reserved at its largest size up
+// front, so literals never move.
+class Repl {
+    ASTContext ctx;
+    std::vector<ASTNodePtr> no_stmts;
+    Chunk *chunk;                   // owned by `vm`
+    Sema sema;
+    CodeGen codegen;
+    VM vm;
+
+public:
+    explicit Repl(const HeapConfig& heap = HeapConfig());
+
+    // Compiles and runs one entry of complete statements and writes the
+    // globals it defined to `out`. False on a compile error, which leaves
+    // the session as it was.
+    bool eval(std::string_view src, std::ostream& out);
+
+    // Evaluates entries from `in` until it ends. An entry ends with a line
+    // that closes every brace and its last statement; `prompt` shows the
+    // prompts for interactive use.
+    void run(std::istream& in, std::ostream& out, bool prompt);
+
+private:
+    void print_global(Symbol name, std::ostream& out);
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include "ast.h"
+#include <vector>
+
+// Resolves names, checks types and folds constants, once. Every variable
+// and call is bound to its index, every expression gets its type and every
+// implicit widening becomes a CVENode, so CodeGen only walks the result.
+//
+// Names are looked up in tables indexed by Symbol, which hold the innermost
+// binding of each name; a block's locals restore the bindings they shadow
+// when it ends.
+class Sema {
+public:
+    struct GlobalVar {
+        Symbol name;
+        Type type;
+        LENode *value;              // literal of a const global
+    };
+
+private:
+    std::string_view file_name;
+    std::vector<ASTNodePtr> stmts;
+    ASTContext& ctx;
+
+    std::vector<GlobalVar> global_vars;                 // by global index, imports first
+    std::vector<const FDSNode*> funcs;                  // by function index, imports first
+    uint32_t imported_funcs = 0;
+    struct Native {
+        const FDSNode *decl;
+        uint32_t index;                                 // in the host's table
+    };
+    std::vector<Native> natives;
+    size_t old_globals = 0, old_funcs = 0;              // before the last analyze(), for forget()
+
+    // Parameters and block locals, innermost last. A local's frame slot is
+    // its index here, so sibling blocks reuse the same slots.
+    struct LocalVar {
+        Symbol name;
+        Type type;
+        LENode *value;              // literal of a const local
+        uint32_t shadowed;          // the name's binding before this one
+    };
+    std::vector<LocalVar> locals;
+    uint32_t scope_depth = 0;
+    const FDSNode *cur_func = nullptr;
+
+    // By Symbol: UNBOUND, a global index or LOCAL | an index into `locals`
+    // for variables; a function index or NATIVE | an index into `natives`
+    // for functions. Variables and functions have separate namespaces.
+    static constexpr uint32_t UNBOUND = UINT32_MAX;
+    static constexpr uint32_t LOCAL = 1u << 31;
+    static constexpr uint32_t NATIVE = 1u << 31;
+    std::vector<uint32_t> var_scope, func_scope;
+
+public:
+    Sema(std::string_view fn, std::vector<ASTNodePtr>& s, ASTContext& c) : file_name(fn), stmts(s), ctx(c) {}
+
+    std::vector<ASTNodePtr> analyze();
+
+    // Incremental use (see Repl): analyzes further top-level statements with
+    // everything analyzed so far in scope. forget() drops the names the last
+    // analyze() defined, when it or compiling its result failed.
+    std::vector<ASTNodePtr> analyze(std::vector<ASTNodePtr> more);
+    void forget();
+
+    // Definitions from other modules (see ModuleBuilder), made before
+    // analyze(). They take the first global and function indices, in call
+    // order. False if the name is already taken.
+    bool import_global(Symbol name, Type type);
+    bool import_function(const FDSNode *decl);
+
+    // Host functions (see psharp.h), called by their index in the embedder's
+    // table. False if the name is already taken.
+    bool import_native(const FDSNode *decl, uint32_t index);
+
+    // Index and type of a top-level variable; false if there is none
+    bool find_global(Symbol name, uint32_t& index, Type& type) const;
+
+    const std::vector<GlobalVar>& globals() const { return global_vars; }
+    const std::vector<const FDSNode*>& functions() const { return funcs; }
+    uint32_t imported_functions() const { return imported_funcs; }
+
+private:
+    void analyze_stmt(ASTNode& stmt);
+    void analyze_vds_stmt(VDSNode& vds);
+    void analyze_fds_stmt(FDSNode& fds);
+    void analyze_rs_stmt(RSNode& rs);
+    void analyze_block(ASTNodePtr *stmts, uint32_t count);
+    void bind_local(Symbol name, Type type, LENode *value);
+    void unbind_locals(size_t mark);
+    uint32_t& binding(std::vector<uint32_t>& scope, Symbol name);
+
+    // Each returns the checked (possibly replaced) expression, typed
+    ASTNodePtr analyze_expr(ASTNodePtr expr);
+    ASTNodePtr analyze_be_expr(BENode& be);
+    ASTNodePtr analyze_ue_expr(UENode& ue);
+    ASTNodePtr analyze_ve_expr(VENode& ve);
+    ASTNodePtr analyze_ce_expr(CENode& ce);
+    ASTNodePtr fold_be_expr(BENode& be);
+    ASTNodePtr fold_ue_expr(UENode& ue);
+
+    // `expr` as a value of type `to`, or nullptr if it cannot be
+    ASTNodePtr convert(ASTNodePtr expr, Type to);
+};
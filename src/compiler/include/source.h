@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <string_view>
+
+// Read-only view of a source file. The file is mapped rather than read, so
+// the text is never copied; tokens and the lexer point straight into it.
+class SourceBuffer {
+    void *mapping;
+    size_t size;
+    std::string owned;
+
+public:
+    SourceBuffer() : mapping(nullptr), size(0) {}
+    explicit SourceBuffer(std::string text) : mapping(nullptr), size(0), owned(std::move(text)) {}
+    SourceBuffer(const SourceBuffer&) = delete;
+    SourceBuffer& operator=(const SourceBuffer&) = delete;
+    ~SourceBuffer();
+
+    // Returns false if the file cannot be opened or mapped
+    bool open(const std::string& path);
+
+    // Holds `text` instead of a file; only before open()
+    void assign(std::string text) { owned = std::move(text); }
+
+    std::string_view text() const {
+        return mapping ? std::string_view(static_cast<const char*>(mapping), size) : std::string_view(owned);
+    }
+};
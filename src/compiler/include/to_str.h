@@ -1,6 +0,0 @@
-#pragma once
-#include <string>
-
-struct ToStringable {
-    virtual std::string to_str() const = 0;
-};
\ No newline at end of file
@@ -1,6 +1,5 @@
 #pragma once
 #include "location.h"
-#include "to_str.h"
 #include <string_view>
 
 enum TokenType {
@@ -23,10 +22,12 @@ enum TokenType {
     TOK_LONG,
     TOK_FLOAT,
     TOK_DOUBLE,
+    TOK_STR,
     TOK_LET,
     TOK_FUN,
     TOK_RET,
     TOK_CONST,
+    TOK_IMPORT,
 
     // operators
     TOK_PLUS,
@@ -54,17 +55,26 @@ enum TokenType {
     TOK_RBRACE,
     TOK_LBRACKET,
     TOK_RBRACKET,
+
+    TOK_EOF,
 };
 
-struct Token : ToStringable {
+// `val` points into the source buffer, which must outlive the token.
+// Numeric literals are converted by the lexer: integer literals fill `ival`,
+// floating point literals fill `fval`.
+struct Token {
     TokenType type;
-    std::string val;
+    std::string_view val;
     Location pos;
+    union {
+        int64_t ival;
+        double fval;
+    };
 
-    Token(TokenType t, Location p) : type(t), val(""), pos(p) {}
-    Token(TokenType t, const std::string& v, Location p) : type(t), val(v), pos(p) {}
+    Token(TokenType t, Location p) : type(t), val(), pos(p), ival(0) {}
+    Token(TokenType t, std::string_view v, Location p) : type(t), val(v), pos(p), ival(0) {}
 
-    std::string to_str() const override {
-        return std::to_string(type) + " : '" + val + "' (" + pos.to_str() + ")";
+    std::string to_str() const {
+        return std::to_string(type) + " : '" + std::string(val) + "' (" + pos.to_str() + ")";
     }
 };
\ No newline at end of file
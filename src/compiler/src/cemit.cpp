@@ -0,0 +1,383 @@
+#include "../include/cemit.h"
+#include "../include/module.h"
+#include "../../vm/include/opcodes.h"
+#include <cmath>
+#include <cstring>
+#include <ostream>
+
+static const char *PRELUDE =
+    "/* Generated by psharp --emit-c; build with -fwrapv and -lm. */\n"
+    "#include <inttypes.h>\n"
+    "#include <math.h>\n"
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "\n"
+    "typedef union { int64_t i; double f; } Slot;\n"
+    "\n"
+    "static inline double ps_f64(int64_t i) { double f; memcpy(&f, &i, sizeof f); return f; }\n"
+    "static inline int64_t ps_i64(double f) { int64_t i; memcpy(&i, &f, sizeof i); return i; }\n";
+
+static std::string int_literal(int64_t val) {
+    if (val == INT64_MIN) {
+        return "INT64_MIN";
+    }
+    std::string text = std::to_string(val);
+    if (val != (int32_t)val) {
+        text = "INT64_C(" + text + ")";
+    }
+    return val < 0 ? "(" + text + ")" : text;
+}
+
+// Exact: 17 significant digits round-trip every double
+static std::string float_literal(int64_t bits) {
+    double val;
+    memcpy(&val, &bits, sizeof val);
+    if (!std::isfinite(val)) {
+        return "ps_f64(" + int_literal(bits) + ")";
+    }
+    char buf[32];
+    snprintf(buf, sizeof buf, "%.17g", val);
+    std::string text = buf;
+    if (text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return text[0] == '-' ? "(" + text + ")" : text;
+}
+
+CEmitter::CEmitter(const Chunk& c) : chunk(c) {
+    auto kind_of = [](TypeValue type) {
+        if (type >= TYPE_BOOL && type <= TYPE_LONG) return KIND_INT;
+        if (type == TYPE_FLOAT || type == TYPE_DOUBLE) return KIND_FLOAT;
+        return KIND_SLOT;
+    };
+    const Function *funcs = chunk.func_data();
+    LinkTable table;
+    bool named = chunk.sym_size() > 0 && table.decode(chunk.sym_data(), chunk.sym_size()) &&
+                 table.globals.size() == chunk.num_globals && table.functions.size() == chunk.func_count();
+    for (size_t i = 0; named && i < table.functions.size(); i++) {
+        named = table.functions[i].params.size() == funcs[i].arity;
+    }
+    if (named) {
+        for (auto& global : table.globals) {
+            globals.push_back({"g_" + global.name, kind_of(global.type), global.name});
+        }
+        for (auto& decl : table.functions) {
+            Func fn{"f_" + decl.name, kind_of(decl.ret), {}};
+            for (TypeValue param : decl.params) {
+                fn.params.push_back(kind_of(param));
+            }
+            functions.push_back(std::move(fn));
+        }
+        return;
+    }
+    for (uint32_t i = 0; i < chunk.num_globals; i++) {
+        std::string name = "g" + std::to_string(i);
+        globals.push_back({name, KIND_SLOT, name});
+    }
+    for (size_t i = 0; i < chunk.func_count(); i++) {
+        functions.push_back({"f" + std::to_string(i), KIND_SLOT, std::vector<Kind>(funcs[i].arity, KIND_SLOT)});
+    }
+}
+
+bool CEmitter::supported() const {
+    if (chunk.kind != CHUNK_STACK) {
+        return false;
+    }
+    const uint8_t *refs = chunk.ref_data();
+    for (size_t i = 0; i < chunk.ref_size(); i++) {
+        if (refs[i]) {
+            return false;
+        }
+    }
+    const uint8_t *code = chunk.code_data();
+    for (size_t pos = 0; pos < chunk.code_size(); pos += op_size(code[pos])) {
+        switch (code[pos]) {
+            case OP_PSTR: case OP_SCAT: case OP_SEQ: case OP_SNE: case OP_PRINTO: case OP_NCALL:
+                return false;
+        }
+    }
+    return true;
+}
+
+bool CEmitter::emit(std::ostream& out) {
+    if (!supported()) {
+        return false;
+    }
+    out << PRELUDE << '\n';
+
+    auto signature = [&](const Func& fn) {
+        out << "static " << c_type(fn.ret) << ' ' << fn.name << '(';
+        for (size_t i = 0; i < fn.params.size(); i++) {
+            out << (i ? ", " : "") << c_type(fn.params[i]) << " s" << i;
+        }
+        out << (fn.params.empty() ? "void)" : ")");
+    };
+    for (auto& fn : functions) {
+        signature(fn);
+        out << ";\n";
+    }
+    if (!functions.empty()) {
+        out << '\n';
+    }
+
+    for (auto& var : globals) {
+        out << "static " << c_type(var.kind) << ' ' << var.name << ";\n";
+    }
+    out << "\n#ifdef PSHARP_DUMP_GLOBALS\nstatic void ps_dump_globals(void) {\n";
+    for (auto& var : globals) {
+        if (var.kind == KIND_FLOAT) {
+            out << "    printf(\"" << var.label << " = %.17g\\n\", " << var.name << ");\n";
+        }
+        else {
+            out << "    printf(\"" << var.label << " = %\" PRId64 \"\\n\", " << var.name << (var.kind == KIND_SLOT ? ".i" : "") << ");\n";
+        }
+    }
+    out << "}\n#endif\n";
+
+    // Every function enters a frame and leaves it before returning or tail
+    // calling, so recursion that never ends stops where the VM's would
+    if (!functions.empty()) {
+        out << "\nstatic uint32_t ps_depth;\n\n"
+               "static void ps_enter(void) {\n"
+               "    if (++ps_depth == " << VM::DEFAULT_FRAME_COUNT << ") {\n"
+               "        fflush(stdout);\n"
+               "        fputs(\"\\033[31mRuntime error: Call stack overflow\\033[0m\\n\", stderr);\n"
+               "        exit(1);\n"
+               "    }\n"
+               "}\n";
+    }
+
+    const Function *funcs = chunk.func_data();
+    size_t count = chunk.func_count();
+    for (size_t i = 0; i < count; i++) {
+        out << '\n';
+        signature(functions[i]);
+        out << " {\n    ps_enter();\n";
+        emit_body(funcs[i].entry, funcs[i].num_slots, &functions[i], out);
+        out << "}\n";
+    }
+
+    out << "\nint main(void) {\n";
+    emit_body(0, chunk.num_locals, nullptr, out);
+    out << "}\n";
+    return true;
+}
+
+// One function body, or main() for the top-level code when `fn` is null, up
+// to the instruction that leaves it: function records may come in any order
+// (see verifier.h). Parameters keep their declared types; other slots are
+// Slot unions, since sibling blocks reuse them for values of different types.
+void CEmitter::emit_body(size_t start, uint32_t num_slots, const Func *fn, std::ostream& out) {
+    const uint8_t *code = chunk.code_data();
+    const StackSlot *constants = chunk.const_data();
+    uint32_t arity = fn ? fn->params.size() : 0;
+    std::vector<Var> slots;
+    for (uint32_t i = 0; i < num_slots; i++) {
+        std::string name = "s" + std::to_string(i);
+        slots.push_back({name, i < arity ? fn->params[i] : KIND_SLOT, name});
+        if (i >= arity) {
+            out << "    Slot " << name << " = {0};\n";
+        }
+    }
+    stack.clear();
+
+    auto binary = [&](Kind kind, const char *op) {
+        Value b = pop();
+        Value a = pop();
+        stack.push_back({"(" + render(a, kind) + ' ' + op + ' ' + render(b, kind) + ")", kind});
+    };
+    auto constant = [&](Kind kind, const char *op, int64_t bits) {
+        Value a = pop();
+        stack.push_back({"(" + render(a, kind) + ' ' + op + ' ' + render({"", KIND_CONST, bits}, kind) + ")", kind});
+    };
+    auto call = [&](uint32_t index) {
+        const Func& callee = functions[index];
+        std::vector<Value> args(callee.params.size());
+        for (size_t i = args.size(); i-- > 0;) {
+            args[i] = pop();
+        }
+        std::string text = callee.name + '(';
+        for (size_t i = 0; i < args.size(); i++) {
+            text += (i ? ", " : "") + render(args[i], callee.params[i]);
+        }
+        return Value{text + ')', callee.ret};
+    };
+
+    for (size_t pos = start; pos < chunk.code_size(); pos += op_size(code[pos])) {
+        uint8_t op = code[pos];
+        const uint8_t *operands = code + pos + 1;
+        switch (op) {
+            case OP_PCONST:
+                stack.push_back({"", KIND_CONST, constants[read_operand(operands)].ival});
+                break;
+            case OP_LDGLOB: {
+                const Var& var = globals[read_operand(operands)];
+                stack.push_back({var.name, var.kind});
+                break;
+            }
+            case OP_STGLOB: {
+                Value val = pop();
+                store(globals[read_operand(operands)], val, out);
+                break;
+            }
+            case OP_LDLOC:
+            case OP_LDLOC0: case OP_LDLOC1: case OP_LDLOC2: case OP_LDLOC3: {
+                const Var& var = slots[op == OP_LDLOC ? operands[0] : op - OP_LDLOC0];
+                stack.push_back({var.name, var.kind});
+                break;
+            }
+            case OP_STLOC:
+            case OP_STLOC0: case OP_STLOC1: case OP_STLOC2: case OP_STLOC3: {
+                Value val = pop();
+                store(slots[op == OP_STLOC ? operands[0] : op - OP_STLOC0], val, out);
+                break;
+            }
+            case OP_IADD: binary(KIND_INT, "+"); break;
+            case OP_ISUB: binary(KIND_INT, "-"); break;
+            case OP_IMUL: binary(KIND_INT, "*"); break;
+            case OP_IDIV: binary(KIND_INT, "/"); break;
+            case OP_IREM: binary(KIND_INT, "%"); break;
+            case OP_FADD: binary(KIND_FLOAT, "+"); break;
+            case OP_FSUB: binary(KIND_FLOAT, "-"); break;
+            case OP_FMUL: binary(KIND_FLOAT, "*"); break;
+            case OP_FDIV: binary(KIND_FLOAT, "/"); break;
+            case OP_FREM: {
+                Value b = pop();
+                Value a = pop();
+                stack.push_back({"fmod(" + render(a, KIND_FLOAT) + ", " + render(b, KIND_FLOAT) + ")", KIND_FLOAT});
+                break;
+            }
+            case OP_UIMINUS:
+            case OP_UFMINUS: {
+                Kind kind = op == OP_UIMINUS ? KIND_INT : KIND_FLOAT;
+                stack.push_back({"(-" + render(pop(), kind) + ")", kind});
+                break;
+            }
+            case OP_UNOT:
+                stack.push_back({"(!" + render(pop(), KIND_INT) + ")", KIND_INT});
+                break;
+            case OP_ITOF:
+                stack.push_back({"((double)" + render(pop(), KIND_INT) + ")", KIND_FLOAT});
+                break;
+            case OP_PRINTI:
+            case OP_PRINTF: {
+                Value val = pop();
+                spill(out);
+                if (op == OP_PRINTI) {
+                    out << "    printf(\"%\" PRId64 \"\\n\", " << render(val, KIND_INT) << ");\n";
+                }
+                else {
+                    out << "    printf(\"%g\\n\", " << render(val, KIND_FLOAT) << ");\n";
+                }
+                break;
+            }
+            case OP_CALL:
+                stack.push_back(call(read_operand(operands)));
+                break;
+            // The frame is left once the operands are computed, since calls
+            // among them still run inside it
+            case OP_TAILCALL: {
+                spill(out);
+                Value val = call(read_operand(operands));
+                out << "    ps_depth--;\n    return " << render(val, fn->ret) << ";\n";
+                stack.clear();
+                break;
+            }
+            case OP_RET: {
+                spill(out);
+                Value val = pop();
+                out << "    ps_depth--;\n    return " << render(val, fn->ret) << ";\n";
+                stack.clear();
+                break;
+            }
+            case OP_HALT:
+                if (fn == nullptr) {
+                    out << "#ifdef PSHARP_DUMP_GLOBALS\n    ps_dump_globals();\n#endif\n    return 0;\n";
+                }
+                stack.clear();
+                break;
+            case OP_IADD_GG: {
+                const Var& a = globals[read_operand(operands)];
+                const Var& b = globals[read_operand(operands + 3)];
+                stack.push_back({"(" + render({a.name, a.kind}, KIND_INT) + " + " + render({b.name, b.kind}, KIND_INT) + ")", KIND_INT});
+                break;
+            }
+            case OP_IADDK: constant(KIND_INT, "+", constants[read_operand(operands)].ival); break;
+            case OP_ISUBK: constant(KIND_INT, "-", constants[read_operand(operands)].ival); break;
+            case OP_IMULK: constant(KIND_INT, "*", constants[read_operand(operands)].ival); break;
+            case OP_FADDK: constant(KIND_FLOAT, "+", constants[read_operand(operands)].ival); break;
+            case OP_FSUBK: constant(KIND_FLOAT, "-", constants[read_operand(operands)].ival); break;
+            case OP_FMULK: constant(KIND_FLOAT, "*", constants[read_operand(operands)].ival); break;
+            case OP_ISHLK: constant(KIND_INT, "*", (int64_t)1 << operands[0]); break;
+            case OP_IREMP2: constant(KIND_INT, "%", (int64_t)1 << operands[0]); break;
+            case OP_STGLOBK:
+                store(globals[read_operand(operands + 3)], {"", KIND_CONST, constants[read_operand(operands)].ival}, out);
+                break;
+        }
+        if (op == OP_RET || op == OP_TAILCALL || op == OP_HALT) {
+            return;
+        }
+    }
+}
+
+// Pending operands are spilled first so that they read the variable's old
+// value, as they would in the VM
+void CEmitter::store(const Var& var, const Value& val, std::ostream& out) {
+    spill(out);
+    if (var.kind == KIND_SLOT && val.kind != KIND_SLOT) {
+        Kind kind = val.kind == KIND_FLOAT ? KIND_FLOAT : KIND_INT;
+        out << "    " << var.name << (kind == KIND_FLOAT ? ".f = " : ".i = ") << render(val, kind) << ";\n";
+    }
+    else {
+        out << "    " << var.name << " = " << render(val, var.kind) << ";\n";
+    }
+}
+
+void CEmitter::spill(std::ostream& out) {
+    for (auto& val : stack) {
+        if (val.kind != KIND_CONST) {
+            std::string name = "t" + std::to_string(next_temp++);
+            out << "    const " << c_type(val.kind) << ' ' << name << " = " << val.text << ";\n";
+            val.text = name;
+        }
+    }
+}
+
+CEmitter::Value CEmitter::pop() {
+    Value val = std::move(stack.back());
+    stack.pop_back();
+    return val;
+}
+
+const char *CEmitter::c_type(Kind kind) {
+    switch (kind) {
+        case KIND_INT:   return "int64_t";
+        case KIND_FLOAT: return "double";
+        default:         return "Slot";
+    }
+}
+
+// `val` as a C expression of kind `want`. Mismatched kinds are reinterpreted
+// bit for bit, since VM slots are untyped.
+std::string CEmitter::render(const Value& val, Kind want) {
+    if (val.kind == KIND_CONST) {
+        switch (want) {
+            case KIND_INT:   return int_literal(val.bits);
+            case KIND_FLOAT: return float_literal(val.bits);
+            default:         return "(Slot){.i = " + int_literal(val.bits) + "}";
+        }
+    }
+    if (val.kind == want) {
+        return val.text;
+    }
+    switch (val.kind) {
+        case KIND_INT:
+            return want == KIND_FLOAT ? "ps_f64(" + val.text + ")" : "(Slot){.i = " + val.text + "}";
+        case KIND_FLOAT:
+            return want == KIND_INT ? "ps_i64(" + val.text + ")" : "(Slot){.f = " + val.text + "}";
+        default:
+            return val.text + (want == KIND_INT ? ".i" : ".f");
+    }
+}
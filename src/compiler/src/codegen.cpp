@@ -1,154 +1,240 @@
 #include "../../vm/include/opcodes.h"
 #include "../include/exception.h"
 #include <algorithm>
-#include <iterator>
 #include "../include/codegen.h"
 
-std::unordered_map<TypeValue, std::vector<TypeValue>> CodeGen::implicitly_cast_allowed_types {
-    {TYPE_BOOL, {TYPE_BOOL}},
-    {TYPE_CHAR, {TYPE_CHAR, TYPE_SHORT, TYPE_INT, TYPE_LONG, TYPE_FLOAT, TYPE_DOUBLE}},
-    {TYPE_SHORT, {TYPE_SHORT, TYPE_INT, TYPE_LONG, TYPE_FLOAT, TYPE_DOUBLE}},
-    {TYPE_INT, {TYPE_INT, TYPE_LONG, TYPE_FLOAT, TYPE_DOUBLE}},
-    {TYPE_LONG, {TYPE_LONG, TYPE_FLOAT, TYPE_DOUBLE}},
-    {TYPE_FLOAT, {TYPE_FLOAT, TYPE_DOUBLE}}
-};
+// Register operands carry their register file section in the top two bits
+// until relocate_reg_operands() knows the size of every section.
+#define REG_CONST   (0u << 22)
+#define REG_GLOBAL  (1u << 22)
+#define REG_TEMP    (2u << 22)
+#define REG_SECTION (3u << 22)
+#define REG_NO_DST  UINT32_MAX
 
 Chunk *CodeGen::generate() {
     Chunk *chunk = new Chunk();
     c_chunk = chunk;
 
+    for (uint32_t i = 0; i < sema.imported_functions(); i++) {
+        const FDSNode *fds = sema.functions()[i];
+        chunk->functions.push_back({0, (uint16_t)fds->param_count, (uint16_t)fds->param_count, 0, is_ref(fds->type), {}});
+    }
     for (auto& stmt : stmts) {
         generate_stmt(*stmt);
     }
+    chunk->num_globals = sema.globals().size();
+    chunk->num_locals = max_slots;
+    if (backend == BACKEND_REG) {
+        chunk->code.push_back(ROP_HALT);
+        chunk->kind = CHUNK_REG;
+        relocate_reg_operands();
+    }
+    else {
+        finish_stack_code(0, 0);
+    }
 
     return chunk;
 }
 
+// Closes the new top-level code with a HALT and appends the bodies of the
+// functions from `first_func` on after it. Every chunk ends with a HALT, so
+// the bodies get an unreachable one of their own. Globals come first in the
+// ref map, so the entries of new globals go in ahead of the parameters'.
+void CodeGen::finish_stack_code(uint32_t first_func, uint32_t old_globals) {
+    Chunk *chunk = c_chunk;
+    chunk->code.push_back(OP_HALT);
+    if (!func_code.empty()) {
+        uint32_t base = chunk->code.size();
+        chunk->code.insert(chunk->code.end(), func_code.begin(), func_code.end());
+        chunk->code.push_back(OP_HALT);
+        for (size_t i = first_func; i < chunk->functions.size(); i++) {
+            chunk->functions[i].entry += base;
+        }
+        func_code.clear();
+    }
+    uint32_t added = chunk->num_globals - old_globals;
+    std::vector<uint8_t> global_refs;
+    for (uint32_t i = old_globals; i < chunk->num_globals; i++) {
+        global_refs.push_back(is_ref(sema.globals()[i].type));
+    }
+    chunk->ref_map.insert(chunk->ref_map.begin() + old_globals, global_refs.begin(), global_refs.end());
+    for (size_t i = 0; i < first_func; i++) {
+        chunk->functions[i].param_refs += added;
+    }
+    for (size_t i = first_func; i < chunk->functions.size(); i++) {
+        const FDSNode *fds = sema.functions()[i];
+        chunk->functions[i].param_refs = chunk->ref_map.size();
+        for (uint32_t p = 0; p < fds->param_count; p++) {
+            chunk->ref_map.push_back(is_ref(fds->params[p].type));
+        }
+    }
+}
+
+CodeGen::Mark CodeGen::mark(const Chunk& chunk) const {
+    return {chunk.code.size(), chunk.constants.size(), chunk.functions.size(), chunk.strings.size(), (uint32_t)sema.globals().size(), max_slots};
+}
+
+uint32_t CodeGen::extend(Chunk& chunk, std::vector<ASTNodePtr> more, const Mark& m) {
+    c_chunk = &chunk;
+    stmts = std::move(more);
+    for (auto& stmt : stmts) {
+        generate_stmt(*stmt);
+    }
+    chunk.num_globals = sema.globals().size();
+    chunk.num_locals = max_slots;
+    finish_stack_code(m.functions, m.globals);
+    return m.code;
+}
+
+// Names are Sema's to forget (see Sema::forget)
+void CodeGen::revert(Chunk& chunk, const Mark& m) {
+    chunk.code.resize(m.code);
+    chunk.constants.resize(m.constants);
+    chunk.functions.resize(m.functions);
+    chunk.strings.resize(m.strings);
+    for (uint32_t& offset : string_literals) {
+        if (offset != UINT32_MAX && offset >= m.strings) {
+            offset = UINT32_MAX;
+        }
+    }
+    func_code.clear();
+    max_slots = m.slots;
+}
+
 void CodeGen::generate_stmt(const ASTNode& stmt) {
-    if (auto vds = stmt.as<VDSNode>()) {
-        generate_vds_stmt(*vds);
+    if (auto fds = stmt.as<FDSNode>()) {
+        generate_fds_stmt(*fds);
+    }
+    else if (auto rs = stmt.as<RSNode>()) {
+        generate_rs_stmt(*rs);
+    }
+    else if (auto bs = stmt.as<BSNode>()) {
+        if (backend == BACKEND_REG) {
+            error(file_name, "Blocks are not supported by the register backend", stmt.pos);
+        }
+        generate_block(bs->stmts, bs->stmt_count);
+    }
+    else if (stmt.as<ISNode>()) {
+        // Resolved by ModuleBuilder before generation
+    }
+    else if (auto vds = stmt.as<VDSNode>()) {
+        if (backend == BACKEND_REG) {
+            generate_reg_vds_stmt(*vds);
+        }
+        else {
+            generate_vds_stmt(*vds);
+        }
     }
     else {
         error(file_name, "Unsupported statement", stmt.pos);
     }
 }
 
+// Globals are sized up front from their count, so a definition is a plain
+// store
 void CodeGen::generate_vds_stmt(const VDSNode& vds) {
-    Type type = vds.type;
     if (vds.expr != nullptr) {
-        type = generate_expr(*vds.expr);
+        generate_expr(*vds.expr);
+    }
+    else if (vds.type.type == TYPE_STR) {
+        push_str(0, vds.pos);
     }
     else {
         c_chunk->constants.push_back({0});
-        uint32_t index = c_chunk->constants.size() - 1;
-        int minor2 = index & 0xFF;
-        int minor1 = (index >> 8) & 0xFF;
-        int major = (index >> 16) & 0xFF;
         c_chunk->code.push_back(OP_PCONST);
-        c_chunk->code.push_back(major);
-        c_chunk->code.push_back(minor1);
-        c_chunk->code.push_back(minor2);
+        push_index(c_chunk->constants.size() - 1);
+    }
+    if (vds.kind == VAR_LOCAL) {
+        push_local_op(OP_STLOC, OP_STLOC0, vds.index);
+        max_slots = std::max(max_slots, vds.index + 1);
+        return;
     }
-    c_chunk->code.push_back(OP_DEFGLOB);
     c_chunk->code.push_back(OP_STGLOB);
-    uint32_t index = global_vars.size();
-    int minor2 = index & 0xFF;
-    int minor1 = (index >> 8) & 0xFF;
-    int major = (index >> 16) & 0xFF;
-    c_chunk->code.push_back(major);
-    c_chunk->code.push_back(minor1);
-    c_chunk->code.push_back(minor2);
-    global_vars.emplace(vds.name, GlobVar{type, StackSlot{}, index});
+    push_index(vds.index);
 }
 
-Type CodeGen::generate_expr(const ASTNode& expr) {
-    if (auto be = expr.as<BENode>()) {
-        return generate_be_expr(*be);
+void CodeGen::generate_fds_stmt(const FDSNode& fds) {
+    if (backend == BACKEND_REG) {
+        error(file_name, "Functions are not supported by the register backend", fds.pos);
     }
-    else if (auto ue = expr.as<UENode>()) {
-        return generate_ue_expr(*ue);
+    uint32_t index = c_chunk->functions.size();
+    c_chunk->functions.push_back({(uint32_t)func_code.size(), (uint16_t)fds.param_count, (uint16_t)fds.param_count, 0, is_ref(fds.type), {}});
+
+    uint32_t top_level_slots = max_slots;
+    max_slots = fds.param_count;
+    std::swap(c_chunk->code, func_code);
+    generate_block(fds.body, fds.body_count);
+    std::swap(c_chunk->code, func_code);
+    c_chunk->functions[index].num_slots = max_slots;
+    max_slots = top_level_slots;
+}
+
+void CodeGen::generate_block(ASTNodePtr *stmts, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        generate_stmt(*stmts[i]);
     }
-    else if (auto le = expr.as<LENode>()) {
-        return generate_le_expr(*le);
+}
+
+void CodeGen::generate_rs_stmt(const RSNode& rs) {
+    if (rs.tail) {
+        generate_ce_expr(*rs.expr->as<CENode>(), true);
+        return;
     }
-    else if (auto ve = expr.as<VENode>()) {
-        return generate_ve_expr(*ve);
+    generate_expr(*rs.expr);
+    c_chunk->code.push_back(OP_RET);
+}
+
+void CodeGen::generate_expr(const ASTNode& expr) {
+    switch (expr.type) {
+        case NODE_BE:  generate_be_expr(*expr.as<BENode>()); break;
+        case NODE_UE:  generate_ue_expr(*expr.as<UENode>()); break;
+        case NODE_LE:  generate_le_expr(*expr.as<LENode>()); break;
+        case NODE_VE:  generate_ve_expr(*expr.as<VENode>()); break;
+        case NODE_CE:  generate_ce_expr(*expr.as<CENode>()); break;
+        case NODE_CVE: generate_cve_expr(*expr.as<CVENode>()); break;
+        default:
+            error(file_name, "Unsupported expression", expr.pos);
     }
-    error(file_name, "Unsupported expression", expr.pos);
 }
 
-Type CodeGen::generate_be_expr(const BENode& be) {
-    Type RHS = generate_expr(*be.RHS);
-    Type LHS = generate_expr(*be.LHS);
-    Type common_type = get_common_type(RHS, LHS, be.pos);
+void CodeGen::generate_be_expr(const BENode& be) {
+    generate_expr(*be.LHS);
+    generate_expr(*be.RHS);
+    Type type = expr_type(*be.LHS);
+    if (type.type == TYPE_STR) {
+        switch (be.op) {
+            case TOK_PLUS:   c_chunk->code.push_back(OP_SCAT); break;
+            case TOK_EQ_EQ:  c_chunk->code.push_back(OP_SEQ); break;
+            default:         c_chunk->code.push_back(OP_SNE); break;
+        }
+        return;
+    }
+    bool i = is_int(type);
     switch (be.op) {
-        #define PUSH_CODE(i, f) \
-        if (common_type.type <= TYPE_LONG) c_chunk->code.push_back(i); \
-        else c_chunk->code.push_back(f);
+        case TOK_PLUS:   c_chunk->code.push_back(i ? OP_IADD : OP_FADD); break;
+        case TOK_MINUS:  c_chunk->code.push_back(i ? OP_ISUB : OP_FSUB); break;
+        case TOK_STAR:   c_chunk->code.push_back(i ? OP_IMUL : OP_FMUL); break;
+        case TOK_SLASH:  c_chunk->code.push_back(i ? OP_IDIV : OP_FDIV); break;
+        default:         c_chunk->code.push_back(i ? OP_IREM : OP_FREM); break;
+    }
+}
 
-        case TOK_PLUS:
-            PUSH_CODE(OP_IADD, OP_FADD);
-            break;
-        case TOK_MINUS:
-            PUSH_CODE(OP_ISUB, OP_FSUB);
-            break;
-        case TOK_STAR:
-            PUSH_CODE(OP_IMUL, OP_FMUL);
-            break;
-        case TOK_SLASH:
-            PUSH_CODE(OP_IDIV, OP_FDIV);
-            break;
-        case TOK_PRECENT:
-            PUSH_CODE(OP_IREM, OP_FREM);
-            break;
-        default:
-            error(file_name, "Unsupported binary operator", be.pos);
-        #undef PUSH_CODE
-    }
-    return common_type;
-}
-
-Type CodeGen::generate_ue_expr(const UENode& ue) {
-    Type type = generate_expr(*ue.expr);
-    switch (ue.op) {
-        case TOK_MINUS:
-            if (type.type <= TYPE_LONG && type.type > TYPE_BOOL) {
-                c_chunk->code.push_back(OP_UIMINUS);
-                
-            }
-            else if (type.type <= TYPE_DOUBLE) {
-                c_chunk->code.push_back(OP_UFMINUS);
-            }
-            else {
-                error(file_name, "Unary minus does not supported this type", ue.pos);
-            }
-            break;
-        case TOK_NOT:
-            if (type.type == TYPE_BOOL) {
-                c_chunk->code.push_back(OP_UNOT);
-            }
-            else {
-                error(file_name, "Unary logical not does not supported this type", ue.pos);
-            }
-            break;
-        default:
-            error(file_name, "Unsupported unary operator", ue.pos);
+void CodeGen::generate_ue_expr(const UENode& ue) {
+    generate_expr(*ue.expr);
+    if (ue.op == TOK_NOT) {
+        c_chunk->code.push_back(OP_UNOT);
+    }
+    else {
+        c_chunk->code.push_back(is_int(ue.value_type) ? OP_UIMINUS : OP_UFMINUS);
     }
-    return type;
 }
 
-Type CodeGen::generate_le_expr(const LENode& le) {
+void CodeGen::generate_le_expr(const LENode& le) {
     switch (le.val.type.type) {
         #define PUSH_CONST(name, val) \
         c_chunk->constants.push_back({name = val}); \
-        uint32_t index = c_chunk->constants.size() - 1; \
-        int minor2 = index & 0xFF; \
-        int minor1 = (index >> 8) & 0xFF; \
-        int major = (index >> 16) & 0xFF; \
         c_chunk->code.push_back(OP_PCONST); \
-        c_chunk->code.push_back(major); \
-        c_chunk->code.push_back(minor1); \
-        c_chunk->code.push_back(minor2);
+        push_index(c_chunk->constants.size() - 1);
         
         case TYPE_BOOL: {
             PUSH_CONST(.ival, le.val.b);
@@ -178,48 +264,202 @@ Type CodeGen::generate_le_expr(const LENode& le) {
             PUSH_CONST(.fval, le.val.d);
             break;
         }
+        case TYPE_STR: {
+            push_str(le.val.str, le.pos);
+            break;
+        }
         default:
             error(file_name, "Literal does not supported", le.pos);
         #undef PUSH_CONST
     }
-    return le.val.type;
 }
 
-Type CodeGen::generate_ve_expr(const VENode& ve) {
-    auto it = global_vars.find(ve.name);
-    uint32_t index = it->second.index;
-    int minor2 = index & 0xFF;
-    int minor1 = (index >> 8) & 0xFF;
-    int major = (index >> 16) & 0xFF;
+void CodeGen::generate_ve_expr(const VENode& ve) {
+    if (ve.kind == VAR_LOCAL) {
+        push_local_op(OP_LDLOC, OP_LDLOC0, ve.index);
+        return;
+    }
     c_chunk->code.push_back(OP_LDGLOB);
-    c_chunk->code.push_back(major);
-    c_chunk->code.push_back(minor1);
-    c_chunk->code.push_back(minor2);
-    return it->second.type;
+    push_index(ve.index);
+}
+
+// Arguments are pushed left to right and become the callee's first slots
+void CodeGen::generate_ce_expr(const CENode& ce, bool tail) {
+    for (uint32_t i = 0; i < ce.arg_count; i++) {
+        generate_expr(*ce.args[i]);
+    }
+    if (ce.kind == FUNC_NATIVE) {
+        c_chunk->code.push_back(OP_NCALL);
+        push_index(ce.index);
+        c_chunk->code.push_back(ce.arg_count);
+        return;
+    }
+    c_chunk->code.push_back(tail ? OP_TAILCALL : OP_CALL);
+    push_index(ce.index);
+}
+
+// Integers and doubles share a slot, so only going from one to the other
+// takes an instruction
+void CodeGen::generate_cve_expr(const CVENode& cve) {
+    generate_expr(*cve.expr);
+    if (is_int(expr_type(*cve.expr)) && !is_int(cve.value_type)) {
+        c_chunk->code.push_back(OP_ITOF);
+    }
+}
+
+void CodeGen::generate_reg_vds_stmt(const VDSNode& vds) {
+    uint32_t dst = REG_GLOBAL | vds.index;
+    if (vds.expr != nullptr) {
+        uint32_t operand;
+        generate_reg_expr(*vds.expr, operand, dst);
+        if (operand != dst) {
+            c_chunk->code.push_back(ROP_MOV);
+            push_index(dst);
+            push_index(operand);
+        }
+    }
+    else if (vds.type.type == TYPE_STR) {
+        error(file_name, "Strings are not supported by the register backend", vds.pos);
+    }
+    else {
+        c_chunk->code.push_back(ROP_MOV);
+        push_index(dst);
+        push_index(add_reg_const({0}));
+    }
+}
+
+// Leaves (literals and variables) are used in place as constant or global
+// operands; only operators emit code. `dst` is where the caller wants the
+// result, REG_NO_DST lets an operator pick a temporary. Temporaries are
+// allocated like a stack, so the register file needs as many of them as the
+// deepest expression.
+void CodeGen::generate_reg_expr(const ASTNode& expr, uint32_t& operand, uint32_t dst) {
+    if (auto le = expr.as<LENode>()) {
+        switch (le->val.type.type) {
+            case TYPE_BOOL:   operand = add_reg_const({.ival = le->val.b}); break;
+            case TYPE_CHAR:   operand = add_reg_const({.ival = le->val.c}); break;
+            case TYPE_SHORT:  operand = add_reg_const({.ival = le->val.s}); break;
+            case TYPE_INT:    operand = add_reg_const({.ival = le->val.i}); break;
+            case TYPE_LONG:   operand = add_reg_const({.ival = le->val.l}); break;
+            case TYPE_FLOAT:  operand = add_reg_const({.fval = le->val.f}); break;
+            case TYPE_DOUBLE: operand = add_reg_const({.fval = le->val.d}); break;
+            case TYPE_STR:
+                error(file_name, "Strings are not supported by the register backend", le->pos);
+            default:
+                error(file_name, "Literal does not supported", le->pos);
+        }
+        return;
+    }
+    if (auto ve = expr.as<VENode>()) {
+        operand = REG_GLOBAL | ve->index;
+        return;
+    }
+
+    uint32_t mark = next_temp;
+    uint32_t a, b = REG_NO_DST;
+    uint8_t op;
+    if (auto be = expr.as<BENode>()) {
+        generate_reg_expr(*be->LHS, a, REG_NO_DST);
+        generate_reg_expr(*be->RHS, b, REG_NO_DST);
+        bool i = is_int(expr_type(*be->LHS));
+        switch (be->op) {
+            case TOK_PLUS:    op = i ? ROP_IADD : ROP_FADD; break;
+            case TOK_MINUS:   op = i ? ROP_ISUB : ROP_FSUB; break;
+            case TOK_STAR:    op = i ? ROP_IMUL : ROP_FMUL; break;
+            case TOK_SLASH:   op = i ? ROP_IDIV : ROP_FDIV; break;
+            case TOK_PRECENT: op = i ? ROP_IREM : ROP_FREM; break;
+            default:
+                error(file_name, "Strings are not supported by the register backend", be->pos);
+        }
+    }
+    else if (auto ue = expr.as<UENode>()) {
+        generate_reg_expr(*ue->expr, a, REG_NO_DST);
+        op = ue->op == TOK_NOT ? ROP_UNOT : is_int(ue->value_type) ? ROP_UIMINUS : ROP_UFMINUS;
+    }
+    else if (auto cve = expr.as<CVENode>()) {
+        if (!is_int(expr_type(*cve->expr)) || is_int(cve->value_type)) {
+            generate_reg_expr(*cve->expr, operand, dst);
+            return;
+        }
+        generate_reg_expr(*cve->expr, a, REG_NO_DST);
+        op = ROP_ITOF;
+    }
+    else {
+        error(file_name, "Unsupported expression", expr.pos);
+    }
+    next_temp = mark;
+    operand = dst != REG_NO_DST ? dst : REG_TEMP | next_temp++;
+    c_chunk->code.push_back(op);
+    push_index(operand);
+    push_index(a);
+    if (b != REG_NO_DST) {
+        push_index(b);
+    }
+    if (next_temp > c_chunk->num_temps) {
+        c_chunk->num_temps = next_temp;
+    }
+}
+
+uint32_t CodeGen::add_reg_const(StackSlot slot) {
+    c_chunk->constants.push_back(slot);
+    return REG_CONST | (c_chunk->constants.size() - 1);
 }
 
-bool CodeGen::has_common_type(Type LHS, Type RHS) {
-    if (LHS == RHS) {
-        return true;
+void CodeGen::relocate_reg_operands() {
+    uint32_t bases[] = {0, (uint32_t)c_chunk->constants.size(), (uint32_t)c_chunk->constants.size() + c_chunk->num_globals};
+    if (bases[2] + c_chunk->num_temps > (1u << 22)) {
+        error(file_name, "Register file is too large", {0, 0});
     }
-    if (implicitly_cast_allowed_types.find(LHS.type) != implicitly_cast_allowed_types.end() &&
-        std::find(implicitly_cast_allowed_types[LHS.type].begin(), implicitly_cast_allowed_types[LHS.type].end(), RHS.type) != implicitly_cast_allowed_types[LHS.type].end()) {
-        return true;
+    auto& code = c_chunk->code;
+    for (size_t i = 0; code[i] != ROP_HALT;) {
+        size_t operands = reg_op_operands(code[i]);
+        i++;
+        for (size_t n = 0; n < operands; n++, i += 3) {
+            uint32_t operand = (code[i] << 16) | (code[i + 1] << 8) | code[i + 2];
+            operand = bases[operand >> 22] + (operand & ~REG_SECTION);
+            code[i] = (operand >> 16) & 0xFF;
+            code[i + 1] = (operand >> 8) & 0xFF;
+            code[i + 2] = operand & 0xFF;
+        }
     }
-    return false;
 }
 
-Type CodeGen::get_common_type(Type LHS, Type RHS, Location pos) {
-    if (LHS.type == RHS.type) {
-        return LHS;
+// Slots 0-3 have one-byte forms, `short_op` being the one for slot 0
+void CodeGen::push_local_op(uint8_t op, uint8_t short_op, uint8_t slot) {
+    if (slot < 4) {
+        c_chunk->code.push_back(short_op + slot);
     }
+    else {
+        c_chunk->code.push_back(op);
+        c_chunk->code.push_back(slot);
+    }
+}
 
-    if (has_common_type(LHS, RHS)) {
-        return Type(*std::find(implicitly_cast_allowed_types[LHS.type].begin(), implicitly_cast_allowed_types[LHS.type].end(), RHS.type).base(), RHS.name, RHS.is_const);
+// Short strings are immediates and go to the constant table; longer ones
+// are laid out once in the string pool.
+void CodeGen::push_str(Symbol value, Location pos) {
+    std::string_view text = ctx.symbols.name(value);
+    if (text.size() <= str::INLINE_MAX) {
+        c_chunk->constants.push_back({.objval = str::make_inline(text.data(), text.size())});
+        c_chunk->code.push_back(OP_PCONST);
+        push_index(c_chunk->constants.size() - 1);
+        return;
+    }
+    if (value >= string_literals.size()) {
+        string_literals.resize(std::max<size_t>(ctx.symbols.size(), value + 1), UINT32_MAX);
     }
-    if (has_common_type(RHS, LHS)) {
-        return Type(*std::find(implicitly_cast_allowed_types[RHS.type].begin(), implicitly_cast_allowed_types[RHS.type].end(), LHS.type).base(), LHS.name, LHS.is_const);
+    if (string_literals[value] == UINT32_MAX) {
+        if (c_chunk->strings.size() + str::flat_size(text.size()) >= (1u << 24)) {
+            error(file_name, "Too many string literals", pos);
+        }
+        string_literals[value] = str::add_literal(c_chunk->strings, text);
     }
-    
-    error(file_name, "Does not have common type", pos);
-}
\ No newline at end of file
+    c_chunk->code.push_back(OP_PSTR);
+    push_index(string_literals[value]);
+}
+
+void CodeGen::push_index(uint32_t index) {
+    c_chunk->code.push_back((index >> 16) & 0xFF);
+    c_chunk->code.push_back((index >> 8) & 0xFF);
+    c_chunk->code.push_back(index & 0xFF);
+}
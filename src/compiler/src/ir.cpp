@@ -0,0 +1,387 @@
+#include "../../vm/include/opcodes.h"
+#include "../include/ir.h"
+#include <algorithm>
+
+bool ir::is_pure(uint8_t op) {
+    switch (op) {
+        case OP_STGLOB:
+        case OP_CALL:
+        case OP_TAILCALL:
+        case OP_NCALL:
+        case OP_RET:
+        case OP_HALT:
+        case OP_PRINTI:
+        case OP_PRINTF:
+        case OP_PRINTO:
+            return false;
+        default:
+            return true;
+    }
+}
+
+bool ir::lift(const Chunk& chunk, uint32_t func, IRBlock& block, size_t& end) {
+    const uint8_t *code = chunk.code_data();
+    size_t size = chunk.code_size();
+    const uint8_t *refs = chunk.ref_data();
+    const Function *functions = chunk.func_data();
+    bool top_level = func == UINT32_MAX;
+    size_t pos = top_level ? 0 : functions[func].entry;
+    block.insts.clear();
+    block.arity = top_level ? 0 : functions[func].arity;
+
+    std::vector<uint32_t> stack;
+    std::vector<uint32_t> slots(UINT8_MAX + 1, UINT32_MAX);     // value last stored in each frame slot
+    auto add = [&](uint8_t op, IRType type, uint32_t imm, std::vector<uint32_t> args) {
+        block.insts.push_back({op, type, true, imm, std::move(args)});
+        return (uint32_t)block.insts.size() - 1;
+    };
+    // `want` is IR_VOID for any value and IR_WORD for any scalar; a WORD
+    // takes the more precise type of its first user. Constants may also be
+    // short strings, which are inline rather than on the heap.
+    auto pop = [&](IRType want, uint32_t& val) {
+        if (stack.empty()) {
+            return false;
+        }
+        val = stack.back();
+        stack.pop_back();
+        IRType& have = block.insts[val].type;
+        if (want == IR_VOID) {
+            return true;
+        }
+        if (have == IR_WORD && want == IR_REF && block.insts[val].op == OP_PCONST) {
+            have = IR_REF;
+        }
+        if ((have == IR_REF) != (want == IR_REF)) {
+            return false;
+        }
+        if (have == IR_WORD) {
+            have = want;
+        }
+        return true;
+    };
+    auto pop_args = [&](uint32_t count, const uint8_t *arg_refs, std::vector<uint32_t>& args) {
+        args.resize(count);
+        for (uint32_t i = count; i-- > 0;) {
+            if (!pop(arg_refs == nullptr ? IR_WORD : arg_refs[i] ? IR_REF : IR_WORD, args[i])) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto load_slot = [&](uint32_t slot) {
+        if (slots[slot] == UINT32_MAX) {
+            if (slot >= block.arity) {
+                return false;
+            }
+            bool ref = refs[functions[func].param_refs + slot];
+            slots[slot] = add(OP_LDLOC, ref ? IR_REF : IR_WORD, slot, {});
+        }
+        stack.push_back(slots[slot]);
+        return true;
+    };
+
+    for (;;) {
+        if (pos >= size) {
+            return false;
+        }
+        uint8_t op = code[pos];
+        const uint8_t *operands = code + pos + 1;
+        pos += op_size(op);
+        uint32_t a, b;
+        std::vector<uint32_t> args;
+        switch (op) {
+            case OP_PCONST:
+                if (read_operand(operands) >= chunk.const_count()) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_WORD, read_operand(operands), {}));
+                break;
+            case OP_PSTR:
+                stack.push_back(add(op, IR_REF, read_operand(operands), {}));
+                break;
+            case OP_LDGLOB:
+            case OP_STGLOB: {
+                uint32_t global = read_operand(operands);
+                if (global >= chunk.num_globals) {
+                    return false;
+                }
+                IRType type = refs[global] ? IR_REF : IR_WORD;
+                if (op == OP_LDGLOB) {
+                    stack.push_back(add(op, type, global, {}));
+                }
+                else if (!pop(type, a)) {
+                    return false;
+                }
+                else {
+                    add(op, IR_VOID, global, {a});
+                }
+                break;
+            }
+            case OP_LDLOC:
+                if (!load_slot(operands[0])) {
+                    return false;
+                }
+                break;
+            case OP_LDLOC0: case OP_LDLOC1: case OP_LDLOC2: case OP_LDLOC3:
+                if (!load_slot(op - OP_LDLOC0)) {
+                    return false;
+                }
+                break;
+            case OP_STLOC:
+            case OP_STLOC0: case OP_STLOC1: case OP_STLOC2: case OP_STLOC3:
+                if (!pop(IR_VOID, a)) {
+                    return false;
+                }
+                slots[op == OP_STLOC ? operands[0] : op - OP_STLOC0] = a;
+                break;
+            case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IREM:
+                if (!pop(IR_INT, b) || !pop(IR_INT, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_INT, 0, {a, b}));
+                break;
+            case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV: case OP_FREM:
+                if (!pop(IR_FLOAT, b) || !pop(IR_FLOAT, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_FLOAT, 0, {a, b}));
+                break;
+            case OP_SCAT: case OP_SEQ: case OP_SNE:
+                if (!pop(IR_REF, b) || !pop(IR_REF, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, op == OP_SCAT ? IR_REF : IR_INT, 0, {a, b}));
+                break;
+            case OP_UIMINUS: case OP_UNOT:
+                if (!pop(IR_INT, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_INT, 0, {a}));
+                break;
+            case OP_UFMINUS:
+                if (!pop(IR_FLOAT, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_FLOAT, 0, {a}));
+                break;
+            case OP_ITOF:
+                if (!pop(IR_INT, a)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_FLOAT, 0, {a}));
+                break;
+            case OP_PRINTI: case OP_PRINTF: case OP_PRINTO:
+                if (!pop(op == OP_PRINTI ? IR_INT : op == OP_PRINTF ? IR_FLOAT : IR_REF, a)) {
+                    return false;
+                }
+                add(op, IR_VOID, 0, {a});
+                break;
+            case OP_CALL:
+            case OP_TAILCALL: {
+                uint32_t callee = read_operand(operands);
+                if (callee >= chunk.func_count()) {
+                    return false;
+                }
+                const Function& fn = functions[callee];
+                if (!pop_args(fn.arity, refs + fn.param_refs, args)) {
+                    return false;
+                }
+                IRType type = op == OP_TAILCALL ? IR_VOID : fn.ret_ref ? IR_REF : IR_WORD;
+                uint32_t val = add(op, type, callee, std::move(args));
+                if (op == OP_CALL) {
+                    stack.push_back(val);
+                }
+                break;
+            }
+            case OP_NCALL:
+                if (!pop_args(operands[3], nullptr, args)) {
+                    return false;
+                }
+                stack.push_back(add(op, IR_WORD, read_operand(operands), std::move(args)));
+                break;
+            case OP_RET:
+                if (top_level || !pop(IR_VOID, a)) {
+                    return false;
+                }
+                add(op, IR_VOID, 0, {a});
+                break;
+            case OP_HALT:
+                if (!top_level) {
+                    return false;
+                }
+                add(op, IR_VOID, 0, {});
+                break;
+            default:
+                return false;
+        }
+        if (op == OP_RET || op == OP_TAILCALL || op == OP_HALT) {
+            end = pos;
+            return stack.empty();
+        }
+    }
+}
+
+static void put_operand(std::vector<uint8_t>& code, uint32_t val) {
+    code.push_back((val >> 16) & 0xFF);
+    code.push_back((val >> 8) & 0xFF);
+    code.push_back(val & 0xFF);
+}
+
+static void put_slot_op(std::vector<uint8_t>& code, uint8_t op, uint8_t short_op, uint32_t slot) {
+    if (slot < 4) {
+        code.push_back(short_op + slot);
+    }
+    else {
+        code.push_back(op);
+        code.push_back(slot);
+    }
+}
+
+// Instructions run in their original order, so effects keep theirs. A value
+// with a single use stays on the operand stack when its user finds it on top,
+// in argument order, and is otherwise spilled to a frame slot right after it
+// is computed; so are values with several uses. Spilling a value only takes
+// it off the simulated stack, which never changes what earlier users found
+// on top, so one forward pass decides every spill. Loads of constants,
+// strings, parameters and globals not stored in the block are repeated at
+// each use instead of spilled.
+bool ir::lower(const IRBlock& block, std::vector<uint8_t>& code, uint32_t& num_slots) {
+    const std::vector<IRInst>& insts = block.insts;
+    size_t n = insts.size();
+    std::vector<uint32_t> uses(n, 0), last_use(n, 0);
+    std::vector<uint8_t> stored;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!insts[i].live) {
+            continue;
+        }
+        for (uint32_t arg : insts[i].args) {
+            uses[arg]++;
+            last_use[arg] = i;
+        }
+        if (insts[i].op == OP_STGLOB) {
+            stored.resize(std::max<size_t>(stored.size(), insts[i].imm + 1));
+            stored[insts[i].imm] = 1;
+        }
+    }
+    auto remat = [&](uint32_t i) {
+        switch (insts[i].op) {
+            case OP_PCONST: case OP_PSTR: case OP_LDLOC:
+                return true;
+            case OP_LDGLOB:
+                return insts[i].imm >= stored.size() || !stored[insts[i].imm];
+            default:
+                return false;
+        }
+    };
+
+    std::vector<uint8_t> spilled(n, 0);
+    std::vector<uint32_t> take(n, 0);       // leading arguments found on the stack
+    std::vector<uint32_t> stack;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!insts[i].live) {
+            continue;
+        }
+        const std::vector<uint32_t>& args = insts[i].args;
+        size_t m = 0;
+        while (m < args.size() && !spilled[args[m]]) {
+            m++;
+        }
+        for (; m > 0; m--) {
+            if (stack.size() >= m && std::equal(stack.end() - m, stack.end(), args.begin())) {
+                break;
+            }
+        }
+        for (size_t j = m; j < args.size(); j++) {
+            if (!spilled[args[j]]) {
+                spilled[args[j]] = 1;
+                stack.erase(std::find(stack.begin(), stack.end(), args[j]));
+            }
+        }
+        stack.resize(stack.size() - m);
+        take[i] = m;
+        if (insts[i].type != IR_VOID) {
+            if (uses[i] == 1) {
+                stack.push_back(i);
+            }
+            else if (uses[i] > 1) {
+                spilled[i] = 1;
+            }
+        }
+    }
+
+    std::vector<uint32_t> slot_of(n, UINT32_MAX);
+    std::vector<uint32_t> free_slots;
+    uint32_t next_slot = block.arity;
+    auto alloc = [&]() {
+        if (free_slots.empty()) {
+            return next_slot++;
+        }
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    };
+    auto emit = [&](uint32_t i) {
+        const IRInst& inst = insts[i];
+        switch (inst.op) {
+            case OP_PCONST: case OP_PSTR: case OP_LDGLOB: case OP_STGLOB:
+            case OP_CALL: case OP_TAILCALL:
+                code.push_back(inst.op);
+                put_operand(code, inst.imm);
+                break;
+            case OP_NCALL:
+                code.push_back(inst.op);
+                put_operand(code, inst.imm);
+                code.push_back(inst.args.size());
+                break;
+            case OP_LDLOC:
+                put_slot_op(code, OP_LDLOC, OP_LDLOC0, inst.imm);
+                break;
+            case OP_ISHLK: case OP_IREMP2:
+                code.push_back(inst.op);
+                code.push_back(inst.imm);
+                break;
+            default:
+                code.push_back(inst.op);
+                break;
+        }
+    };
+    for (uint32_t i = 0; i < n; i++) {
+        if (!insts[i].live) {
+            continue;
+        }
+        const std::vector<uint32_t>& args = insts[i].args;
+        for (size_t j = take[i]; j < args.size(); j++) {
+            if (remat(args[j])) {
+                emit(args[j]);
+            }
+            else {
+                put_slot_op(code, OP_LDLOC, OP_LDLOC0, slot_of[args[j]]);
+            }
+        }
+        bool deferred = spilled[i] && remat(i);
+        if (!deferred) {
+            emit(i);
+        }
+        for (uint32_t arg : args) {
+            if (last_use[arg] == i && slot_of[arg] != UINT32_MAX) {
+                free_slots.push_back(slot_of[arg]);
+                slot_of[arg] = UINT32_MAX;
+            }
+        }
+        if (insts[i].type == IR_VOID || deferred) {
+            continue;
+        }
+        if (spilled[i]) {
+            slot_of[i] = alloc();
+            put_slot_op(code, OP_STLOC, OP_STLOC0, slot_of[i]);
+        }
+        else if (uses[i] == 0) {
+            // An effect whose result nobody reads
+            uint32_t slot = alloc();
+            put_slot_op(code, OP_STLOC, OP_STLOC0, slot);
+            free_slots.push_back(slot);
+        }
+    }
+    num_slots = next_slot;
+    return next_slot <= UINT8_MAX + 1;
+}
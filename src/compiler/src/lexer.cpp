@@ -1,135 +1,290 @@
 #include "../include/exception.h"
 #include "../include/lexer.h"
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
 
-std::unordered_map<std::string_view, TokenType> Lexer::spec_symbols {
-    {"true", TOK_BOOL_L},
-    {"false", TOK_BOOL_L},
-    {"bool", TOK_BOOL},
-    {"char", TOK_CHAR},
-    {"i16", TOK_SHORT},
-    {"i32", TOK_INT},
-    {"i64", TOK_LONG},
-    {"f32", TOK_FLOAT},
-    {"f64", TOK_DOUBLE},
-    {"let", TOK_LET},
-    {"fun", TOK_FUN},
-    {"return", TOK_RET},
-    {"const", TOK_CONST},
-    {"+", TOK_PLUS},
-    {"-", TOK_MINUS},
-    {"*", TOK_STAR},
-    {"/", TOK_SLASH},
-    {"%", TOK_PRECENT},
-    {"=", TOK_EQ},
-    {"==", TOK_EQ_EQ},
-    {"!=", TOK_NOT_EQ},
-    {"!", TOK_NOT},
-    {">", TOK_GT},
-    {">=", TOK_GT_EQ},
-    {"<", TOK_LS},
-    {"<=", TOK_LS_EQ},
-    {"&&", TOK_LAND},
-    {"||", TOK_LOR},
-    {".", TOK_DOT},
-    {",", TOK_COMMA},
-    {";", TOK_SEMICOLON},
-    {":", TOK_COLON},
-    {"(", TOK_LPAREN},
-    {")", TOK_RPAREN},
-    {"{", TOK_LBRACE},
-    {"}", TOK_RBRACE},
-    {"[", TOK_LBRACKET},
-    {"]", TOK_RBRACKET},
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Byte classes. Unlike <cctype> this ignores the locale and compiles to a
+// single load.
+enum : uint8_t {
+    CC_SPACE = 1,
+    CC_DIGIT = 2,
+    CC_ALPHA = 4,       // letters and '_'
+    CC_IDENT = CC_DIGIT | CC_ALPHA,
 };
 
+static constexpr std::array<uint8_t, 256> char_classes = [] {
+    std::array<uint8_t, 256> table{};
+    for (int c = 0; c < 256; c++) {
+        if (c == ' ' || (c >= '\t' && c <= '\r')) table[c] = CC_SPACE;
+        if (c >= '0' && c <= '9') table[c] = CC_DIGIT;
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') table[c] = CC_ALPHA;
+    }
+    return table;
+}();
+
+static inline bool is_class(char c, uint8_t cls) {
+    return char_classes[(unsigned char)c] & cls;
+}
+
+// Block scanners. Each returns a bit mask with bit i set when byte i of the
+// block belongs to the class. Blocks are only loaded when they lie entirely
+// inside the input; the remainder goes through the scalar loops.
+#if defined(__AVX2__)
+#define SIMD_WIDTH 32
+using simd_mask = uint32_t;
+#define SIMD_LOAD(p)       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+#define SIMD_EQ(v, c)      _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define SIMD_IN(v, lo, hi) _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8((lo) - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8((hi) + 1), v))
+#define SIMD_OR(a, b)      _mm256_or_si256(a, b)
+#define SIMD_LOWER(v)      _mm256_or_si256(v, _mm256_set1_epi8(0x20))
+#define SIMD_MASK(v)       (simd_mask)_mm256_movemask_epi8(v)
+#elif defined(__SSE2__)
+#define SIMD_WIDTH 16
+using simd_mask = uint32_t;
+#define SIMD_LOAD(p)       _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))
+#define SIMD_EQ(v, c)      _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define SIMD_IN(v, lo, hi) _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), _mm_cmpgt_epi8(_mm_set1_epi8((hi) + 1), v))
+#define SIMD_OR(a, b)      _mm_or_si128(a, b)
+#define SIMD_LOWER(v)      _mm_or_si128(v, _mm_set1_epi8(0x20))
+#define SIMD_MASK(v)       (simd_mask)_mm_movemask_epi8(v)
+#endif
+
+#ifdef SIMD_WIDTH
+static constexpr simd_mask SIMD_FULL = SIMD_WIDTH == 32 ? 0xFFFFFFFFu : 0xFFFFu;
+
+static inline simd_mask ident_mask(const char *p) {
+    auto v = SIMD_LOAD(p);
+    // Bytes >= 0x80 compare as negative and fall out of every range
+    auto alpha = SIMD_IN(SIMD_LOWER(v), 'a', 'z');
+    auto digit = SIMD_IN(v, '0', '9');
+    return SIMD_MASK(SIMD_OR(SIMD_OR(alpha, digit), SIMD_EQ(v, '_')));
+}
+
+static inline simd_mask space_mask(const char *p) {
+    auto v = SIMD_LOAD(p);
+    return SIMD_MASK(SIMD_OR(SIMD_EQ(v, ' '), SIMD_IN(v, '\t', '\r')));
+}
+
+static inline simd_mask byte_mask(const char *p, char c) {
+    return SIMD_MASK(SIMD_EQ(SIMD_LOAD(p), c));
+}
+#endif
+
+// Length of the identifier-character run starting at `p`
+static size_t ident_run(const char *p, const char *end) {
+    const char *start = p;
+#ifdef SIMD_WIDTH
+    while (end - p >= SIMD_WIDTH) {
+        simd_mask m = ident_mask(p);
+        if (m != SIMD_FULL) {
+            return p - start + std::countr_one(m);
+        }
+        p += SIMD_WIDTH;
+    }
+#endif
+    while (p < end && is_class(*p, CC_IDENT)) {
+        p++;
+    }
+    return p - start;
+}
+
+// First occurrence of `c` in [p, end), or `end`
+static const char *find_byte(const char *p, const char *end, char c) {
+#ifdef SIMD_WIDTH
+    while (end - p >= SIMD_WIDTH) {
+        simd_mask m = byte_mask(p, c);
+        if (m != 0) {
+            return p + std::countr_zero(m);
+        }
+        p += SIMD_WIDTH;
+    }
+#endif
+    while (p < end && *p != c) {
+        p++;
+    }
+    return p;
+}
+
+static size_t count_byte(const char *p, const char *end, char c) {
+    size_t count = 0;
+#ifdef SIMD_WIDTH
+    while (end - p >= SIMD_WIDTH) {
+        count += std::popcount(byte_mask(p, c));
+        p += SIMD_WIDTH;
+    }
+#endif
+    while (p < end) {
+        count += *p++ == c;
+    }
+    return count;
+}
+
+// Keywords, resolved by length and then by character instead of hashing
+static TokenType keyword(std::string_view s) {
+    #define KW(str, tok) if (s == str) return tok
+    switch (s.size()) {
+        case 3:
+            switch (s[0]) {
+                case 'i':
+                    KW("i16", TOK_SHORT);
+                    KW("i32", TOK_INT);
+                    KW("i64", TOK_LONG);
+                    break;
+                case 'f':
+                    KW("f32", TOK_FLOAT);
+                    KW("f64", TOK_DOUBLE);
+                    KW("fun", TOK_FUN);
+                    break;
+                case 'l':
+                    KW("let", TOK_LET);
+                    break;
+                case 's':
+                    KW("str", TOK_STR);
+                    break;
+            }
+            break;
+        case 4:
+            switch (s[0]) {
+                case 't': KW("true", TOK_BOOL_L); break;
+                case 'b': KW("bool", TOK_BOOL); break;
+                case 'c': KW("char", TOK_CHAR); break;
+            }
+            break;
+        case 5:
+            switch (s[0]) {
+                case 'f': KW("false", TOK_BOOL_L); break;
+                case 'c': KW("const", TOK_CONST); break;
+            }
+            break;
+        case 6:
+            switch (s[0]) {
+                case 'r': KW("return", TOK_RET); break;
+                case 'i': KW("import", TOK_IMPORT); break;
+            }
+            break;
+    }
+    return TOK_ID;
+    #undef KW
+}
+
 std::vector<Token> Lexer::tokenize() {
     std::vector<Token> tokens;
+    for (Token tok = next(); tok.type != TOK_EOF; tok = next()) {
+        tokens.push_back(tok);
+    }
+    return tokens;
+}
 
+Token Lexer::next() {
     while (pos < src.length()) {
-        const char c = peek();
-        if (c == '/' && (peek(1) == '/' || peek(1) == '*')) {
-            skip_comments();
+        const char c = src[pos];
+        uint8_t cls = char_classes[(unsigned char)c];
+        if (cls & CC_SPACE) {
+            skip_spaces();
         }
-        else if (std::isspace(c)) {
-            advance();
+        else if (cls & CC_ALPHA) {
+            return tokenize_id();
         }
-        else if (std::isdigit(c)) {
-            tokens.push_back(tokenize_num());
+        else if (cls & CC_DIGIT) {
+            return tokenize_num();
         }
-        else if (std::isalpha(c) || c == '_') {
-            tokens.push_back(tokenize_id());
+        else if (c == '/' && pos + 1 < src.length() && (src[pos + 1] == '/' || src[pos + 1] == '*')) {
+            skip_comments();
         }
         else if (c == '"') {
-            tokens.push_back(tokenize_str());
+            return tokenize_str();
         }
         else if (c == '\'') {
-            tokens.push_back(tokenize_char());
+            return tokenize_char();
         }
         else {
-            tokens.push_back(tokenize_op());
+            return tokenize_op();
         }
     }
-
-    return tokens;
+    return Token(TOK_EOF, loc);
 }
 
 Token Lexer::tokenize_num() {
     Location loc = this->loc;
-    std::string val;
+    uint64_t start = pos;
     bool has_dot = false;
-    while (pos < src.length() && (std::isdigit(peek()) || peek() == '.')) {
-        if (peek() == '.') {
+    while (pos < src.length() && (is_class(src[pos], CC_DIGIT) || src[pos] == '.')) {
+        if (src[pos] == '.') {
             if (has_dot) {
                 error(file_name, "Invalid number literal: twice dot", loc);
             }
-            else {
-                has_dot = true;
-            }
+            has_dot = true;
         }
-        val += std::string{advance()};
+        pos++;
     }
-    #define TOK(type) Token(type, val, loc)
-    const char suffix = pos < src.length() ? peek() : '\0';
-    switch (tolower(suffix)) {
+    std::string_view val = src.substr(start, pos - start);
+
+    TokenType type = has_dot ? TOK_DOUBLE_L : TOK_INT_L;
+    const char suffix = pos < src.length() ? src[pos] | 0x20 : '\0';
+    switch (suffix) {
         case 'l':
-            return TOK(TOK_LONG_L);
+            type = TOK_LONG_L;
+            pos++;
+            break;
         case 'f':
-            return TOK(TOK_FLOAT_L);
+            type = TOK_FLOAT_L;
+            pos++;
+            break;
         case 's':
-            return TOK(TOK_SHORT_L);
+            type = TOK_SHORT_L;
+            pos++;
+            break;
     }
-    if (has_dot) {
-        return TOK(TOK_DOUBLE_L);
+    this->loc.column += pos - start;
+
+    Token tok(type, val, loc);
+    std::from_chars_result res;
+    if (type == TOK_FLOAT_L || type == TOK_DOUBLE_L) {
+        res = std::from_chars(val.data(), val.data() + val.size(), tok.fval);
+    }
+    else {
+        res = std::from_chars(val.data(), val.data() + val.size(), tok.ival);
+    }
+    // Literals are unsigned here, so only the upper bound of their type matters
+    bool too_big = (type == TOK_INT_L && tok.ival > INT32_MAX) || (type == TOK_SHORT_L && tok.ival > INT16_MAX);
+    if (res.ec == std::errc::result_out_of_range || too_big) {
+        error(file_name, "Invalid number literal: out of range", loc);
     }
-    return TOK(TOK_INT_L);
-    #undef TOK
+    if (res.ec != std::errc() || res.ptr != val.data() + val.size()) {
+        error(file_name, "Invalid number literal", loc);
+    }
+    return tok;
 }
 
 Token Lexer::tokenize_str() {
     Location loc = this->loc;
-    std::string val;
     advance();
-    while (pos < src.length() && peek() != '"') {
-        val += std::string{advance()};
-    }
-    if (pos == src.length() - 1) {
+    uint64_t start = pos;
+    uint64_t end = find_byte(src.data() + pos, src.data() + src.length(), '"') - src.data();
+    if (end == src.length()) {
         error(file_name, "Invalid string literal: there is no closing double quotation mark", loc);
     }
-    advance();
-    return Token(TOK_STR_L, val, loc);
+    advance_to(end + 1);
+    return Token(TOK_STR_L, src.substr(start, end - start), loc);
 }
 
 Token Lexer::tokenize_char() {
     Location loc = this->loc;
-    std::string val;
     advance();
-    while (pos < src.length() && peek() != '\'') {
-        val += std::string{advance()};
-    }
-    if (pos == src.length() - 1) {
+    uint64_t start = pos;
+    uint64_t end = find_byte(src.data() + pos, src.data() + src.length(), '\'') - src.data();
+    if (end == src.length()) {
         error(file_name, "Invalid character literal: there is no closing single quotation mark", loc);
     }
-    advance();
+    advance_to(end + 1);
+    std::string_view val = src.substr(start, end - start);
     if (val.length() != 1) {
         error(file_name, "Invalid character literal: the length of the literal must be 1", loc);
     }
@@ -138,51 +293,109 @@ Token Lexer::tokenize_char() {
 
 Token Lexer::tokenize_id() {
     Location loc = this->loc;
-    std::string val;
-    while (pos < src.length() && (std::isalpha(peek()) || std::isdigit(peek()) || peek() == '_')) {
-        val += std::string{advance()};
-    }
-    auto it = spec_symbols.find(val);
-    if (it != spec_symbols.end()) {
-        if (it->second == TOK_BOOL_L || it->second >= TOK_BOOL && it->second <= TOK_DOUBLE) {
-            return Token(it->second, val, loc);
-        }
-        return Token(it->second, loc);
+    size_t len = ident_run(src.data() + pos, src.data() + src.length());
+    std::string_view val = src.substr(pos, len);
+    pos += len;
+    this->loc.column += len;
+
+    TokenType type = keyword(val);
+    if (type == TOK_ID || type == TOK_BOOL_L || (type >= TOK_BOOL && type <= TOK_STR)) {
+        return Token(type, val, loc);
     }
-    return Token(TOK_ID, val, loc);
+    return Token(type, loc);
 }
 
 Token Lexer::tokenize_op() {
     Location loc = this->loc;
-    std::string op = std::string{advance()};
-    if (pos < src.length()) {
-        op += std::string{peek()};
-    }
-    auto it = spec_symbols.find(op);
-    if (it != spec_symbols.end()) {
-        if (pos < src.length()) {
-            advance();
+    const char c = advance();
+    const char n = pos < src.length() ? src[pos] : '\0';
+    // Two-character operators first, then single characters
+    #define OP2(second, tok) if (n == second) { advance(); return Token(tok, loc); }
+    switch (c) {
+        case '+': return Token(TOK_PLUS, loc);
+        case '-': return Token(TOK_MINUS, loc);
+        case '*': return Token(TOK_STAR, loc);
+        case '/': return Token(TOK_SLASH, loc);
+        case '%': return Token(TOK_PRECENT, loc);
+        case '=': OP2('=', TOK_EQ_EQ) return Token(TOK_EQ, loc);
+        case '!': OP2('=', TOK_NOT_EQ) return Token(TOK_NOT, loc);
+        case '>': OP2('=', TOK_GT_EQ) return Token(TOK_GT, loc);
+        case '<': OP2('=', TOK_LS_EQ) return Token(TOK_LS, loc);
+        case '&': OP2('&', TOK_LAND) break;
+        case '|': OP2('|', TOK_LOR) break;
+        case '.': return Token(TOK_DOT, loc);
+        case ',': return Token(TOK_COMMA, loc);
+        case ';': return Token(TOK_SEMICOLON, loc);
+        case ':': return Token(TOK_COLON, loc);
+        case '(': return Token(TOK_LPAREN, loc);
+        case ')': return Token(TOK_RPAREN, loc);
+        case '{': return Token(TOK_LBRACE, loc);
+        case '}': return Token(TOK_RBRACE, loc);
+        case '[': return Token(TOK_LBRACKET, loc);
+        case ']': return Token(TOK_RBRACKET, loc);
+    }
+    #undef OP2
+    error(file_name, "Unsupported operator: \033[0m'" + std::string{c} + "'\033[31m", loc);
+}
+
+void Lexer::skip_comments() {
+    const char *begin = src.data();
+    const char *end = begin + src.length();
+    if (src[pos + 1] == '/') {
+        // The newline itself is left to skip_spaces
+        advance_to(find_byte(begin + pos + 2, end, '\n') - begin);
+        return;
+    }
+    Location loc = this->loc;
+    const char *p = begin + pos + 2;
+    for (;;) {
+        p = find_byte(p, end, '*');
+        if (p + 1 >= end) {
+            error(file_name, "Invalid comment: there is no closing \033[0m'*/'\033[31m", loc);
+        }
+        if (p[1] == '/') {
+            break;
         }
-        return Token(it->second, loc);
+        p++;
     }
-    else {
-        op = std::string{op[0]};
-        it = spec_symbols.find(op);
-        if (it != spec_symbols.end()) {
-            return Token(it->second, loc);
+    advance_to(p + 2 - begin);
+}
+
+void Lexer::skip_spaces() {
+    const char *begin = src.data();
+    const char *end = begin + src.length();
+    const char *p = begin + pos;
+#ifdef SIMD_WIDTH
+    while (end - p >= SIMD_WIDTH) {
+        simd_mask m = space_mask(p);
+        if (m != SIMD_FULL) {
+            p += std::countr_one(m);
+            advance_to(p - begin);
+            return;
         }
+        p += SIMD_WIDTH;
+    }
+#endif
+    while (p < end && is_class(*p, CC_SPACE)) {
+        p++;
     }
-    error(file_name, "Unsupported operator: \033[0m'" + std::string{op[0]} + "'\033[31m", loc);
+    advance_to(p - begin);
 }
 
-void Lexer::skip_comments() {
-    advance();  // skip '/'
-    if (advance() == '/') {
-        while (advance() != '\n');
+// Moves to `new_pos`, counting the newlines in between to keep `loc` exact
+void Lexer::advance_to(uint64_t new_pos) {
+    const char *p = src.data() + pos;
+    const char *end = src.data() + new_pos;
+    size_t lines = count_byte(p, end, '\n');
+    if (lines == 0) {
+        loc.column += end - p;
     }
     else {
-        while (advance() != '*' || advance() != '/');
+        const char *last = static_cast<const char*>(memrchr(p, '\n', end - p));
+        loc.line += lines;
+        loc.column = end - last;
     }
+    pos = new_pos;
 }
 
 const char Lexer::peek(uint64_t rpos) const {
@@ -203,4 +416,4 @@ const char Lexer::advance() {
         loc.column++;
     }
     return c;
-}
\ No newline at end of file
+}
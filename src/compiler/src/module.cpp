@@ -0,0 +1,535 @@
+#include "../../vm/include/bytecode.h"
+#include "../../vm/include/executor.h"
+#include "../../vm/include/opcodes.h"
+#include "../../vm/include/verifier.h"
+#include "../include/exception.h"
+#include "../include/lexer.h"
+#include "../include/module.h"
+#include "../include/optimizer.h"
+#include "../include/parser.h"
+#include "../include/peephole.h"
+#include "../include/sema.h"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// LinkTable encoding: counts and string lengths are 4-byte native words,
+// types one byte each:
+//     imported_globals, count, {name_len, name, type, is_const}[count]
+//     imported_functions, count, {name_len, name, ret, param_count, params}[count]
+static void put_u32(std::vector<uint8_t>& out, uint32_t val) {
+    uint8_t bytes[4];
+    memcpy(bytes, &val, sizeof(bytes));
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+static void put_name(std::vector<uint8_t>& out, const std::string& name) {
+    put_u32(out, name.size());
+    out.insert(out.end(), name.begin(), name.end());
+}
+
+std::vector<uint8_t> LinkTable::encode() const {
+    std::vector<uint8_t> out;
+    put_u32(out, imported_globals);
+    put_u32(out, globals.size());
+    for (auto& global : globals) {
+        put_name(out, global.name);
+        out.push_back(global.type);
+        out.push_back(global.is_const);
+    }
+    put_u32(out, imported_functions);
+    put_u32(out, functions.size());
+    for (auto& fn : functions) {
+        put_name(out, fn.name);
+        out.push_back(fn.ret);
+        out.push_back(fn.params.size());
+        out.insert(out.end(), fn.params.begin(), fn.params.end());
+    }
+    return out;
+}
+
+bool LinkTable::decode(const uint8_t *data, size_t size) {
+    const uint8_t *end = data + size;
+    auto u32 = [&](uint32_t& val) {
+        if (end - data < 4) {
+            return false;
+        }
+        memcpy(&val, data, 4);
+        data += 4;
+        return true;
+    };
+    auto byte = [&](uint8_t& val) {
+        if (data == end) {
+            return false;
+        }
+        val = *data++;
+        return true;
+    };
+    auto type = [&](TypeValue& val) {
+        uint8_t b;
+        if (!byte(b) || b > TYPE_CLASS) {
+            return false;
+        }
+        val = static_cast<TypeValue>(b);
+        return true;
+    };
+    auto name = [&](std::string& val) {
+        uint32_t len;
+        if (!u32(len) || (size_t)(end - data) < len) {
+            return false;
+        }
+        val.assign(reinterpret_cast<const char*>(data), len);
+        data += len;
+        return true;
+    };
+
+    uint32_t count;
+    if (!u32(imported_globals) || !u32(count) || imported_globals > count) {
+        return false;
+    }
+    globals.resize(count);
+    for (auto& global : globals) {
+        uint8_t is_const;
+        if (!name(global.name) || !type(global.type) || !byte(is_const)) {
+            return false;
+        }
+        global.is_const = is_const;
+    }
+    if (!u32(imported_functions) || !u32(count) || imported_functions > count) {
+        return false;
+    }
+    functions.resize(count);
+    for (auto& fn : functions) {
+        uint8_t param_count;
+        if (!name(fn.name) || !type(fn.ret) || !byte(param_count)) {
+            return false;
+        }
+        fn.params.resize(param_count);
+        for (auto& param : fn.params) {
+            if (!type(param)) {
+                return false;
+            }
+        }
+    }
+    return data == end;
+}
+
+ModuleBuilder::ModuleBuilder(Backend b, bool cache, size_t t, std::vector<LinkTable::Function> n, uint8_t level) : backend(b), use_cache(cache), threads(t), opt_level(level), natives(std::move(n)) {
+    // The cache key covers everything that changes the generated code
+    std::string options = "v" + std::to_string(BytecodeHeader::VERSION) + (backend == BACKEND_REG ? ":reg" : ":stack");
+    if (!natives.empty()) {
+        LinkTable table;
+        table.functions = natives;
+        std::vector<uint8_t> encoded = table.encode();
+        options.append(encoded.begin(), encoded.end());
+    }
+    options_key = bytecode::key(options);
+}
+
+ModuleBuilder::~ModuleBuilder() {
+    for (auto& module : modules) {
+        delete module->chunk;
+    }
+}
+
+Chunk *ModuleBuilder::build(const std::string& path, const std::string *text) {
+    std::string root = std::filesystem::weakly_canonical(std::filesystem::absolute(path)).string();
+    if (scan(root, text) == UINT32_MAX) {
+        return nullptr;
+    }
+    if (modules.size() == 1) {
+        compile(*modules[0]);
+        return optimize(link());
+    }
+
+    // A module is submitted by whichever of its imports finishes last. The
+    // pool threads throw like the caller does; the first error stops
+    // submitting and is rethrown here once the pool is idle.
+    size_t count = threads ? threads : std::thread::hardware_concurrency();
+    Executor executor(std::clamp<size_t>(count, 1, modules.size()));
+    bool throws = error_throws;
+    std::mutex failed_mutex;
+    std::exception_ptr failed;
+    std::function<void(uint32_t)> start = [&](uint32_t index) {
+        executor.submit([&, index] {
+            error_throws = throws;
+            try {
+                compile(*modules[index]);
+            }
+            catch (...) {
+                std::lock_guard lock(failed_mutex);
+                if (!failed) {
+                    failed = std::current_exception();
+                }
+                return;
+            }
+            for (uint32_t importer : modules[index]->importers) {
+                if (--modules[importer]->waiting == 0) {
+                    start(importer);
+                }
+            }
+        });
+    };
+    // Only modules without imports start here: once the pool is running, a
+    // module whose `waiting` reads 0 may already have been submitted
+    for (uint32_t i = 0; i < modules.size(); i++) {
+        if (modules[i]->imports.empty()) {
+            start(i);
+        }
+    }
+    executor.wait();
+    if (failed) {
+        std::rethrow_exception(failed);
+    }
+    return optimize(link());
+}
+
+SourceKey ModuleBuilder::program_key() const {
+    if (modules.empty()) {
+        return {0, 0};
+    }
+    // Module chunks do not depend on the optimization level; the program does
+    return bytecode::key(std::string_view(reinterpret_cast<const char*>(&opt_level), 1), modules.back()->key);
+}
+
+// Maps the file and reads only its imports, which come first, then scans
+// every imported file depth first. Modules are numbered once their imports
+// are, so every import gets a lower index than its importers.
+uint32_t ModuleBuilder::scan(const std::string& path, const std::string *text) {
+    auto module = std::make_unique<Module>();
+    module->path = path;
+    if (text != nullptr) {
+        module->source.assign(*text);
+    }
+    else if (!module->source.open(path)) {
+        return UINT32_MAX;
+    }
+    ASTContext ctx;
+    Lexer lex(module->source.text(), module->path);
+    Parser parser(module->path, lex, ctx);
+    std::vector<ASTNodePtr> imports = parser.parse_imports();
+
+    import_chain.push_back(path);
+    SourceKey seed = options_key;
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    for (ASTNodePtr stmt : imports) {
+        auto is = stmt->as<ISNode>();
+        std::string target = std::filesystem::weakly_canonical(dir / ctx.symbols.name(is->path)).string();
+        if (std::find(import_chain.begin(), import_chain.end(), target) != import_chain.end()) {
+            error(path, "Circular import", is->pos);
+        }
+        auto it = module_index.find(target);
+        uint32_t index = it != module_index.end() ? it->second : scan(target);
+        if (index == UINT32_MAX) {
+            error(path, "Cannot open module \033[0m'" + target + "'\033[31m", is->pos);
+        }
+        auto seen = [&](const std::pair<uint32_t, Location>& import) { return import.first == index; };
+        if (std::any_of(module->imports.begin(), module->imports.end(), seen)) {
+            continue;
+        }
+        module->imports.push_back({index, is->pos});
+        SourceKey key = modules[index]->key;
+        seed = bytecode::key(std::string_view(reinterpret_cast<const char*>(&key), sizeof(key)), seed);
+    }
+    import_chain.pop_back();
+
+    module->key = bytecode::key(module->source.text(), seed);
+    module->waiting = module->imports.size();
+    uint32_t index = modules.size();
+    for (auto& [dep, pos] : module->imports) {
+        modules[dep]->importers.push_back(index);
+    }
+    module_index.emplace(path, index);
+    modules.push_back(std::move(module));
+    return index;
+}
+
+// A bodiless FDSNode in the module's arena, so the usual call checks apply
+// to functions defined elsewhere
+static const FDSNode *declare(ASTContext& ctx, const LinkTable::Function& fn, Location pos) {
+    Param *params = ctx.arena.make_array<Param>(fn.params.size());
+    for (size_t n = 0; n < fn.params.size(); n++) {
+        new (&params[n]) Param{Type(fn.params[n], false), 0};
+    }
+    return ctx.make<FDSNode>(Type(fn.ret, false), ctx.symbols.intern(fn.name), params, fn.params.size(), nullptr, 0, pos);
+}
+
+// Runs on a pool thread once every import is compiled. Only the module
+// itself is written; imports are read.
+void ModuleBuilder::compile(Module& module) {
+    if (use_cache) {
+        Chunk *chunk = bytecode::load_cached(module.key);
+        if (chunk != nullptr && module.table.decode(chunk->sym_data(), chunk->sym_size())) {
+            module.chunk = chunk;
+            return;
+        }
+        delete chunk;
+        module.table = LinkTable();
+    }
+
+    std::string_view file_name = module.path;
+    Lexer lex(module.source.text(), file_name);
+    ASTContext ctx;
+    Parser parser(file_name, lex, ctx);
+    std::vector<ASTNodePtr> stmts(parser.parse());
+
+    Sema sema(file_name, stmts, ctx);
+    LinkTable& table = module.table;
+    for (auto& [dep, pos] : module.imports) {
+        const LinkTable& imported = modules[dep]->table;
+        for (size_t i = imported.imported_globals; i < imported.globals.size(); i++) {
+            auto& global = imported.globals[i];
+            if (!sema.import_global(ctx.symbols.intern(global.name), Type(global.type, global.is_const))) {
+                error(file_name, "Imports define \033[0m'" + global.name + "'\033[31m more than once", pos);
+            }
+            table.globals.push_back(global);
+        }
+        for (size_t i = imported.imported_functions; i < imported.functions.size(); i++) {
+            auto& fn = imported.functions[i];
+            if (!sema.import_function(declare(ctx, fn, pos))) {
+                error(file_name, "Imports define \033[0m'" + fn.name + "'\033[31m more than once", pos);
+            }
+            table.functions.push_back(fn);
+        }
+    }
+    table.imported_globals = table.globals.size();
+    table.imported_functions = table.functions.size();
+    for (uint32_t i = 0; i < natives.size(); i++) {
+        if (!sema.import_native(declare(ctx, natives[i], {0, 0}), i)) {
+            error(file_name, "Imports define \033[0m'" + natives[i].name + "'\033[31m, which is a native function", {0, 0});
+        }
+    }
+
+    stmts = sema.analyze();
+    CodeGen codegen(file_name, stmts, ctx, sema, backend);
+    Chunk *chunk = codegen.generate();
+    auto& globals = sema.globals();
+    for (size_t i = table.imported_globals; i < globals.size(); i++) {
+        table.globals.push_back({std::string(ctx.symbols.name(globals[i].name)), globals[i].type.type, globals[i].type.is_const});
+    }
+    auto& functions = sema.functions();
+    for (size_t i = table.imported_functions; i < functions.size(); i++) {
+        const FDSNode *fds = functions[i];
+        LinkTable::Function fn{std::string(ctx.symbols.name(fds->name)), fds->type.type, {}};
+        for (uint32_t n = 0; n < fds->param_count; n++) {
+            fn.params.push_back(fds->params[n].type.type);
+        }
+        table.functions.push_back(std::move(fn));
+    }
+    chunk->symbols = table.encode();
+    module.chunk = chunk;
+    if (use_cache) {
+        bytecode::store_cached(*chunk, module.key);
+    }
+}
+
+// Whole-program passes, run once every module is linked in. The result is
+// verified, so that the VM runs it without stack checks; code the verifier
+// rejects is a compiler bug.
+Chunk *ModuleBuilder::optimize(Chunk *chunk) {
+    Optimizer(*chunk, opt_level).run();
+    Peephole(*chunk).run();
+    if (!verifier::verify(*chunk)) {
+        delete chunk;
+        error(modules.back()->path, "Internal error: generated code fails verification", {0, 0});
+    }
+    return chunk;
+}
+
+static void write_operand(uint8_t *code, uint32_t val) {
+    code[0] = (val >> 16) & 0xFF;
+    code[1] = (val >> 8) & 0xFF;
+    code[2] = val & 0xFF;
+}
+
+// Lays the modules out one after another: the top-level code of every module
+// in order, then a HALT, then each module's function bodies. Constants,
+// globals and functions are renumbered and imports bound by name; string
+// literals are merged, since the VM relies on there being one pool record
+// per text.
+Chunk *ModuleBuilder::link() {
+    if (modules.size() == 1) {
+        Chunk *chunk = modules[0]->chunk;
+        modules[0]->chunk = nullptr;
+        return chunk;
+    }
+
+    struct Relocation {
+        uint32_t const_base;
+        std::vector<uint32_t> globals;
+        std::vector<uint32_t> functions;
+        std::unordered_map<uint32_t, uint32_t> strings;     // old pool offset to new
+    };
+    std::vector<Relocation> relocs(modules.size());
+    Chunk *linked = new Chunk();
+    linked->kind = modules[0]->chunk->kind;
+    LinkTable table;
+    std::unordered_map<std::string, uint32_t> global_index, function_index;
+    std::unordered_map<std::string_view, uint32_t> literals;
+    uint32_t num_consts = 0;
+
+    for (size_t m = 0; m < modules.size(); m++) {
+        const Module& module = *modules[m];
+        const Chunk& chunk = *module.chunk;
+        Relocation& reloc = relocs[m];
+        reloc.const_base = num_consts;
+        num_consts += chunk.const_count();
+        linked->num_locals = std::max(linked->num_locals, chunk.num_locals);
+        linked->num_temps = std::max(linked->num_temps, chunk.num_temps);
+
+        auto bind = [&](const std::string& name, uint32_t index, bool imported, auto& by_name, std::vector<uint32_t>& map) {
+            if (imported) {
+                auto it = by_name.find(name);
+                if (it == by_name.end()) {
+                    error(module.path, "Imported \033[0m'" + name + "'\033[31m is not defined", {0, 0});
+                }
+                map.push_back(it->second);
+            }
+            else if (!by_name.emplace(name, index).second) {
+                error(module.path, "\033[0m'" + name + "'\033[31m is defined by more than one module", {0, 0});
+            }
+            else {
+                map.push_back(index);
+            }
+            return !imported;
+        };
+        for (size_t i = 0; i < module.table.globals.size(); i++) {
+            auto& global = module.table.globals[i];
+            if (bind(global.name, table.globals.size(), i < module.table.imported_globals, global_index, reloc.globals)) {
+                table.globals.push_back(global);
+            }
+        }
+        for (size_t i = 0; i < module.table.functions.size(); i++) {
+            auto& fn = module.table.functions[i];
+            if (bind(fn.name, table.functions.size(), i < module.table.imported_functions, function_index, reloc.functions)) {
+                table.functions.push_back(fn);
+            }
+        }
+
+        const uint8_t *pool = chunk.str_data();
+        for (size_t pos = 0; pos < chunk.str_size();) {
+            Obj *s = reinterpret_cast<Obj*>(const_cast<uint8_t*>(pool + pos));
+            std::string_view text(str::chars(s), str::flat(s)->length);
+            auto it = literals.find(text);
+            if (it == literals.end()) {
+                it = literals.emplace(text, str::add_literal(linked->strings, text)).first;
+            }
+            reloc.strings.emplace(pos, it->second);
+            pos += s->size;
+        }
+        for (size_t i = 0; i < chunk.const_count(); i++) {
+            linked->constants.push_back(chunk.const_data()[i]);
+        }
+    }
+    linked->num_globals = table.globals.size();
+    if (num_consts >= (1u << 24) || linked->num_globals >= (1u << 24) || table.functions.size() >= (1u << 24) ||
+        linked->strings.size() >= (1u << 24) || (linked->kind == CHUNK_REG && num_consts + linked->num_globals + linked->num_temps > (1u << 24))) {
+        error(modules.back()->path, "Program is too large to link", {0, 0});
+    }
+
+    if (linked->kind == CHUNK_REG) {
+        // Register operands index [constants | globals | temporaries]
+        uint32_t temp_base = num_consts + linked->num_globals;
+        for (size_t m = 0; m < modules.size(); m++) {
+            const Chunk& chunk = *modules[m]->chunk;
+            const Relocation& reloc = relocs[m];
+            const uint8_t *code = chunk.code_data();
+            uint32_t consts = chunk.const_count();
+            for (size_t pos = 0; code[pos] != ROP_HALT; pos += reg_op_size(code[pos])) {
+                size_t at = linked->code.size();
+                linked->code.insert(linked->code.end(), code + pos, code + pos + reg_op_size(code[pos]));
+                for (uint8_t i = 0; i < reg_op_operands(code[pos]); i++) {
+                    uint32_t reg = read_operand(code + pos + 1 + 3 * i);
+                    if (reg < consts) {
+                        reg += reloc.const_base;
+                    }
+                    else if (reg < consts + chunk.num_globals) {
+                        reg = num_consts + reloc.globals[reg - consts];
+                    }
+                    else {
+                        reg = temp_base + reg - consts - chunk.num_globals;
+                    }
+                    write_operand(&linked->code[at + 1 + 3 * i], reg);
+                }
+            }
+        }
+        linked->code.push_back(ROP_HALT);
+        linked->symbols = table.encode();
+        return linked;
+    }
+
+    auto relocate = [&](const Relocation& reloc, const uint8_t *code, size_t start, size_t end) {
+        for (size_t pos = start; pos < end; pos += op_size(code[pos])) {
+            size_t at = linked->code.size();
+            linked->code.insert(linked->code.end(), code + pos, code + pos + op_size(code[pos]));
+            uint8_t *operands = &linked->code[at + 1];
+            switch (code[pos]) {
+                case OP_PCONST:
+                case OP_IADDK: case OP_ISUBK: case OP_IMULK:
+                case OP_FADDK: case OP_FSUBK: case OP_FMULK:
+                    write_operand(operands, reloc.const_base + read_operand(operands));
+                    break;
+                case OP_LDGLOB:
+                case OP_STGLOB:
+                    write_operand(operands, reloc.globals[read_operand(operands)]);
+                    break;
+                case OP_CALL:
+                case OP_TAILCALL:
+                    write_operand(operands, reloc.functions[read_operand(operands)]);
+                    break;
+                case OP_PSTR:
+                    write_operand(operands, reloc.strings.at(read_operand(operands)));
+                    break;
+                case OP_IADD_GG:
+                    write_operand(operands, reloc.globals[read_operand(operands)]);
+                    write_operand(operands + 3, reloc.globals[read_operand(operands + 3)]);
+                    break;
+                case OP_STGLOBK:
+                    write_operand(operands, reloc.const_base + read_operand(operands));
+                    write_operand(operands + 3, reloc.globals[read_operand(operands + 3)]);
+                    break;
+            }
+        }
+    };
+
+    // Top-level code runs up to the module's first HALT
+    std::vector<size_t> top_level_end(modules.size());
+    for (size_t m = 0; m < modules.size(); m++) {
+        const uint8_t *code = modules[m]->chunk->code_data();
+        size_t pos = 0;
+        while (code[pos] != OP_HALT) {
+            pos += op_size(code[pos]);
+        }
+        top_level_end[m] = pos;
+        relocate(relocs[m], code, 0, pos);
+    }
+    linked->code.push_back(OP_HALT);
+
+    linked->ref_map.resize(linked->num_globals);
+    std::vector<uint8_t> param_refs;
+    for (size_t m = 0; m < modules.size(); m++) {
+        const Module& module = *modules[m];
+        const Chunk& chunk = *module.chunk;
+        const uint8_t *refs = chunk.ref_data();
+        for (size_t i = module.table.imported_globals; i < chunk.num_globals; i++) {
+            linked->ref_map[relocs[m].globals[i]] = refs[i];
+        }
+        size_t start = top_level_end[m] + 1;
+        int64_t delta = (int64_t)linked->code.size() - (int64_t)start;
+        relocate(relocs[m], chunk.code_data(), start, chunk.code_size());
+        for (size_t i = module.table.imported_functions; i < chunk.func_count(); i++) {
+            Function fn = chunk.func_data()[i];
+            fn.entry += delta;
+            param_refs.insert(param_refs.end(), refs + fn.param_refs, refs + fn.param_refs + fn.arity);
+            fn.param_refs = linked->num_globals + param_refs.size() - fn.arity;
+            linked->functions.push_back(fn);
+        }
+    }
+    linked->ref_map.insert(linked->ref_map.end(), param_refs.begin(), param_refs.end());
+    linked->symbols = table.encode();
+    return linked;
+}
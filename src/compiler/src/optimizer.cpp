@@ -0,0 +1,294 @@
+#include "../../vm/include/opcodes.h"
+#include "../include/optimizer.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+void Optimizer::run() {
+    if (level == 0 || chunk.kind != CHUNK_STACK || chunk.mapping != nullptr) {
+        return;
+    }
+    // Block 0 is the top-level code, block f + 1 the body of function f.
+    // CodeGen lays them out back to back in that order.
+    size_t count = chunk.functions.size();
+    std::vector<IRBlock> blocks(count + 1);
+    size_t end = 0;
+    for (size_t b = 0; b <= count; b++) {
+        uint32_t func = b == 0 ? UINT32_MAX : b - 1;
+        if (b > 0 && chunk.functions[func].entry != end) {
+            return;
+        }
+        if (!ir::lift(chunk, func, blocks[b], end)) {
+            return;
+        }
+    }
+
+    for (IRBlock& block : blocks) {
+        propagate_copies(block);
+        reduce_strength(block);
+        propagate_copies(block);        // folding exposes more identities
+        number_values(block);
+    }
+    // Dropping a store can leave the loads feeding it dead, and with them
+    // the last reads of other globals
+    std::vector<uint8_t> read_globals(chunk.num_globals, 1);
+    for (;;) {
+        for (IRBlock& block : blocks) {
+            eliminate_dead(block, read_globals);
+        }
+        if (level < 2) {
+            break;
+        }
+        std::vector<uint8_t> read(chunk.num_globals, 0);
+        for (const IRBlock& block : blocks) {
+            for (const IRInst& inst : block.insts) {
+                if (inst.live && inst.op == OP_LDGLOB) {
+                    read[inst.imm] = 1;
+                }
+            }
+        }
+        if (read == read_globals) {
+            break;
+        }
+        read_globals = std::move(read);
+    }
+
+    std::vector<uint8_t> code;
+    std::vector<Function> functions = chunk.functions;
+    uint32_t num_locals;
+    if (!ir::lower(blocks[0], code, num_locals)) {
+        return;
+    }
+    for (size_t f = 0; f < count; f++) {
+        uint32_t num_slots;
+        functions[f].entry = code.size();
+        if (!ir::lower(blocks[f + 1], code, num_slots)) {
+            return;
+        }
+        functions[f].num_slots = num_slots;
+    }
+    if (count > 0) {
+        code.push_back(OP_HALT);
+    }
+    chunk.code = std::move(code);
+    chunk.functions = std::move(functions);
+    chunk.num_locals = num_locals;
+}
+
+// Index of a constant with these bits, added to the pool if needed.
+// UINT32_MAX when the pool is full.
+uint32_t Optimizer::constant(int64_t bits) {
+    if (constant_index.empty()) {
+        for (uint32_t i = 0; i < chunk.constants.size(); i++) {
+            constant_index.emplace(chunk.constants[i].ival, i);
+        }
+    }
+    auto it = constant_index.find(bits);
+    if (it != constant_index.end()) {
+        return it->second;
+    }
+    if (chunk.constants.size() >= 1 << 24) {
+        return UINT32_MAX;
+    }
+    StackSlot slot;
+    slot.ival = bits;
+    chunk.constants.push_back(slot);
+    constant_index.emplace(bits, chunk.constants.size() - 1);
+    return chunk.constants.size() - 1;
+}
+
+bool Optimizer::constant_of(const IRBlock& block, uint32_t val, int64_t& bits) const {
+    const IRInst& inst = block.insts[val];
+    if (inst.op != OP_PCONST) {
+        return false;
+    }
+    bits = chunk.constants[inst.imm].ival;
+    return true;
+}
+
+// Slots are already gone (see ir::lift); this forwards a global stored in the
+// block to its later loads and drops operations that return an operand
+// unchanged.
+void Optimizer::propagate_copies(IRBlock& block) {
+    std::vector<IRInst>& insts = block.insts;
+    std::vector<uint32_t> repl(insts.size());
+    std::unordered_map<uint32_t, uint32_t> stored;     // global, value
+    for (uint32_t i = 0; i < insts.size(); i++) {
+        repl[i] = i;
+        IRInst& inst = insts[i];
+        if (!inst.live) {
+            continue;
+        }
+        for (uint32_t& arg : inst.args) {
+            arg = repl[arg];
+        }
+        int64_t k;
+        auto is = [&](size_t arg, int64_t value) {
+            return constant_of(block, inst.args[arg], k) && k == value;
+        };
+        uint32_t same = UINT32_MAX;
+        switch (inst.op) {
+            case OP_STGLOB:
+                stored[inst.imm] = inst.args[0];
+                break;
+            case OP_LDGLOB: {
+                auto it = stored.find(inst.imm);
+                if (it != stored.end()) {
+                    same = it->second;
+                }
+                break;
+            }
+            case OP_IADD:
+                if (is(1, 0)) same = inst.args[0];
+                else if (is(0, 0)) same = inst.args[1];
+                break;
+            case OP_IMUL:
+                if (is(1, 1)) same = inst.args[0];
+                else if (is(0, 1)) same = inst.args[1];
+                break;
+            case OP_ISUB:
+            case OP_IDIV:
+                if (is(1, inst.op == OP_ISUB ? 0 : 1)) same = inst.args[0];
+                break;
+            case OP_UIMINUS:
+            case OP_UFMINUS:
+                if (insts[inst.args[0]].op == inst.op) same = insts[inst.args[0]].args[0];
+                break;
+        }
+        if (same != UINT32_MAX) {
+            repl[i] = same;
+            inst.live = false;
+        }
+    }
+}
+
+// Folds operations on constants and turns multiplications and remainders by
+// powers of two into shifts and masks. Integer arithmetic wraps like the VM's;
+// divisions that would trap at run time are left for run time.
+void Optimizer::reduce_strength(IRBlock& block) {
+    for (IRInst& inst : block.insts) {
+        if (!inst.live || inst.args.empty() || !ir::is_pure(inst.op)) {
+            continue;
+        }
+        int64_t a = 0, b = 0;
+        bool ka = constant_of(block, inst.args[0], a);
+        bool kb = inst.args.size() > 1 && constant_of(block, inst.args[1], b);
+        auto fold = [&](IRType type, int64_t bits) {
+            uint32_t index = constant(bits);
+            if (index != UINT32_MAX) {
+                inst = {OP_PCONST, type, true, index, {}};
+            }
+        };
+        auto fold_float = [&](double value) {
+            fold(IR_FLOAT, std::bit_cast<int64_t>(value));
+        };
+        auto reduce = [&](uint8_t op, int shift, uint32_t arg) {
+            inst.op = op;
+            inst.imm = shift;
+            inst.args = {arg};
+        };
+        // n for 2^n with n in 1..62, else 0
+        auto log2 = [](int64_t k) {
+            return k > 1 && std::has_single_bit((uint64_t)k) ? std::countr_zero((uint64_t)k) : 0;
+        };
+        double x = std::bit_cast<double>(a), y = std::bit_cast<double>(b);
+        uint64_t ua = a, ub = b;
+        switch (inst.op) {
+            case OP_IADD: if (ka && kb) fold(IR_INT, ua + ub); break;
+            case OP_ISUB: if (ka && kb) fold(IR_INT, ua - ub); break;
+            case OP_IMUL:
+                if (ka && kb) fold(IR_INT, ua * ub);
+                else if ((ka && a == 0) || (kb && b == 0)) fold(IR_INT, 0);
+                else if (kb && log2(b)) reduce(OP_ISHLK, log2(b), inst.args[0]);
+                else if (ka && log2(a)) reduce(OP_ISHLK, log2(a), inst.args[1]);
+                break;
+            case OP_IDIV:
+            case OP_IREM:
+                if (ka && kb && b != 0 && !(a == INT64_MIN && b == -1)) fold(IR_INT, inst.op == OP_IDIV ? a / b : a % b);
+                else if (inst.op == OP_IREM && kb && b == 1) fold(IR_INT, 0);
+                else if (inst.op == OP_IREM && kb && log2(b)) reduce(OP_IREMP2, log2(b), inst.args[0]);
+                break;
+            case OP_FADD: if (ka && kb) fold_float(x + y); break;
+            case OP_FSUB: if (ka && kb) fold_float(x - y); break;
+            case OP_FMUL: if (ka && kb) fold_float(x * y); break;
+            case OP_FDIV: if (ka && kb) fold_float(x / y); break;
+            case OP_FREM: if (ka && kb) fold_float(std::fmod(x, y)); break;
+            case OP_UIMINUS: if (ka) fold(IR_INT, -ua); break;
+            case OP_UFMINUS: if (ka) fold_float(-x); break;
+            case OP_UNOT: if (ka) fold(IR_INT, !a); break;
+            case OP_ITOF: if (ka) fold_float((double)a); break;
+        }
+    }
+}
+
+namespace {
+struct KeyHash {
+    size_t operator()(const std::vector<uint64_t>& key) const {
+        uint64_t h = 0xcbf29ce484222325;
+        for (uint64_t word : key) {
+            h = (h ^ word) * 0x100000001b3;
+        }
+        return h;
+    }
+};
+}
+
+// Merges pure instructions that compute the same thing from the same values.
+// A global's load is valid until the next store to it.
+void Optimizer::number_values(IRBlock& block) {
+    std::vector<IRInst>& insts = block.insts;
+    std::vector<uint32_t> repl(insts.size());
+    std::unordered_map<std::vector<uint64_t>, uint32_t, KeyHash> table;
+    for (uint32_t i = 0; i < insts.size(); i++) {
+        repl[i] = i;
+        IRInst& inst = insts[i];
+        if (!inst.live) {
+            continue;
+        }
+        for (uint32_t& arg : inst.args) {
+            arg = repl[arg];
+        }
+        if (inst.op == OP_STGLOB) {
+            table.erase({OP_LDGLOB, inst.imm});
+        }
+        if (!ir::is_pure(inst.op)) {
+            continue;
+        }
+        std::vector<uint64_t> key = {inst.op, inst.imm};
+        if (inst.op == OP_PCONST) {
+            key[1] = chunk.constants[inst.imm].ival;
+        }
+        key.insert(key.end(), inst.args.begin(), inst.args.end());
+        switch (inst.op) {
+            case OP_IADD: case OP_IMUL: case OP_FADD: case OP_FMUL: case OP_SEQ: case OP_SNE:
+                std::sort(key.begin() + 2, key.end());
+                break;
+        }
+        auto [it, fresh] = table.emplace(std::move(key), i);
+        if (!fresh) {
+            repl[i] = it->second;
+            inst.live = false;
+        }
+    }
+}
+
+// Keeps effects and whatever they use. With -O2, stores to globals missing
+// from `read_globals` are not effects.
+void Optimizer::eliminate_dead(IRBlock& block, const std::vector<uint8_t>& read_globals) {
+    std::vector<IRInst>& insts = block.insts;
+    for (IRInst& inst : insts) {
+        if (ir::is_pure(inst.op)) {
+            inst.live = false;
+        }
+        else if (inst.op == OP_STGLOB && level >= 2 && !read_globals[inst.imm]) {
+            inst.live = false;
+        }
+    }
+    for (size_t i = insts.size(); i-- > 0;) {
+        if (insts[i].live) {
+            for (uint32_t arg : insts[i].args) {
+                insts[arg].live = true;
+            }
+        }
+    }
+}
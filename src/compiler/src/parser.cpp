@@ -1,18 +1,39 @@
 #include "../include/exception.h"
 #include "../include/parser.h"
+#include <memory>
 
 std::vector<ASTNodePtr> Parser::parse() {
-    std::vector<ASTNodePtr> stmts;
-    while (pos < tokens.size()) {
+    std::vector<ASTNodePtr> stmts = parse_imports();
+    while (peek().type != TOK_EOF) {
         stmts.push_back(parse_stmt());
     }
     return stmts;
 }
 
+std::vector<ASTNodePtr> Parser::parse_imports() {
+    std::vector<ASTNodePtr> stmts;
+    while (match(TOK_IMPORT)) {
+        stmts.push_back(parse_is_stmt());
+    }
+    return stmts;
+}
+
 ASTNodePtr Parser::parse_stmt() {
     if (match(TOK_LET)) {
         return parse_vds_stmt();
     }
+    else if (match(TOK_FUN)) {
+        return parse_fds_stmt();
+    }
+    else if (match(TOK_RET)) {
+        return parse_rs_stmt();
+    }
+    else if (match(TOK_LBRACE)) {
+        return parse_bs_stmt();
+    }
+    else if (peek().type == TOK_IMPORT) {
+        error(file_name, "Imports must come before other statements", peek().pos);
+    }
     else {
         error(file_name, "Unsupproted statement", peek().pos);
     }
@@ -21,13 +42,64 @@ ASTNodePtr Parser::parse_stmt() {
 ASTNodePtr Parser::parse_vds_stmt() {
     Location pos = peek(-1).pos;
     Type type = consume_type();
-    std::string name = consume(TOK_ID, "Expected identifier", peek().pos).val;
+    Symbol name = ctx.symbols.intern(consume(TOK_ID, "Expected identifier", peek().pos).val);
     ASTNodePtr expr = nullptr;
     if (match(TOK_EQ)) {
         expr = parse_expr();
     }
     consume_semicolon();
-    return std::make_shared<VDSNode>(type, name, expr, pos);
+    return ctx.make<VDSNode>(type, name, expr, pos);
+}
+
+ASTNodePtr Parser::parse_fds_stmt() {
+    Location pos = peek(-1).pos;
+    Type type = consume_type();
+    Symbol name = ctx.symbols.intern(consume(TOK_ID, "Expected identifier", peek().pos).val);
+    consume(TOK_LPAREN, "Expected \033[0m'('\033[31m", peek().pos);
+    std::vector<Param> params;
+    if (!match(TOK_RPAREN)) {
+        do {
+            Type param_type = consume_type();
+            Symbol param_name = ctx.symbols.intern(consume(TOK_ID, "Expected identifier", peek().pos).val);
+            params.push_back({param_type, param_name});
+        } while (match(TOK_COMMA));
+        consume(TOK_RPAREN, "Expected \033[0m')'\033[31m", peek().pos);
+    }
+    consume(TOK_LBRACE, "Expected \033[0m'{'\033[31m", peek().pos);
+    std::vector<ASTNodePtr> body = parse_block();
+    return ctx.make<FDSNode>(type, name, to_arena(params), params.size(), to_arena(body), body.size(), pos);
+}
+
+ASTNodePtr Parser::parse_rs_stmt() {
+    Location pos = peek(-1).pos;
+    ASTNodePtr expr = parse_expr();
+    consume_semicolon();
+    return ctx.make<RSNode>(expr, pos);
+}
+
+ASTNodePtr Parser::parse_bs_stmt() {
+    Location pos = peek(-1).pos;
+    std::vector<ASTNodePtr> stmts = parse_block();
+    return ctx.make<BSNode>(to_arena(stmts), stmts.size(), pos);
+}
+
+ASTNodePtr Parser::parse_is_stmt() {
+    Location pos = peek(-1).pos;
+    Symbol path = ctx.symbols.intern(consume(TOK_STR_L, "Expected module path", peek().pos).val);
+    consume_semicolon();
+    return ctx.make<ISNode>(path, pos);
+}
+
+// Statements up to and including the closing brace
+std::vector<ASTNodePtr> Parser::parse_block() {
+    std::vector<ASTNodePtr> stmts;
+    while (!match(TOK_RBRACE)) {
+        if (peek().type == TOK_EOF) {
+            error(file_name, "Expected \033[0m'}'\033[31m", peek().pos);
+        }
+        stmts.push_back(parse_stmt());
+    }
+    return stmts;
 }
 
 ASTNodePtr Parser::parse_expr() {
@@ -38,7 +110,7 @@ ASTNodePtr Parser::parse_land_expr() {
     ASTNodePtr expr = parse_lor_expr();
     while (match(TOK_LAND)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_lor_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_lor_expr(), tok.pos);
     }
     return expr;
 }
@@ -47,7 +119,7 @@ ASTNodePtr Parser::parse_lor_expr() {
     ASTNodePtr expr = parse_eq_expr();
     while (match(TOK_LOR)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_eq_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_eq_expr(), tok.pos);
     }
     return expr;
 }
@@ -56,7 +128,7 @@ ASTNodePtr Parser::parse_eq_expr() {
     ASTNodePtr expr = parse_comp_expr();
     while (match(TOK_EQ_EQ) || match(TOK_NOT_EQ)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_comp_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_comp_expr(), tok.pos);
     }
     return expr;
 }
@@ -65,7 +137,7 @@ ASTNodePtr Parser::parse_comp_expr() {
     ASTNodePtr expr = parse_additive_expr();
     while (match(TOK_GT) || match(TOK_GT_EQ) || match(TOK_LS) || match(TOK_LS_EQ)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_additive_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_additive_expr(), tok.pos);
     }
     return expr;
 }
@@ -74,7 +146,7 @@ ASTNodePtr Parser::parse_additive_expr() {
     ASTNodePtr expr = parse_multiplicative_expr();
     while (match(TOK_PLUS) || match(TOK_MINUS)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_multiplicative_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_multiplicative_expr(), tok.pos);
     }
     return expr;
 }
@@ -83,7 +155,7 @@ ASTNodePtr Parser::parse_multiplicative_expr() {
     ASTNodePtr expr = parse_unary_expr();
     while (match(TOK_STAR) || match(TOK_SLASH) || match(TOK_PRECENT)) {
         Token tok = peek(-1);
-        expr = std::make_shared<BENode>(tok.type, expr, parse_unary_expr(), tok.pos);
+        expr = ctx.make<BENode>(tok.type, expr, parse_unary_expr(), tok.pos);
     }
     return expr;
 }
@@ -91,53 +163,95 @@ ASTNodePtr Parser::parse_multiplicative_expr() {
 ASTNodePtr Parser::parse_unary_expr() {
     while (match(TOK_NOT) || match(TOK_MINUS) || match(TOK_PRECENT)) {
         Token tok = peek(-1);
-        return std::make_shared<UENode>(tok.type, parse_primary_expr(), tok.pos);
+        return ctx.make<UENode>(tok.type, parse_unary_expr(), tok.pos);
     }
     return parse_primary_expr();
 }
 
 ASTNodePtr Parser::parse_primary_expr() {
     Token tok = peek();
-    pos++;
+    advance();
     switch (tok.type) {
         case TOK_LPAREN: {
             ASTNodePtr expr = parse_expr();
             consume(TOK_RPAREN, "Expected \033[0m')'\033[31m", tok.pos);
             return expr;
         }
-        #define LIT(val) std::make_shared<LENode>(val, tok.pos)
+        #define LIT(val) ctx.make<LENode>(val, tok.pos)
         case TOK_BOOL_L:
             return LIT(tok.val == "true");
         case TOK_CHAR_L:
             return LIT((char8_t)tok.val[0]);
         case TOK_SHORT_L:
-            return LIT((int16_t)std::stoll(tok.val));
+            return LIT((int16_t)tok.ival);
         case TOK_INT_L:
-            return LIT((int32_t)std::stoll(tok.val));
+            return LIT((int32_t)tok.ival);
         case TOK_LONG_L:
-            return LIT((int64_t)std::stoll(tok.val));
+            return LIT((int64_t)tok.ival);
         case TOK_FLOAT_L:
-            return LIT((float_t)std::stold(tok.val));
+            return LIT((float_t)tok.fval);
         case TOK_DOUBLE_L:
-            return LIT((double_t)std::stold(tok.val));
+            return LIT((double_t)tok.fval);
+        case TOK_STR_L:
+            return LIT(Value::string(ctx.symbols.intern(tok.val)));
         #undef LIT
         case TOK_ID:
-            return std::make_shared<VENode>(tok.val, tok.pos);
+            if (match(TOK_LPAREN)) {
+                return parse_call_expr(tok);
+            }
+            return ctx.make<VENode>(ctx.symbols.intern(tok.val), tok.pos);
         default:
             error(file_name, "Unsupported expression", tok.pos);
     }
 }
 
-const Token Parser::peek(uint32_t rpos) const {
-    if (pos + rpos < tokens.size() && pos + rpos >= 0) {
-        return tokens[pos + rpos];
+ASTNodePtr Parser::parse_call_expr(const Token& name) {
+    std::vector<ASTNodePtr> args;
+    if (!match(TOK_RPAREN)) {
+        do {
+            args.push_back(parse_expr());
+        } while (match(TOK_COMMA));
+        consume(TOK_RPAREN, "Expected \033[0m')'\033[31m", name.pos);
+    }
+    return ctx.make<CENode>(ctx.symbols.intern(name.val), to_arena(args), args.size(), name.pos);
+}
+
+template<typename T>
+T *Parser::to_arena(const std::vector<T>& items) {
+    T *out = ctx.arena.make_array<T>(items.size());
+    std::uninitialized_copy(items.begin(), items.end(), out);
+    return out;
+}
+
+const Token& Parser::peek(int32_t rpos) {
+    if (rpos < 0) {
+        return previous;
+    }
+    while (lookahead.size() <= (size_t)rpos) {
+        lookahead.push_back(pull());
+    }
+    return lookahead[rpos];
+}
+
+void Parser::advance() {
+    peek();
+    previous = lookahead.front();
+    lookahead.pop_front();
+}
+
+Token Parser::pull() {
+    if (lex != nullptr) {
+        return lex->next();
+    }
+    if (pos < tokens.size()) {
+        return tokens[pos++];
     }
-    error(file_name, "Index out of range", {0, 0});
+    return Token(TOK_EOF, tokens.empty() ? Location(0, 0) : tokens.back().pos);
 }
 
 bool Parser::match(TokenType type) {
     if (peek().type == type) {
-        pos++;
+        advance();
         return true;
     }
     return false;
@@ -146,7 +260,7 @@ bool Parser::match(TokenType type) {
 Token Parser::consume(TokenType type, std::string_view err, Location pos) {
     Token tok = peek();
     if (tok.type == type) {
-        this->pos++;
+        advance();
         return tok;
     }
     error(file_name, err, pos);
@@ -161,12 +275,12 @@ Type Parser::consume_type() {
     bool is_const = false;
     if (tok.type == TOK_CONST) {
         is_const = true;
-        pos++;
+        advance();
         tok = peek();
     }
-    pos++;
+    advance();
     switch (tok.type) {
-        #define TYPE(type) Type(type, tok.val, is_const)
+        #define TYPE(type) Type(type, is_const)
         case TOK_BOOL:
             return TYPE(TYPE_BOOL);
         case TOK_CHAR:
@@ -181,8 +295,10 @@ Type Parser::consume_type() {
             return TYPE(TYPE_FLOAT);
         case TOK_DOUBLE:
             return TYPE(TYPE_DOUBLE);
+        case TOK_STR:
+            return TYPE(TYPE_STR);
         case TOK_ID:
-            return TYPE(TYPE_CLASS);
+            return Type(TYPE_CLASS, is_const, ctx.symbols.intern(tok.val));
         #undef TYPE
         default:
             error(file_name, "Expected type", tok.pos);
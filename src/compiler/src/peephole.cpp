@@ -0,0 +1,73 @@
+#include "../../vm/include/opcodes.h"
+#include "../include/peephole.h"
+
+void Peephole::run(size_t start, size_t first_func) {
+    if (chunk.kind != CHUNK_STACK) {
+        return;
+    }
+    std::vector<uint8_t> out;
+    out.reserve(chunk.code.size() - start);
+    const uint8_t *code = chunk.code.data();
+    size_t size = chunk.code.size();
+    auto fn = chunk.functions.begin() + first_func;
+    for (size_t pos = start; pos < size;) {
+        // Entries are in code order and never inside a pattern, which ends
+        // at the latest on the RET or HALT before the next function
+        for (; fn != chunk.functions.end() && fn->entry == pos; fn++) {
+            fn->entry = start + out.size();
+        }
+        pos += match(code, pos, size, out);
+    }
+    if (start == 0) {
+        chunk.code = std::move(out);
+        return;
+    }
+    chunk.code.resize(start);
+    chunk.code.insert(chunk.code.end(), out.begin(), out.end());
+}
+
+// Emits the replacement for the longest pattern starting at `pos` (or the
+// instruction itself) and returns how many input bytes it consumed.
+size_t Peephole::match(const uint8_t *code, size_t pos, size_t size, std::vector<uint8_t>& out) const {
+    const uint8_t *end = code + size;
+    const uint8_t *i0 = code + pos;
+    const uint8_t *i1 = i0 + op_size(i0[0]);
+    if (i0[0] == OP_HALT || i0[0] == OP_RET || i1 >= end) {
+        out.insert(out.end(), i0, i1);
+        return i1 - i0;
+    }
+    const uint8_t *i2 = i1[0] == OP_HALT || i1[0] == OP_RET || i1 + op_size(i1[0]) >= end ? i1 : i1 + op_size(i1[0]);
+
+    auto emit = [&](uint8_t op, std::initializer_list<const uint8_t*> operands) {
+        out.push_back(op);
+        for (auto operand : operands) {
+            out.insert(out.end(), operand, operand + 3);
+        }
+    };
+
+    if (i0[0] == OP_LDGLOB && i1[0] == OP_LDGLOB && i2[0] == OP_IADD) {
+        emit(OP_IADD_GG, {i0 + 1, i1 + 1});
+        return i2 + 1 - i0;
+    }
+    if (i0[0] == OP_PCONST && i1[0] == OP_STGLOB) {
+        emit(OP_STGLOBK, {i0 + 1, i1 + 1});
+        return i1 + 4 - i0;
+    }
+    if (i0[0] == OP_PCONST) {
+        uint8_t fused = OP_HALT;
+        switch (i1[0]) {
+            case OP_IADD: fused = OP_IADDK; break;
+            case OP_ISUB: fused = OP_ISUBK; break;
+            case OP_IMUL: fused = OP_IMULK; break;
+            case OP_FADD: fused = OP_FADDK; break;
+            case OP_FSUB: fused = OP_FSUBK; break;
+            case OP_FMUL: fused = OP_FMULK; break;
+        }
+        if (fused != OP_HALT) {
+            emit(fused, {i0 + 1});
+            return i1 + 1 - i0;
+        }
+    }
+    out.insert(out.end(), i0, i1);
+    return i1 - i0;
+}
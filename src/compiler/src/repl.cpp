@@ -0,0 +1,174 @@
+#include "../include/exception.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/peephole.h"
+#include "../include/repl.h"
+#include <iostream>
+
+static constexpr std::string_view FILE_NAME = "<repl>";
+
+// String pool offsets are 24 bits wide (see CodeGen::push_str), so this
+// capacity is never outgrown
+static Chunk *new_chunk() {
+    Chunk *chunk = new Chunk();
+    chunk->strings.reserve(1u << 24);
+    return chunk;
+}
+
+Repl::Repl(const HeapConfig& heap) : chunk(new_chunk()), sema(FILE_NAME, no_stmts, ctx), codegen(FILE_NAME, no_stmts, ctx, sema), vm(chunk, VM::DEFAULT_STACK_SIZE, VM::DEFAULT_FRAME_COUNT, heap) {}
+
+bool Repl::eval(std::string_view src, std::ostream& out) {
+    CodeGen::Mark mark = codegen.mark(*chunk);
+    std::vector<ASTNodePtr> stmts;
+    bool analyzed = false;
+    error_throws = true;
+    try {
+        // Tokens point into `src`, but everything the tree keeps is interned
+        Lexer lex(src, FILE_NAME);
+        Parser parser(FILE_NAME, lex, ctx);
+        stmts = parser.parse();
+        for (ASTNodePtr stmt : stmts) {
+            if (stmt->as<ISNode>()) {
+                error(FILE_NAME, "Imports are not supported in the REPL", stmt->pos);
+            }
+        }
+        analyzed = true;
+        stmts = sema.analyze(std::move(stmts));
+        vm.entry = codegen.extend(*chunk, stmts, mark);
+    }
+    catch (const CompileError& e) {
+        error_throws = false;
+        std::cerr << e.message;
+        if (analyzed) {
+            sema.forget();
+        }
+        codegen.revert(*chunk, mark);
+        return false;
+    }
+    error_throws = false;
+    Peephole(*chunk).run(vm.entry, mark.functions);
+    for (size_t i = mark.functions; i < chunk->functions.size(); i++) {
+        map_safepoints(*chunk, i);
+    }
+    map_safepoints(*chunk, UINT32_MAX, vm.entry);
+    vm.strings.add_pool(chunk->strings.data() + mark.strings, chunk->strings.size() - mark.strings);
+
+    vm.execute();
+    for (ASTNodePtr stmt : stmts) {
+        if (auto vds = stmt->as<VDSNode>()) {
+            print_global(vds->name, out);
+        }
+    }
+    return true;
+}
+
+// Sema converts every initializer to the declared type
+void Repl::print_global(Symbol name, std::ostream& out) {
+    uint32_t index;
+    Type type(TYPE_NOTH, false);
+    if (!sema.find_global(name, index, type)) {
+        return;
+    }
+    StackSlot val = vm.global_vars[index];
+    out << ctx.symbols.name(name) << ": " << type.to_str(ctx.symbols) << " = ";
+    switch (type.type) {
+        case TYPE_BOOL:
+            out << (val.ival ? "true" : "false");
+            break;
+        case TYPE_FLOAT:
+        case TYPE_DOUBLE:
+            out << val.fval;
+            break;
+        case TYPE_STR:
+            out << '"';
+            vm.strings.write(out, val.objval);
+            out << '"';
+            break;
+        default:
+            out << val.ival;
+            break;
+    }
+    out << '\n';
+}
+
+// Scans `text` from `pos` on, past string and character literals and
+// comments. Returns true once the braces balance and the last token is a
+// ';' or a '}'.
+static bool complete(std::string_view text, size_t& pos, int& depth, char& last, bool& in_comment) {
+    while (pos < text.size()) {
+        char c = text[pos++];
+        if (in_comment) {
+            if (c == '*' && pos < text.size() && text[pos] == '/') {
+                in_comment = false;
+                pos++;
+            }
+            continue;
+        }
+        if (c == '/' && pos < text.size() && text[pos] == '/') {
+            pos = text.find('\n', pos);
+            pos = pos == std::string_view::npos ? text.size() : pos;
+            continue;
+        }
+        if (c == '/' && pos < text.size() && text[pos] == '*') {
+            in_comment = true;
+            pos++;
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            size_t end = text.find(c, pos);
+            if (end == std::string_view::npos) {
+                // An unterminated literal is the lexer's error to report
+                last = ';';
+                pos = text.size();
+                break;
+            }
+            pos = end + 1;
+        }
+        else if (c == '{') {
+            depth++;
+        }
+        else if (c == '}') {
+            depth--;
+        }
+        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+            last = c;
+        }
+    }
+    return !in_comment && depth <= 0 && (last == ';' || last == '}');
+}
+
+void Repl::run(std::istream& in, std::ostream& out, bool prompt) {
+    std::string entry, line;
+    size_t pos = 0;
+    int depth = 0;
+    char last = ';';
+    bool in_comment = false;
+    for (;;) {
+        if (prompt) {
+            out << (entry.empty() ? "> " : ". ") << std::flush;
+        }
+        if (!std::getline(in, line)) {
+            break;
+        }
+        entry += line;
+        entry += '\n';
+        if (entry.find_first_not_of(" \t\r\n") == std::string::npos) {
+            entry.clear();
+            pos = 0;
+            continue;
+        }
+        if (complete(entry, pos, depth, last, in_comment)) {
+            eval(entry, out);
+            entry.clear();
+            pos = 0;
+            depth = 0;
+            last = ';';
+        }
+    }
+    if (entry.find_first_not_of(" \t\r\n") != std::string::npos) {
+        eval(entry, out);
+    }
+    if (prompt) {
+        out << '\n';
+    }
+}
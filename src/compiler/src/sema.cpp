@@ -0,0 +1,561 @@
+#include "../include/sema.h"
+#include "../include/exception.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+
+static bool is_numeric(TypeValue type) {
+    return type >= TYPE_CHAR && type <= TYPE_DOUBLE;
+}
+
+static bool is_int(TypeValue type) {
+    return type >= TYPE_CHAR && type <= TYPE_LONG;
+}
+
+// Type promotion lattice: the type two operands meet at, TYPE_NOTH where
+// they do not mix. Bool only combines with bool, every other numeric type
+// widens to the larger of the two. A value converts implicitly to `to`
+// exactly when PROMOTE[from][to] == to.
+static constexpr auto PROMOTE = [] {
+    std::array<std::array<TypeValue, TYPE_CLASS + 1>, TYPE_CLASS + 1> table;
+    for (int a = 0; a <= TYPE_CLASS; a++) {
+        for (int b = 0; b <= TYPE_CLASS; b++) {
+            TypeValue A = (TypeValue)a, B = (TypeValue)b;
+            if (A == B && A != TYPE_NOTH) {
+                table[a][b] = A;
+            }
+            else if (A >= TYPE_CHAR && A <= TYPE_DOUBLE && B >= TYPE_CHAR && B <= TYPE_DOUBLE) {
+                table[a][b] = std::max(A, B);
+            }
+            else {
+                table[a][b] = TYPE_NOTH;
+            }
+        }
+    }
+    return table;
+}();
+
+static TypeValue common_type(const Type& LHS, const Type& RHS) {
+    if (LHS.type == TYPE_CLASS && LHS.name != RHS.name) {
+        return TYPE_NOTH;
+    }
+    return PROMOTE[LHS.type][RHS.type];
+}
+
+static int64_t int_val(const Value& val) {
+    switch (val.type.type) {
+        case TYPE_BOOL:   return val.b;
+        case TYPE_CHAR:   return val.c;
+        case TYPE_SHORT:  return val.s;
+        case TYPE_INT:    return val.i;
+        case TYPE_LONG:   return val.l;
+        case TYPE_FLOAT:  return (int64_t)val.f;
+        case TYPE_DOUBLE: return (int64_t)val.d;
+        default:          return 0;
+    }
+}
+
+static double float_val(const Value& val) {
+    switch (val.type.type) {
+        case TYPE_FLOAT:  return val.f;
+        case TYPE_DOUBLE: return val.d;
+        default:          return (double)int_val(val);
+    }
+}
+
+// For integer literals that fit their new type (see fits())
+static Value make_int(TypeValue type, int64_t val) {
+    switch (type) {
+        case TYPE_CHAR:  return Value((char8_t)val);
+        case TYPE_SHORT: return Value((int16_t)val);
+        case TYPE_INT:   return Value((int32_t)val);
+        default:         return Value((int64_t)val);
+    }
+}
+
+// A computed literal of type `type`. The VM, the JIT and the C emitter
+// compute every integer in 64 bits and every float as a double, so the
+// value keeps that width whatever the type says; folding an expression
+// never changes its result.
+static LENode *computed(ASTContext& ctx, TypeValue type, int64_t val, Location pos) {
+    LENode *le = ctx.make<LENode>(Value(val), pos);
+    le->value_type = Type(type, false);
+    return le;
+}
+
+static LENode *computed(ASTContext& ctx, TypeValue type, double val, Location pos) {
+    LENode *le = ctx.make<LENode>(Value((double_t)val), pos);
+    le->value_type = Type(type, false);
+    return le;
+}
+
+static bool is_lit(const ASTNodePtr& expr, double val) {
+    auto le = expr->as<LENode>();
+    return le != nullptr && is_numeric(le->val.type.type) && float_val(le->val) == val;
+}
+
+// An integer literal also converts to a narrower integer type that holds it
+static bool fits(int64_t val, TypeValue type) {
+    switch (type) {
+        case TYPE_CHAR:  return val >= 0 && val <= UINT8_MAX;
+        case TYPE_SHORT: return val >= INT16_MIN && val <= INT16_MAX;
+        case TYPE_INT:   return val >= INT32_MIN && val <= INT32_MAX;
+        case TYPE_LONG:  return true;
+        default:         return false;
+    }
+}
+
+std::vector<ASTNodePtr> Sema::analyze() {
+    old_globals = global_vars.size();
+    old_funcs = funcs.size();
+    for (auto& stmt : stmts) {
+        analyze_stmt(*stmt);
+    }
+    return stmts;
+}
+
+std::vector<ASTNodePtr> Sema::analyze(std::vector<ASTNodePtr> more) {
+    stmts = std::move(more);
+    return analyze();
+}
+
+void Sema::forget() {
+    unbind_locals(0);
+    for (size_t i = old_globals; i < global_vars.size(); i++) {
+        var_scope[global_vars[i].name] = UNBOUND;
+    }
+    for (size_t i = old_funcs; i < funcs.size(); i++) {
+        func_scope[funcs[i]->name] = UNBOUND;
+    }
+    global_vars.erase(global_vars.begin() + old_globals, global_vars.end());
+    funcs.resize(old_funcs);
+    scope_depth = 0;
+    cur_func = nullptr;
+}
+
+bool Sema::import_global(Symbol name, Type type) {
+    uint32_t& bound = binding(var_scope, name);
+    if (bound != UNBOUND) {
+        return false;
+    }
+    bound = global_vars.size();
+    global_vars.push_back({name, type, nullptr});
+    return true;
+}
+
+bool Sema::import_function(const FDSNode *decl) {
+    uint32_t& bound = binding(func_scope, decl->name);
+    if (bound != UNBOUND) {
+        return false;
+    }
+    bound = funcs.size();
+    funcs.push_back(decl);
+    imported_funcs++;
+    return true;
+}
+
+bool Sema::import_native(const FDSNode *decl, uint32_t index) {
+    uint32_t& bound = binding(func_scope, decl->name);
+    if (bound != UNBOUND) {
+        return false;
+    }
+    bound = NATIVE | natives.size();
+    natives.push_back({decl, index});
+    return true;
+}
+
+bool Sema::find_global(Symbol name, uint32_t& index, Type& type) const {
+    if (name >= var_scope.size() || var_scope[name] == UNBOUND || (var_scope[name] & LOCAL)) {
+        return false;
+    }
+    index = var_scope[name];
+    type = global_vars[index].type;
+    return true;
+}
+
+// Symbols interned after the table was last sized are unbound
+uint32_t& Sema::binding(std::vector<uint32_t>& scope, Symbol name) {
+    if (name >= scope.size()) {
+        scope.resize(std::max<size_t>(ctx.symbols.size(), name + 1), UNBOUND);
+    }
+    return scope[name];
+}
+
+void Sema::analyze_stmt(ASTNode& stmt) {
+    if (auto vds = stmt.as<VDSNode>()) {
+        analyze_vds_stmt(*vds);
+    }
+    else if (auto fds = stmt.as<FDSNode>()) {
+        analyze_fds_stmt(*fds);
+    }
+    else if (auto bs = stmt.as<BSNode>()) {
+        analyze_block(bs->stmts, bs->stmt_count);
+    }
+    else if (auto rs = stmt.as<RSNode>()) {
+        analyze_rs_stmt(*rs);
+    }
+    else if (stmt.as<ISNode>()) {
+        // Resolved by ModuleBuilder before analysis
+    }
+    else {
+        error(file_name, "Unsupported statement", stmt.pos);
+    }
+}
+
+// Inside a block the variable takes the next frame slot
+void Sema::analyze_vds_stmt(VDSNode& vds) {
+    LENode *value = nullptr;
+    if (vds.expr != nullptr) {
+        ASTNodePtr expr = convert(analyze_expr(vds.expr), vds.type);
+        if (expr == nullptr) {
+            error(file_name, "Value does not match the variable type", vds.expr->pos);
+        }
+        vds.expr = expr;
+        if (vds.type.is_const) {
+            value = expr->as<LENode>();
+        }
+    }
+    if (scope_depth > 0) {
+        if (locals.size() > UINT8_MAX) {
+            error(file_name, "Too many local variables", vds.pos);
+        }
+        vds.kind = VAR_LOCAL;
+        vds.index = locals.size();
+        bind_local(vds.name, vds.type, value);
+        return;
+    }
+    uint32_t& bound = binding(var_scope, vds.name);
+    if (bound != UNBOUND) {
+        error(file_name, "Variable is already defined", vds.pos);
+    }
+    vds.kind = VAR_GLOBAL;
+    vds.index = bound = global_vars.size();
+    global_vars.push_back({vds.name, vds.type, value});
+}
+
+// Parameters take the first slots and shadow globals, so none of them is
+// replaced by a constant
+void Sema::analyze_fds_stmt(FDSNode& fds) {
+    if (cur_func != nullptr || scope_depth > 0) {
+        error(file_name, "Functions must be defined at the top level", fds.pos);
+    }
+    if (fds.param_count > UINT8_MAX) {
+        error(file_name, "Too many parameters", fds.pos);
+    }
+    if (fds.body_count == 0 || !fds.body[fds.body_count - 1]->as<RSNode>()) {
+        error(file_name, "Function must end with a return statement", fds.pos);
+    }
+    uint32_t& bound = binding(func_scope, fds.name);
+    if (bound != UNBOUND) {
+        error(file_name, "Function is already defined", fds.pos);
+    }
+    bound = funcs.size();
+    funcs.push_back(&fds);
+
+    cur_func = &fds;
+    for (uint32_t i = 0; i < fds.param_count; i++) {
+        bind_local(fds.params[i].name, fds.params[i].type, nullptr);
+    }
+    analyze_block(fds.body, fds.body_count);
+    unbind_locals(0);
+    cur_func = nullptr;
+}
+
+// A call to a function of the same type in return position reuses the
+// caller's frame. A native has no frame to reuse.
+void Sema::analyze_rs_stmt(RSNode& rs) {
+    if (cur_func == nullptr) {
+        error(file_name, "Return statement outside of a function", rs.pos);
+    }
+    rs.expr = analyze_expr(rs.expr);
+    auto ce = rs.expr->as<CENode>();
+    rs.tail = ce != nullptr && ce->kind == FUNC_SCRIPT && funcs[ce->index]->type == cur_func->type;
+    ASTNodePtr expr = convert(rs.expr, cur_func->type);
+    if (expr == nullptr) {
+        error(file_name, "Return value does not match the function type", rs.pos);
+    }
+    rs.expr = expr;
+}
+
+void Sema::analyze_block(ASTNodePtr *stmts, uint32_t count) {
+    size_t mark = locals.size();
+    scope_depth++;
+    for (uint32_t i = 0; i < count; i++) {
+        analyze_stmt(*stmts[i]);
+    }
+    scope_depth--;
+    unbind_locals(mark);
+}
+
+void Sema::bind_local(Symbol name, Type type, LENode *value) {
+    uint32_t& bound = binding(var_scope, name);
+    locals.push_back({name, type, value, bound});
+    bound = LOCAL | (locals.size() - 1);
+}
+
+void Sema::unbind_locals(size_t mark) {
+    while (locals.size() > mark) {
+        var_scope[locals.back().name] = locals.back().shadowed;
+        locals.pop_back();
+    }
+}
+
+ASTNodePtr Sema::analyze_expr(ASTNodePtr expr) {
+    switch (expr->type) {
+        case NODE_BE: return analyze_be_expr(*expr->as<BENode>());
+        case NODE_UE: return analyze_ue_expr(*expr->as<UENode>());
+        case NODE_LE: return expr;
+        case NODE_VE: return analyze_ve_expr(*expr->as<VENode>());
+        case NODE_CE: return analyze_ce_expr(*expr->as<CENode>());
+        default:
+            error(file_name, "Unsupported expression", expr->pos);
+    }
+}
+
+// Both operands are converted to their common type
+ASTNodePtr Sema::analyze_be_expr(BENode& be) {
+    be.LHS = analyze_expr(be.LHS);
+    be.RHS = analyze_expr(be.RHS);
+    const Type& LHS = expr_type(*be.LHS);
+    TypeValue common = common_type(LHS, expr_type(*be.RHS));
+    if (common == TYPE_NOTH) {
+        error(file_name, "Does not have common type", be.pos);
+    }
+    bool comparison = be.op == TOK_EQ_EQ || be.op == TOK_NOT_EQ;
+    if (common == TYPE_STR) {
+        if (be.op != TOK_PLUS && !comparison) {
+            error(file_name, "Unsupported binary operator for strings", be.pos);
+        }
+    }
+    else if (common > TYPE_DOUBLE || comparison) {
+        error(file_name, "Unsupported binary operator", be.pos);
+    }
+    else {
+        switch (be.op) {
+            case TOK_PLUS: case TOK_MINUS: case TOK_STAR: case TOK_SLASH: case TOK_PRECENT:
+                break;
+            default:
+                error(file_name, "Unsupported binary operator", be.pos);
+        }
+    }
+    Type type(common, false, LHS.name);
+    be.LHS = convert(be.LHS, type);
+    be.RHS = convert(be.RHS, type);
+    be.value_type = comparison ? Type(TYPE_BOOL, false) : type;
+    return fold_be_expr(be);
+}
+
+ASTNodePtr Sema::analyze_ue_expr(UENode& ue) {
+    ue.expr = analyze_expr(ue.expr);
+    TypeValue type = expr_type(*ue.expr).type;
+    switch (ue.op) {
+        case TOK_MINUS:
+            if (!is_numeric(type)) {
+                error(file_name, "Unary minus does not supported this type", ue.pos);
+            }
+            break;
+        case TOK_NOT:
+            if (type != TYPE_BOOL) {
+                error(file_name, "Unary logical not does not supported this type", ue.pos);
+            }
+            break;
+        default:
+            error(file_name, "Unsupported unary operator", ue.pos);
+    }
+    ue.value_type = Type(type, false);
+    return fold_ue_expr(ue);
+}
+
+ASTNodePtr Sema::analyze_ve_expr(VENode& ve) {
+    uint32_t bound = ve.name < var_scope.size() ? var_scope[ve.name] : UNBOUND;
+    if (bound == UNBOUND) {
+        error(file_name, "Undefined variable", ve.pos);
+    }
+    if (bound & LOCAL) {
+        const LocalVar& local = locals[bound & ~LOCAL];
+        if (local.value != nullptr) {
+            return local.value;
+        }
+        ve.kind = VAR_LOCAL;
+        ve.index = bound & ~LOCAL;
+        ve.value_type = local.type;
+        return &ve;
+    }
+    const GlobalVar& global = global_vars[bound];
+    if (global.value != nullptr) {
+        return global.value;
+    }
+    ve.kind = VAR_GLOBAL;
+    ve.index = bound;
+    ve.value_type = global.type;
+    return &ve;
+}
+
+// Arguments are converted to the parameter types
+ASTNodePtr Sema::analyze_ce_expr(CENode& ce) {
+    uint32_t bound = ce.name < func_scope.size() ? func_scope[ce.name] : UNBOUND;
+    if (bound == UNBOUND) {
+        error(file_name, "Undefined function", ce.pos);
+    }
+    const FDSNode *decl;
+    if (bound & NATIVE) {
+        decl = natives[bound & ~NATIVE].decl;
+        ce.kind = FUNC_NATIVE;
+        ce.index = natives[bound & ~NATIVE].index;
+    }
+    else {
+        decl = funcs[bound];
+        ce.kind = FUNC_SCRIPT;
+        ce.index = bound;
+    }
+    if (ce.arg_count != decl->param_count) {
+        error(file_name, "Wrong number of arguments", ce.pos);
+    }
+    for (uint32_t i = 0; i < ce.arg_count; i++) {
+        ASTNodePtr arg = convert(analyze_expr(ce.args[i]), decl->params[i].type);
+        if (arg == nullptr) {
+            error(file_name, "Argument does not match the parameter type", ce.args[i]->pos);
+        }
+        ce.args[i] = arg;
+    }
+    ce.value_type = decl->type;
+    return &ce;
+}
+
+ASTNodePtr Sema::fold_be_expr(BENode& be) {
+    TypeValue common = expr_type(*be.LHS).type;
+    auto lhs_le = be.LHS->as<LENode>();
+    auto rhs_le = be.RHS->as<LENode>();
+    if (lhs_le && rhs_le && common == TYPE_STR) {
+        std::string_view a = ctx.symbols.name(lhs_le->val.str);
+        std::string_view b = ctx.symbols.name(rhs_le->val.str);
+        switch (be.op) {
+            case TOK_PLUS:
+                return ctx.make<LENode>(Value::string(ctx.symbols.intern(std::string(a) + std::string(b))), be.pos);
+            case TOK_EQ_EQ:
+                return ctx.make<LENode>(Value(a == b), be.pos);
+            case TOK_NOT_EQ:
+                return ctx.make<LENode>(Value(a != b), be.pos);
+            default:
+                return &be;
+        }
+    }
+    if (lhs_le && rhs_le && is_numeric(common)) {
+        if (is_int(common)) {
+            int64_t a = int_val(lhs_le->val);
+            int64_t b = int_val(rhs_le->val);
+            int64_t res;
+            switch (be.op) {
+                case TOK_PLUS:  res = (int64_t)((uint64_t)a + (uint64_t)b); break;
+                case TOK_MINUS: res = (int64_t)((uint64_t)a - (uint64_t)b); break;
+                case TOK_STAR:  res = (int64_t)((uint64_t)a * (uint64_t)b); break;
+                case TOK_SLASH:
+                case TOK_PRECENT:
+                    // Leave traps to the runtime
+                    if (b == 0 || (a == INT64_MIN && b == -1)) {
+                        return &be;
+                    }
+                    res = be.op == TOK_SLASH ? a / b : a % b;
+                    break;
+                default:
+                    return &be;
+            }
+            return computed(ctx, common, res, be.pos);
+        }
+        double a = float_val(lhs_le->val);
+        double b = float_val(rhs_le->val);
+        double res;
+        switch (be.op) {
+            case TOK_PLUS:    res = a + b; break;
+            case TOK_MINUS:   res = a - b; break;
+            case TOK_STAR:    res = a * b; break;
+            case TOK_SLASH:   res = a / b; break;
+            case TOK_PRECENT: res = std::fmod(a, b); break;
+            default:
+                return &be;
+        }
+        return computed(ctx, common, res, be.pos);
+    }
+
+    // Identities. Both operands already have the type of the result.
+    // `x + 0.0` is kept because it turns -0.0 into +0.0.
+    if (!is_numeric(common)) {
+        return &be;
+    }
+    switch (be.op) {
+        case TOK_PLUS:
+            if (is_int(common) && is_lit(be.LHS, 0)) {
+                return be.RHS;
+            }
+            if (is_int(common) && is_lit(be.RHS, 0)) {
+                return be.LHS;
+            }
+            break;
+        case TOK_MINUS:
+            if (is_lit(be.RHS, 0)) {
+                return be.LHS;
+            }
+            break;
+        case TOK_STAR:
+            if (is_lit(be.LHS, 1)) {
+                return be.RHS;
+            }
+            if (is_lit(be.RHS, 1)) {
+                return be.LHS;
+            }
+            break;
+        case TOK_SLASH:
+            if (is_lit(be.RHS, 1)) {
+                return be.LHS;
+            }
+            break;
+        default:
+            break;
+    }
+    return &be;
+}
+
+ASTNodePtr Sema::fold_ue_expr(UENode& ue) {
+    TypeValue type = ue.value_type.type;
+    if (auto le = ue.expr->as<LENode>()) {
+        if (ue.op == TOK_MINUS && is_int(type)) {
+            return computed(ctx, type, (int64_t)(0 - (uint64_t)int_val(le->val)), ue.pos);
+        }
+        if (ue.op == TOK_MINUS) {
+            return computed(ctx, type, -float_val(le->val), ue.pos);
+        }
+        return ctx.make<LENode>(Value(!int_val(le->val)), ue.pos);
+    }
+    // --x and !!x
+    auto inner = ue.expr->as<UENode>();
+    if (inner != nullptr && inner->op == ue.op) {
+        return inner->expr;
+    }
+    return &ue;
+}
+
+// Literals are converted here rather than at run time
+ASTNodePtr Sema::convert(ASTNodePtr expr, Type to) {
+    const Type& from = expr_type(*expr);
+    if (from.type == to.type && (to.type != TYPE_CLASS || from.name == to.name)) {
+        return expr;
+    }
+    auto le = expr->as<LENode>();
+    if (le != nullptr && is_int(from.type) && fits(int_val(le->val), to.type)) {
+        return ctx.make<LENode>(make_int(to.type, int_val(le->val)), le->pos);
+    }
+    if (le != nullptr && from.type == TYPE_DOUBLE && to.type == TYPE_FLOAT) {
+        return ctx.make<LENode>(Value((float_t)le->val.d), le->pos);
+    }
+    if (PROMOTE[from.type][to.type] != to.type) {
+        return nullptr;
+    }
+    if (le != nullptr) {
+        if (is_int(to.type)) {
+            return computed(ctx, to.type, int_val(le->val), le->pos);
+        }
+        return computed(ctx, to.type, float_val(le->val), le->pos);
+    }
+    return ctx.make<CVENode>(expr, Type(to.type, false, to.name), expr->pos);
+}
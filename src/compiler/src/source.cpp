@@ -0,0 +1,37 @@
+#include "../include/source.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceBuffer::~SourceBuffer() {
+    if (mapping != nullptr) {
+        munmap(mapping, size);
+    }
+}
+
+bool SourceBuffer::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        // mmap rejects empty files
+        close(fd);
+        return true;
+    }
+    void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) {
+        return false;
+    }
+    madvise(m, st.st_size, MADV_SEQUENTIAL);
+    mapping = m;
+    size = st.st_size;
+    return true;
+}
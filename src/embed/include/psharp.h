@@ -0,0 +1,192 @@
+#pragma once
+#include "../../compiler/include/module.h"
+#include "../../vm/include/vm.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Embedding API: compile a script once, then run it as often as needed in
+// the host process.
+//
+//     static double price(int64_t id) { ... }
+//
+//     psharp::Engine engine;
+//     engine.bind<&price>("price");
+//     auto script = engine.compile("let f64 total = price(7) * 2.0;");
+//     psharp::Global<double> total;
+//     script->global("total", total);
+//     psharp::Instance instance(script);
+//     instance.run();
+//     double value = instance.get(total);
+//
+// A Script never changes once compiled, so any number of Instances can run
+// it on any threads at the same time. An Instance is one VM and belongs to
+// one thread at a time.
+namespace psharp {
+
+// The P# type of a C++ parameter, result or global
+template<typename T>
+constexpr TypeValue type_of() {
+    if constexpr (std::is_same_v<T, bool>) return TYPE_BOOL;
+    else if constexpr (std::is_same_v<T, char>) return TYPE_CHAR;
+    else if constexpr (std::is_same_v<T, int16_t>) return TYPE_SHORT;
+    else if constexpr (std::is_same_v<T, int32_t>) return TYPE_INT;
+    else if constexpr (std::is_same_v<T, int64_t>) return TYPE_LONG;
+    else if constexpr (std::is_same_v<T, float>) return TYPE_FLOAT;
+    else if constexpr (std::is_same_v<T, double>) return TYPE_DOUBLE;
+    else if constexpr (std::is_same_v<T, std::string>) return TYPE_STR;
+    else static_assert(sizeof(T) == 0, "no P# type for this C++ type");
+}
+
+// Integers and bools live in StackSlot::ival, f32 and f64 in fval
+template<typename T>
+T from_slot(StackSlot slot) {
+    if constexpr (std::is_floating_point_v<T>) return static_cast<T>(slot.fval);
+    else return static_cast<T>(slot.ival);
+}
+
+template<typename T>
+StackSlot to_slot(T value) {
+    StackSlot slot;
+    if constexpr (std::is_floating_point_v<T>) slot.fval = value;
+    else slot.ival = static_cast<int64_t>(value);
+    return slot;
+}
+
+// Adapts a plain function to a Native. The function is a template argument,
+// so the call is direct and the arguments are read from the VM stack in
+// place.
+template<auto Fn, typename Sig = decltype(Fn)>
+struct Thunk;
+
+template<auto Fn, typename R, typename... A>
+struct Thunk<Fn, R (*)(A...)> {
+    static_assert(!std::is_same_v<R, std::string> && (!std::is_same_v<A, std::string> && ...), "natives take and return numbers and bools");
+
+    static StackSlot call(const StackSlot *args, void *) {
+        return invoke(args, std::index_sequence_for<A...>());
+    }
+
+    template<size_t... I>
+    static StackSlot invoke(const StackSlot *args, std::index_sequence<I...>) {
+        return to_slot<R>(Fn(from_slot<A>(args[I])...));
+    }
+};
+
+// Index of a script global, looked up once by name (see Script::global)
+template<typename T>
+struct Global {
+    uint32_t index = UINT32_MAX;
+};
+
+class Script {
+    Program program;
+    std::vector<Native> natives;
+    LinkTable table;
+
+    Script() = default;
+    uint32_t find_global(std::string_view name, TypeValue type) const;
+
+    friend class Engine;
+    friend class Instance;
+
+public:
+    // False when the script has no such global or its values do not fit T:
+    // integer and bool globals read as any integer type or bool, f32 and f64
+    // ones as float or double, strings as std::string.
+    template<typename T>
+    bool global(std::string_view name, Global<T>& out) const {
+        out.index = find_global(name, type_of<T>());
+        return out.index != UINT32_MAX;
+    }
+
+    const Chunk& chunk() const { return *program; }
+};
+
+// Host functions and compile settings. Scripts compiled by an Engine may call
+// the host functions bound before compiling them.
+class Engine {
+    bool use_cache;
+    uint8_t opt_level;
+    std::vector<LinkTable::Function> signatures;
+    std::vector<Native> natives;
+    std::string last_error;
+
+    std::shared_ptr<const Script> build(const std::string& path, const std::string *text);
+
+public:
+    // `cache` reuses module chunks from the on-disk cache, like the CLI.
+    // `level` is the CLI's -O level; at 2, globals no script code reads
+    // are never stored, so the host cannot get() them either.
+    explicit Engine(bool cache = true, uint8_t level = 1) : use_cache(cache), opt_level(level) {}
+
+    // Makes `Fn` callable from scripts as `name`, with the P# types of its
+    // parameters and result. False if the name is taken.
+    template<auto Fn>
+    bool bind(std::string name) {
+        return bind_thunk<Fn>(std::move(name), Fn);
+    }
+
+    // A Native with an explicit signature, for functions that need `data`
+    bool bind(std::string name, TypeValue ret, std::vector<TypeValue> params, Native native);
+
+    // nullptr on a compile error, see error(). compile() takes the source of
+    // the root file; `name` is its path for imports and messages.
+    std::shared_ptr<const Script> compile(std::string_view source, const std::string& name = "script.ps");
+    std::shared_ptr<const Script> compile_file(const std::string& path);
+
+    // The message of the last failed compile, without colors
+    const std::string& error() const { return last_error; }
+
+private:
+    template<auto Fn, typename R, typename... A>
+    bool bind_thunk(std::string name, R (*)(A...)) {
+        return bind(std::move(name), type_of<R>(), {type_of<A>()...}, Native{Thunk<Fn>::call, nullptr});
+    }
+};
+
+// One VM running a Script. Globals keep their values between runs and can be
+// read and written by the host at any time outside run().
+class Instance {
+    std::shared_ptr<const Script> script;
+    VM machine;
+
+public:
+    explicit Instance(std::shared_ptr<const Script> s, const HeapConfig& heap = HeapConfig());
+
+    // Runs the script's top-level code
+    void run() { machine.execute(); }
+
+    template<typename T>
+    T get(Global<T> global) const {
+        StackSlot slot = global.index < machine.global_vars.size() ? machine.global_vars[global.index] : StackSlot{};
+        if constexpr (std::is_same_v<T, std::string>) return string(slot.objval);
+        else return from_slot<T>(slot);
+    }
+
+    // False, and nothing is written, for a Global that was never found
+    template<typename T>
+    bool set(Global<T> global, T value) {
+        static_assert(!std::is_same_v<T, std::string>, "string globals are read-only");
+        if (global.index >= machine.chunk->num_globals) {
+            return false;
+        }
+        if (machine.global_vars.size() < machine.chunk->num_globals) {
+            machine.global_vars.resize(machine.chunk->num_globals);
+        }
+        machine.global_vars[global.index] = to_slot(value);
+        return true;
+    }
+
+    // For output, heap and JIT settings
+    VM& vm() { return machine; }
+
+private:
+    std::string string(Obj *s) const;
+};
+
+}
@@ -0,0 +1,98 @@
+#include "../../compiler/include/exception.h"
+#include "../../vm/include/str.h"
+#include "../include/psharp.h"
+#include <algorithm>
+
+namespace psharp {
+
+// Which StackSlot field holds a value of the type
+static int slot_class(TypeValue type) {
+    if (type <= TYPE_LONG) return 0;
+    if (type <= TYPE_DOUBLE) return 1;
+    return type;
+}
+
+uint32_t Script::find_global(std::string_view name, TypeValue type) const {
+    for (uint32_t i = 0; i < table.globals.size(); i++) {
+        if (table.globals[i].name == name) {
+            return slot_class(table.globals[i].type) == slot_class(type) ? i : UINT32_MAX;
+        }
+    }
+    return UINT32_MAX;
+}
+
+bool Engine::bind(std::string name, TypeValue ret, std::vector<TypeValue> params, Native native) {
+    if (params.size() > UINT8_MAX || std::any_of(signatures.begin(), signatures.end(), [&](auto& fn) { return fn.name == name; })) {
+        return false;
+    }
+    signatures.push_back({std::move(name), ret, std::move(params)});
+    natives.push_back(native);
+    return true;
+}
+
+std::shared_ptr<const Script> Engine::compile(std::string_view source, const std::string& name) {
+    std::string text(source);
+    return build(name, &text);
+}
+
+std::shared_ptr<const Script> Engine::compile_file(const std::string& path) {
+    return build(path, nullptr);
+}
+
+// The frontend reports errors colored for a terminal
+static std::string plain(std::string_view text) {
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\033') {
+            i = std::min(text.find('m', i), text.size());
+            continue;
+        }
+        out += text[i];
+    }
+    while (!out.empty() && out.back() == '\n') {
+        out.pop_back();
+    }
+    return out;
+}
+
+std::shared_ptr<const Script> Engine::build(const std::string& path, const std::string *text) {
+    last_error.clear();
+    ModuleBuilder builder(BACKEND_STACK, use_cache, 0, signatures, opt_level);
+    bool throws = error_throws;
+    error_throws = true;
+    Chunk *chunk = nullptr;
+    try {
+        chunk = builder.build(path, text);
+        if (chunk == nullptr) {
+            last_error = "Cannot open " + path;
+        }
+    }
+    catch (const CompileError& e) {
+        last_error = plain(e.message);
+    }
+    error_throws = throws;
+    if (chunk == nullptr) {
+        return nullptr;
+    }
+    std::shared_ptr<Script> script(new Script());
+    script->program = Program(chunk);
+    script->natives = natives;
+    script->table.decode(chunk->sym_data(), chunk->sym_size());
+    return script;
+}
+
+Instance::Instance(std::shared_ptr<const Script> s, const HeapConfig& heap) : script(std::move(s)), machine(script->program, VM::DEFAULT_STACK_SIZE, VM::DEFAULT_FRAME_COUNT, heap) {
+    machine.natives = script->natives.data();
+    machine.native_count = script->natives.size();
+}
+
+std::string Instance::string(Obj *s) const {
+    if (s == nullptr) {
+        return std::string();
+    }
+    std::string out(str::length(s), '\0');
+    str::copy(s, out.data());
+    return out;
+}
+
+}
@@ -1,35 +1,363 @@
-#include "compiler/include/ast.h"
-#include "compiler/include/codegen.h"
-#include "compiler/include/lexer.h"
-#include "compiler/include/parser.h"
+#include "compiler/include/cemit.h"
+#include "compiler/include/module.h"
+#include "compiler/include/repl.h"
+#include "vm/include/bytecode.h"
+#include "vm/include/executor.h"
+#include "vm/include/profiler.h"
 #include "vm/include/vm.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <spawn.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Runs a chunk, or only lists it with --disasm. The --profile report and the
+// --gc-stats summary go to stderr so they never mix with program output.
+static void run(Chunk *chunk, bool disasm, bool profile, bool jit, const HeapConfig& heap, const OutputConfig& output, bool gc_stats) {
+    VM vm(chunk, VM::DEFAULT_STACK_SIZE, VM::DEFAULT_FRAME_COUNT, heap);
+    vm.jit = jit;
+    vm.output.configure(output);
+    if (disasm) {
+        vm.print_disassembly();
+        return;
+    }
+    Profiler profiler;
+    if (profile) {
+        vm.profiler = &profiler;
+    }
+    vm.execute();
+    if (profile) {
+        std::cout.flush();
+        profiler.report(*chunk, std::cerr);
+    }
+    if (gc_stats) {
+        std::cout.flush();
+        vm.heap.print_stats(std::cerr);
+    }
+}
+
+// --runs N: N independent executions of one shared program, spread over a
+// pool of `threads` workers (0: one per core)
+static void run_parallel(Chunk *chunk, size_t runs, size_t threads, bool jit, const HeapConfig& heap, const OutputConfig& output) {
+    Program program(chunk);
+    Executor executor(threads);
+    for (size_t i = 0; i < runs; i++) {
+        executor.submit([&] {
+            VM vm(program, VM::DEFAULT_STACK_SIZE, VM::DEFAULT_FRAME_COUNT, heap);
+            vm.jit = jit;
+            vm.output.configure(output);
+            vm.execute();
+        });
+    }
+    executor.wait();
+}
+
+// --jit-check: runs one copy of the program interpreted and one compiled by
+// the JIT, then compares their output and final globals bit for bit. The
+// interpreter's output is printed; mismatches go to stderr.
+static int check_jit(Chunk *interpreted, Chunk *compiled, const HeapConfig& heap) {
+    auto capture = [&](Chunk *chunk, bool jit, std::vector<StackSlot>& globals, bool& native) {
+        std::ostringstream out;
+        VM vm(chunk, VM::DEFAULT_STACK_SIZE, VM::DEFAULT_FRAME_COUNT, heap);
+        vm.jit = jit;
+        vm.output.attach(&out);
+        vm.execute();
+        globals = vm.global_vars;
+        native = vm.jit_code != nullptr;
+        return out.str();
+    };
+    std::vector<StackSlot> expected, actual;
+    bool native = false;
+    std::string expected_out = capture(interpreted, false, expected, native);
+    std::string actual_out = capture(compiled, true, actual, native);
+    std::cout << expected_out;
+    if (!native) {
+        std::cerr << "jit check: chunk not compiled, nothing to compare\n";
+        return 0;
+    }
+    int mismatches = 0;
+    if (expected_out != actual_out) {
+        std::cerr << "\033[31mjit check: output differs\033[0m\n" << actual_out;
+        mismatches++;
+    }
+    for (size_t i = 0; i < expected.size(); i++) {
+        if (expected[i].ival != actual[i].ival) {
+            std::cerr << "\033[31mjit check: global " << i << " is " << actual[i].ival
+                      << ", expected " << expected[i].ival << "\033[0m\n";
+            mismatches++;
+        }
+    }
+    if (mismatches == 0) {
+        std::cerr << "jit check: output and " << expected.size() << " globals match\n";
+    }
+    return mismatches == 0 ? 0 : 1;
+}
+
+// --print-flush
+static bool parse_flush(std::string_view arg, FlushPolicy& policy) {
+    if (arg == "auto") policy = FLUSH_AUTO;
+    else if (arg == "full") policy = FLUSH_FULL;
+    else if (arg == "line") policy = FLUSH_LINE;
+    else return false;
+    return true;
+}
+
+// Byte counts with an optional K, M or G suffix; 0 on malformed input
+static size_t parse_size(std::string_view arg) {
+    size_t value = 0;
+    auto [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), value);
+    if (ec != std::errc() || end == arg.data()) {
+        return 0;
+    }
+    std::string_view suffix(end, arg.data() + arg.size() - end);
+    if (suffix == "K" || suffix == "k") return value << 10;
+    if (suffix == "M" || suffix == "m") return value << 20;
+    if (suffix == "G" || suffix == "g") return value << 30;
+    return suffix.empty() ? value : 0;
+}
+
+// Runs the system C compiler ($CC, or cc) on `c_path`. $CC may carry its own
+// arguments and is split into words; the paths reach the compiler as they
+// are, with no shell in between.
+static bool run_cc(const std::string& out, const std::string& c_path) {
+    const char *cc = std::getenv("CC");
+    std::vector<std::string> args;
+    std::istringstream words(cc ? cc : "");
+    for (std::string word; words >> word;) {
+        args.push_back(word);
+    }
+    if (args.empty()) {
+        args.push_back("cc");
+    }
+    // A path starting with '-' would be read as an option
+    auto path = [](const std::string& p) { return p[0] == '-' ? "./" + p : p; };
+    args.insert(args.end(), {"-O2", "-fwrapv", "-o", path(out), path(c_path), "-lm"});
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0) {
+        return false;
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// --emit-c writes the C translation to `out`; --build compiles it into the
+// executable `out` instead
+static bool write_c(CEmitter& emitter, const std::string& out, bool build) {
+    std::string c_path = build ? out + ".c" : out;
+    std::ofstream file(c_path);
+    if (!file) {
+        std::cerr << "\033[31mError writing C file: " << c_path << "\033[0m\n";
+        return false;
+    }
+    if (!emitter.emit(file)) {
+        file.close();
+        std::filesystem::remove(c_path);
+        std::cerr << "\033[31mError emitting C: strings and register bytecode are not supported!\033[0m\n";
+        return false;
+    }
+    file.close();
+    if (!build) {
+        return true;
+    }
+    bool built = run_cc(out, c_path);
+    std::filesystem::remove(c_path);
+    if (!built) {
+        std::cerr << "\033[31mError building " << out << ": the C compiler failed!\033[0m\n";
+        return false;
+    }
+    return true;
+}
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << "\033[31mUsage: psharp path/to/src\033[0m\n";
-        return 1;
+    const char *path = nullptr;
+    const char *output = nullptr;
+    Backend backend = BACKEND_STACK;
+    bool compile_only = false;
+    bool emit_c = false;
+    bool build = false;
+    bool use_cache = true;
+    bool disasm = false;
+    bool profile = false;
+    bool gc_stats = false;
+    bool jit = false;
+    bool jit_check = false;
+    bool repl = false;
+    size_t runs = 1;
+    size_t threads = 0;
+    uint8_t opt_level = 1;
+    HeapConfig heap;
+    OutputConfig output_config;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--reg") {
+            backend = BACKEND_REG;
+        }
+        else if (arg == "--compile") {
+            compile_only = true;
+        }
+        else if (arg == "--emit-c") {
+            emit_c = true;
+        }
+        else if (arg == "--build") {
+            build = true;
+        }
+        else if (arg == "--disasm") {
+            disasm = true;
+        }
+        else if (arg == "--profile") {
+            profile = true;
+        }
+        else if (arg == "--jit") {
+            jit = true;
+        }
+        else if (arg == "--jit-check") {
+            jit_check = true;
+        }
+        else if (arg == "--repl") {
+            repl = true;
+        }
+        else if (arg == "--gc-stats") {
+            gc_stats = true;
+        }
+        else if ((arg == "--runs" || arg == "--threads") && i + 1 < argc) {
+            auto [end, ec] = std::from_chars(argv[i + 1], argv[i + 1] + strlen(argv[i + 1]), arg == "--runs" ? runs : threads);
+            i++;
+            if (ec != std::errc() || *end != '\0' || runs == 0) {
+                path = nullptr;
+                break;
+            }
+        }
+        else if ((arg == "--heap" || arg == "--nursery") && i + 1 < argc) {
+            size_t size = parse_size(argv[++i]);
+            if (size == 0) {
+                path = nullptr;
+                break;
+            }
+            (arg == "--heap" ? heap.max_heap_size : heap.nursery_size) = size;
+        }
+        else if (arg == "--print-buffer" && i + 1 < argc) {
+            output_config.buffer_size = parse_size(argv[++i]);
+            if (output_config.buffer_size == 0) {
+                path = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--print-flush" && i + 1 < argc) {
+            if (!parse_flush(argv[++i], output_config.policy)) {
+                path = nullptr;
+                break;
+            }
+        }
+        else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            opt_level = arg[2] - '0';
+        }
+        else if (arg == "--no-cache") {
+            use_cache = false;
+        }
+        else if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        }
+        else if (path == nullptr && !arg.starts_with("-")) {
+            path = argv[i];
+        }
+        else {
+            path = nullptr;
+            break;
+        }
     }
-    std::ifstream file(argv[1]);
-    if (!file.is_open()) {
-        std::cerr << "\033[31mError openning file: does not exist!\033[0m\n";
+    if (repl && path == nullptr && backend == BACKEND_STACK) {
+        Repl(heap).run(std::cin, std::cout, isatty(STDIN_FILENO));
+        return 0;
+    }
+    if (path == nullptr || repl) {
+        std::cerr << "\033[31mUsage: psharp --repl [--heap size] [--nursery size]\n       psharp [--reg] [-O0 | -O1 | -O2] [--no-cache] [--disasm | --profile] [--jit | --jit-check] [--runs n] [--threads n] [--gc-stats] [--heap size] [--nursery size] [--print-buffer size] [--print-flush auto|full|line] [--compile | --emit-c | --build] [-o out] path/to/src\033[0m\n";
         return 1;
     }
-    auto file_name = std::filesystem::absolute(argv[1]).string();
-    std::ostringstream content;
-    content << file.rdbuf();
-    Lexer lex(content.str(), file_name);
-    file.close();
 
-    std::vector<Token> tokens(lex.tokenize());
-    
-    Parser parser(file_name, tokens);
-    std::vector<ASTNodePtr> stmts(parser.parse());
+    // Precompiled bytecode runs without any frontend work, once it verifies
+    if (bytecode::is_bytecode(path)) {
+        Chunk *chunk = bytecode::load(path, nullptr, true);
+        if (chunk == nullptr) {
+            std::cerr << "\033[31mError loading bytecode: invalid, incompatible or unverifiable file!\033[0m\n";
+            return 1;
+        }
+        if (emit_c || build) {
+            std::string out = output ? output : std::filesystem::path(path).replace_extension(build ? "" : ".c").string();
+            CEmitter emitter(*chunk);
+            bool ok = write_c(emitter, out, build);
+            delete chunk;
+            return ok ? 0 : 1;
+        }
+        if (jit_check) {
+            return check_jit(chunk, bytecode::load(path, nullptr, true), heap);
+        }
+        if (runs > 1) {
+            run_parallel(chunk, runs, threads, jit, heap, output_config);
+            return 0;
+        }
+        run(chunk, disasm, profile, jit, heap, output_config, gc_stats);
+        return 0;
+    }
 
-    CodeGen codegen(file_name, stmts);
-    VM vm(codegen.generate());
-    //vm.print_disassembly();
-    vm.execute();
-}
\ No newline at end of file
+    // Every file of the program is compiled on `threads` workers, reusing
+    // cached module chunks
+    auto load = [&]() {
+        return ModuleBuilder(backend, use_cache, threads, {}, opt_level).build(path);
+    };
+
+    if (compile_only) {
+        std::string out = output ? output : std::filesystem::path(path).replace_extension(".psbc").string();
+        ModuleBuilder builder(backend, use_cache, threads, {}, opt_level);
+        Chunk *chunk = builder.build(path);
+        if (chunk == nullptr) {
+            std::cerr << "\033[31mError openning file: does not exist!\033[0m\n";
+            return 1;
+        }
+        bool ok = bytecode::save(*chunk, out, builder.program_key());
+        delete chunk;
+        if (!ok) {
+            std::cerr << "\033[31mError writing bytecode file: " << out << "\033[0m\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    Chunk *chunk = load();
+    if (chunk == nullptr) {
+        std::cerr << "\033[31mError openning file: does not exist!\033[0m\n";
+        return 1;
+    }
+    if (emit_c || build) {
+        std::string out = output ? output : std::filesystem::path(path).replace_extension(build ? "" : ".c").string();
+        CEmitter emitter(*chunk);
+        bool ok = write_c(emitter, out, build);
+        delete chunk;
+        return ok ? 0 : 1;
+    }
+    if (jit_check) {
+        return check_jit(chunk, load(), heap);
+    }
+    if (runs > 1) {
+        run_parallel(chunk, runs, threads, jit, heap, output_config);
+        return 0;
+    }
+    run(chunk, disasm, profile, jit, heap, output_config, gc_stats);
+}
@@ -0,0 +1,166 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+enum ObjKind : uint8_t {
+    OBJ_RAW,            // no interpretation beyond the header
+    OBJ_STR,            // flat string, see str.h
+    OBJ_ROPE,           // string concatenation, see str.h
+};
+
+enum ObjFlags : uint8_t {
+    OBJ_OLD        = 1 << 0,
+    OBJ_MARKED     = 1 << 1,
+    OBJ_FORWARDED  = 1 << 2,     // nursery copy, the first ref field points to the promoted object
+    OBJ_REMEMBERED = 1 << 3,     // old object in the remembered set
+    OBJ_STATIC     = 1 << 4,     // lives outside the heap (e.g. in a chunk's string pool), never written by the collector
+    OBJ_INTERNED   = 1 << 5,     // canonical copy of a string
+};
+
+// Every heap object starts with this header, followed by `num_refs` Obj*
+// fields that the collector traces and then by raw payload bytes. Reference
+// fields and roots may also hold immediates, words with the low bit set,
+// which the collector skips.
+struct Obj {
+    uint32_t size;              // bytes, header included, multiple of 8
+    uint16_t num_refs;
+    uint8_t kind;
+    uint8_t flags;
+
+    Obj **refs() { return reinterpret_cast<Obj**>(this + 1); }
+    uint8_t *payload() { return reinterpret_cast<uint8_t*>(refs() + num_refs); }
+};
+
+static_assert(sizeof(Obj) == 8, "objects are 8-byte aligned");
+
+inline bool is_pointer(const Obj *ref) {
+    return ref != nullptr && !(reinterpret_cast<uintptr_t>(ref) & 1);
+}
+
+class Heap;
+
+// A table that refers to old objects without keeping them alive, such as
+// the string intern table. Every major collection calls sweep() between
+// marking and freeing; entries that are not Heap::live() must be dropped.
+struct WeakRefs {
+    virtual void sweep(const Heap& heap) = 0;
+
+protected:
+    ~WeakRefs() = default;
+};
+
+// Thread-local allocation buffer: a slice of the nursery owned by one
+// mutator, so the fast path is a pointer bump with no synchronization.
+struct TLAB {
+    uint8_t *cur = nullptr;
+    uint8_t *end = nullptr;
+};
+
+struct HeapConfig {
+    size_t nursery_size = 4 << 20;
+    size_t tlab_size = 32 << 10;
+    size_t old_size = 16 << 20;             // old generation size that triggers the first major collection
+    size_t max_heap_size = size_t(1) << 30;  // old generation limit, promotions included
+};
+
+struct GCStats {
+    uint64_t minor_count = 0;
+    uint64_t major_count = 0;
+    uint64_t minor_pause_ns = 0;
+    uint64_t major_pause_ns = 0;
+    uint64_t max_minor_pause_ns = 0;
+    uint64_t max_major_pause_ns = 0;
+    uint64_t promoted_bytes = 0;
+    uint64_t freed_bytes = 0;
+};
+
+// Two generations. New objects are bumped into the nursery through TLABs;
+// a minor collection copies the live ones into the old generation and
+// empties the nursery. The old generation is mark-sweep over individually
+// allocated objects. Collections need every mutator stopped; the caller
+// passes the addresses of all root slots.
+class Heap {
+    HeapConfig config;
+    uint8_t *nursery;
+    uint8_t *nursery_end;
+    std::atomic<uint8_t*> nursery_top;
+    std::vector<TLAB*> tlabs;
+    std::vector<Obj*> old_objects;
+    std::vector<Obj*> remembered;           // old objects that may point into the nursery
+    std::vector<WeakRefs*> weak_refs;
+    size_t old_bytes = 0;
+    size_t next_major;
+
+    Obj *promote(Obj *obj, std::vector<Obj*>& worklist);
+    void mark(std::vector<Obj*>& worklist);
+    void sweep();
+
+public:
+    GCStats stats;
+
+    Heap(const HeapConfig& c = HeapConfig());
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+    ~Heap();
+
+    void attach(TLAB& tlab);
+    void detach(TLAB& tlab);
+    void add_weak(WeakRefs& refs) { weak_refs.push_back(&refs); }
+    void remove_weak(WeakRefs& refs);
+
+    bool in_nursery(const void *p) const { return p >= nursery && p < nursery_end; }
+
+    // Only meaningful for old objects inside WeakRefs::sweep()
+    static bool live(const Obj *obj) { return obj->flags & (OBJ_MARKED | OBJ_STATIC); }
+
+    // Returns nullptr when the nursery is exhausted or the old generation is
+    // due for a major collection; the caller collects and retries. Reference
+    // fields come back zeroed. Objects are at least 16
+    // bytes so that a forwarding pointer always fits.
+    Obj *alloc(TLAB& tlab, size_t size, uint16_t num_refs, uint8_t kind) {
+        size = size < 16 ? 16 : (size + 7) & ~size_t(7);
+        if ((size_t)(tlab.end - tlab.cur) < size) [[unlikely]] {
+            return alloc_slow(tlab, size, num_refs, kind);
+        }
+        Obj *obj = reinterpret_cast<Obj*>(tlab.cur);
+        tlab.cur += size;
+        init(obj, size, num_refs, kind, 0);
+        return obj;
+    }
+
+    Obj *alloc_slow(TLAB& tlab, size_t size, uint16_t num_refs, uint8_t kind);
+    Obj *alloc_old(size_t size, uint16_t num_refs, uint8_t kind);
+
+    // Call after storing `value` into a field of `holder`, including the
+    // initializing stores into objects from alloc_old(). Nursery holders are
+    // filtered out by the first test.
+    void write_barrier(Obj *holder, Obj *value) {
+        if ((holder->flags & OBJ_OLD) && !(holder->flags & OBJ_REMEMBERED) && is_pointer(value) && in_nursery(value)) {
+            holder->flags |= OBJ_REMEMBERED;
+            remembered.push_back(holder);
+        }
+    }
+
+    // A minor collection, followed by a major one when the old generation
+    // has outgrown its budget or `major` is set. Every root is updated in
+    // place.
+    void collect(const std::vector<Obj**>& roots, bool major = false);
+
+    size_t nursery_used() const;
+    size_t old_used() const { return old_bytes; }
+    void print_stats(std::ostream& out) const;
+
+private:
+    static void init(Obj *obj, size_t size, uint16_t num_refs, uint8_t kind, uint8_t flags) {
+        obj->size = size;
+        obj->num_refs = num_refs;
+        obj->kind = kind;
+        obj->flags = flags;
+        for (uint16_t i = 0; i < num_refs; i++) {
+            obj->refs()[i] = nullptr;
+        }
+    }
+};
@@ -0,0 +1,73 @@
+#pragma once
+#include "vm.h"
+#include <string>
+#include <string_view>
+
+// On-disk chunk format, native byte order:
+//     BytecodeHeader
+//     StackSlot constants[const_count]     (at const_offset, 8-byte aligned)
+//     Function  functions[func_count]      (at func_offset)
+//     uint8_t   ref_map[ref_map_size]      (at ref_map_offset)
+//     uint8_t   strings[strings_size]      (at strings_offset, 8-byte aligned)
+//     uint8_t   code[code_size]            (at code_offset)
+//     uint8_t   symbols[symbols_size]      (at symbols_offset)
+// Loading maps the file read-only and executes straight out of the mapping.
+
+// Identifies the source a chunk was compiled from. `hash` names the cache
+// file; `check` is computed independently and confirms a hit on it.
+struct SourceKey {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    uint64_t check = 0x9e3779b97f4a7c15ull;
+
+    bool operator==(const SourceKey&) const = default;
+};
+struct BytecodeHeader {
+    static constexpr char MAGIC[4] = {'P', 'S', 'B', 'C'};
+    static constexpr uint16_t VERSION = 11;
+    static constexpr uint32_t ENDIAN_TAG = 0x01020304;
+
+    char magic[4];
+    uint16_t version;
+    uint8_t kind;
+    uint8_t reserved;
+    uint32_t endian_tag;
+    uint32_t num_globals;
+    uint32_t num_temps;
+    uint32_t num_locals;
+    uint32_t max_stack;             // see Chunk
+    uint64_t source_hash;
+    uint64_t source_check;
+    uint64_t const_offset;
+    uint64_t const_count;
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t func_offset;
+    uint64_t func_count;
+    uint64_t ref_map_offset;
+    uint64_t ref_map_size;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t symbols_offset;
+    uint64_t symbols_size;
+};
+
+namespace bytecode {
+    uint64_t hash(std::string_view data, uint64_t seed = 0xcbf29ce484222325ull);
+    // Extends both halves of `seed` with `data`; the check also takes its length
+    SourceKey key(std::string_view data, SourceKey seed = {});
+    bool is_bytecode(const std::string& path);
+
+    // Both return false/nullptr on any I/O error or malformed file. With
+    // `verify`, load() also rejects code that fails the verifier (see
+    // verifier.h) or whose max_stack differs from the header's; without it,
+    // the chunk is unverified whatever the header says.
+    bool save(const Chunk& chunk, const std::string& path, SourceKey source = {});
+    Chunk *load(const std::string& path, SourceKey *source = nullptr, bool verify = false);
+
+    // Compile cache keyed by source. The directory is $PSHARP_CACHE_DIR,
+    // else $XDG_CACHE_HOME/psharp, else ~/.cache/psharp. A file whose
+    // header does not carry the whole key is a miss.
+    std::string cache_path(uint64_t source_hash);
+    Chunk *load_cached(SourceKey source);
+    void store_cached(const Chunk& chunk, SourceKey source);
+}
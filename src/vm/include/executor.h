@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker owns a deque: tasks it submits go
+// to the back of its own deque and it takes work from there, so related
+// tasks stay on one core; a worker that runs dry steals from the front of
+// the others'. Tasks submitted from outside the pool are dealt round-robin.
+class Executor {
+public:
+    using Task = std::function<void()>;
+
+    // 0 threads means one per hardware thread
+    explicit Executor(size_t threads = 0);
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+    ~Executor();        // finishes every submitted task
+
+    void submit(Task task);
+
+    // Blocks until every task submitted so far has finished
+    void wait();
+
+    size_t size() const { return threads.size(); }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // `queued` counts tasks sitting in some deque and is only raised under
+    // `lock`, so a worker going to sleep cannot miss a submit
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable all_done;
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> pending{0};     // submitted and not yet finished
+    std::atomic<size_t> next{0};        // round-robin target for outside submits
+    bool stopping = false;
+
+    void run(size_t index);
+    bool take(size_t index, Task& task);
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include "vm.h"
+#include <cstddef>
+#include <cstdint>
+
+// Read by the generated code for its overflow checks and prints
+struct JitContext {
+    StackSlot *stack_end;
+    uint64_t frame_count;
+    Output *output;
+};
+
+// Native code for one stack chunk, in its own executable mapping. The entry
+// point runs the top-level code with `bp` as frame 0 and returns at its HALT.
+struct JitCode {
+    void *mem = nullptr;
+    size_t size = 0;
+    void (*entry)(StackSlot *bp, StackSlot *globals, const JitContext *ctx) = nullptr;
+
+    JitCode() = default;
+    JitCode(const JitCode&) = delete;
+    JitCode& operator=(const JitCode&) = delete;
+    ~JitCode();
+};
+
+namespace jit {
+    // True when this build can generate code at all (Linux on x86-64)
+    bool available();
+
+    // nullptr when the chunk uses instructions the JIT does not translate
+    // (the string operations, which need the collector's view of the stack)
+    // or is a register chunk; the VM then interprets it.
+    JitCode *compile(const Chunk& chunk);
+}
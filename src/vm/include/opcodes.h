@@ -20,9 +20,144 @@ enum OpCodes : uint8_t {
     OP_PRINTI,
     OP_PRINTF,
     OP_PRINTO,
-    OP_DEFGLOB,
     OP_LDGLOB,
     OP_STGLOB,
-    OP_RET,
-    OP_CALL
-};
\ No newline at end of file
+    OP_RET,             // return tos to the caller
+    OP_CALL,            // call f, arguments on the stack
+    OP_TAILCALL,        // call f reusing the current frame
+    OP_LDLOC,           // push frame slot n
+    OP_STLOC,           // pop into frame slot n
+    OP_LDLOC0,          // short forms for the first four slots
+    OP_LDLOC1,
+    OP_LDLOC2,
+    OP_LDLOC3,
+    OP_STLOC0,
+    OP_STLOC1,
+    OP_STLOC2,
+    OP_STLOC3,
+    OP_PSTR,            // push the string literal at pool offset n
+    OP_SCAT,            // concatenate the top two strings
+    OP_SEQ,             // string equality
+    OP_SNE,
+    OP_NCALL,           // call host function n with the top c operands as arguments
+    OP_ITOF,            // integer to double
+
+    // strength-reduced forms, produced only by the optimizer
+    OP_ISHLK,           // shift left by n, for a multiplication by 2^n
+    OP_IREMP2,          // remainder of a division by 2^n, with the dividend's sign
+
+    // superinstructions, produced only by the peephole pass
+    OP_IADD_GG,         // LDGLOB a; LDGLOB b; IADD
+    OP_IADDK,           // PCONST k; IADD
+    OP_ISUBK,           // PCONST k; ISUB
+    OP_IMULK,           // PCONST k; IMUL
+    OP_FADDK,           // PCONST k; FADD
+    OP_FSUBK,           // PCONST k; FSUB
+    OP_FMULK,           // PCONST k; FMUL
+    OP_STGLOBK,         // PCONST k; STGLOB g
+
+    OP_COUNT
+};
+
+// Instruction length in bytes, opcode included. Frame slot operands,
+// argument counts and shift counts are a single byte, every other operand is
+// a 3-byte big-endian index.
+inline uint8_t op_size(uint8_t op) {
+    switch (op) {
+        case OP_LDLOC:
+        case OP_STLOC:
+        case OP_ISHLK:
+        case OP_IREMP2:
+            return 2;
+        case OP_PCONST:
+        case OP_PSTR:
+        case OP_CALL:
+        case OP_TAILCALL:
+        case OP_LDGLOB:
+        case OP_STGLOB:
+        case OP_IADDK:
+        case OP_ISUBK:
+        case OP_IMULK:
+        case OP_FADDK:
+        case OP_FSUBK:
+        case OP_FMULK:
+            return 4;
+        case OP_NCALL:
+            return 5;
+        case OP_IADD_GG:
+        case OP_STGLOBK:
+            return 7;
+        default:
+            return 1;
+    }
+}
+
+inline uint32_t read_operand(const uint8_t *code) {
+    return (uint32_t)code[2] | ((uint32_t)code[1] << 8) | ((uint32_t)code[0] << 16);
+}
+
+inline const char *op_name(uint8_t op) {
+    static const char *names[] = {
+        "HALT", "PCONST", "IADD", "FADD", "ISUB", "FSUB", "IMUL", "FMUL", "IDIV", "FDIV", "IREM", "FREM",
+        "UIMINUS", "UFMINUS", "UNOT", "PRINTI", "PRINTF", "PRINTO", "LDGLOB", "STGLOB", "RET", "CALL",
+        "TAILCALL", "LDLOC", "STLOC", "LDLOC0", "LDLOC1", "LDLOC2", "LDLOC3", "STLOC0", "STLOC1", "STLOC2", "STLOC3",
+        "PSTR", "SCAT", "SEQ", "SNE", "NCALL", "ITOF", "ISHLK", "IREMP2",
+        "IADD_GG", "IADDK", "ISUBK", "IMULK", "FADDK", "FSUBK", "FMULK", "STGLOBK",
+    };
+    static_assert(sizeof(names) / sizeof(*names) == OP_COUNT, "opcode names are out of sync with OpCodes");
+    return op < OP_COUNT ? names[op] : "???";
+}
+// Register-machine instruction set. Every operand is a 3-byte index into the
+// VM register file, which is laid out as [constants | globals | temporaries],
+// so constant and global operands need no separate load instruction:
+//     ROP_IADD dst, a, b      R[dst] = R[a] + R[b]
+//     ROP_UIMINUS dst, a      R[dst] = -R[a]
+//     ROP_MOV dst, a          R[dst] = R[a]
+enum RegOpCodes : uint8_t {
+    ROP_HALT,
+    ROP_MOV,
+    ROP_IADD,
+    ROP_FADD,
+    ROP_ISUB,
+    ROP_FSUB,
+    ROP_IMUL,
+    ROP_FMUL,
+    ROP_IDIV,
+    ROP_FDIV,
+    ROP_IREM,
+    ROP_FREM,
+    ROP_UIMINUS,
+    ROP_UFMINUS,
+    ROP_UNOT,
+    ROP_ITOF,
+
+    ROP_COUNT
+};
+
+inline uint8_t reg_op_operands(uint8_t op) {
+    switch (op) {
+        case ROP_HALT:
+            return 0;
+        case ROP_MOV:
+        case ROP_UIMINUS:
+        case ROP_UFMINUS:
+        case ROP_UNOT:
+        case ROP_ITOF:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+inline uint8_t reg_op_size(uint8_t op) {
+    return 1 + 3 * reg_op_operands(op);
+}
+
+inline const char *reg_op_name(uint8_t op) {
+    static const char *names[] = {
+        "HALT", "MOV", "IADD", "FADD", "ISUB", "FSUB", "IMUL", "FMUL", "IDIV", "FDIV", "IREM", "FREM",
+        "UIMINUS", "UFMINUS", "UNOT", "ITOF",
+    };
+    static_assert(sizeof(names) / sizeof(*names) == ROP_COUNT, "opcode names are out of sync with RegOpCodes");
+    return op < ROP_COUNT ? names[op] : "???";
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include "alloca.h"
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+
+enum FlushPolicy : uint8_t {
+    FLUSH_AUTO,         // FLUSH_LINE on a terminal, FLUSH_FULL otherwise
+    FLUSH_FULL,         // when the buffer is full and when the VM halts
+    FLUSH_LINE,         // after every printed value
+};
+
+struct OutputConfig {
+    size_t buffer_size = 64 << 10;
+    FlushPolicy policy = FLUSH_AUTO;
+};
+
+// Program output, everything the PRINT instructions write. Values are
+// formatted with std::to_chars straight into a buffer, which reaches the
+// file descriptor in large write(2) calls; no iostream is involved. Each
+// value is followed by a newline and doubles print like `std::cout <<` them
+// (%g).
+class Output {
+    char *buf;
+    size_t cap;
+    size_t len = 0;
+    int fd;
+    bool line;
+    std::ostream *stream = nullptr;
+
+    // Longest to_chars result plus the newline
+    static constexpr size_t MAX_NUMBER = 32;
+
+    void ensure(size_t n) {
+        if (cap - len < n) [[unlikely]] {
+            flush();
+        }
+    }
+    void emit(const char *p, size_t n);
+    void end_value() {
+        buf[len++] = '\n';
+        if (line) [[unlikely]] {
+            flush();
+        }
+    }
+
+public:
+    // Runtime errors exit without unwinding; while a Scope is alive, its
+    // Output is flushed by an exit handler instead. Scopes nest per thread.
+    class Scope {
+        Output *prev;
+
+    public:
+        explicit Scope(Output& out);
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        ~Scope();
+    };
+
+    explicit Output(const OutputConfig& config = OutputConfig(), int fd = 1);
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+    ~Output();
+
+    // Flushes, then applies a new buffer size and policy
+    void configure(const OutputConfig& config);
+
+    // Sends the output to `s` instead of the file descriptor, nullptr to
+    // stop; --jit-check captures programs this way
+    void attach(std::ostream *s);
+
+    void print_int(int64_t v) {
+        ensure(MAX_NUMBER);
+        len = std::to_chars(buf + len, buf + cap, v).ptr - buf;
+        end_value();
+    }
+    void print_float(double v) {
+        ensure(MAX_NUMBER);
+        len = std::to_chars(buf + len, buf + cap, v, std::chars_format::general, 6).ptr - buf;
+        end_value();
+    }
+    void print_str(Obj *s);
+
+    void flush();
+};
@@ -0,0 +1,57 @@
+#pragma once
+#include "vm.h"
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Instruction-level profile of one VM::execute() run. The interpreter calls
+// step() before dispatching every instruction; the time between two steps is
+// charged to the earlier instruction. Timestamps are rdtsc cycles on x86 and
+// steady_clock nanoseconds elsewhere.
+struct Profiler {
+    uint64_t op_counts[256] = {};
+    uint64_t op_time[256] = {};
+    std::vector<uint64_t> pair_counts;      // [prev * 256 + next]
+    std::vector<uint64_t> addr_counts;      // per code offset
+    const uint8_t *code = nullptr;
+    uint64_t last_time = 0;
+    uint8_t last_op = 0;
+    bool running = false;
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void start(const Chunk& chunk) {
+        code = chunk.code_data();
+        pair_counts.assign(256 * 256, 0);
+        addr_counts.assign(chunk.code_size(), 0);
+        running = false;
+    }
+
+    void step(const uint8_t *ip) {
+        uint64_t t = now();
+        uint8_t op = *ip;
+        if (running) {
+            op_time[last_op] += t - last_time;
+            pair_counts[last_op * 256 + op]++;
+        }
+        op_counts[op]++;
+        addr_counts[ip - code]++;
+        last_op = op;
+        running = true;
+        last_time = now();
+    }
+
+    // Writes the opcode table, the hottest addresses and the most frequent
+    // opcode pairs, `top` entries each
+    void report(const Chunk& chunk, std::ostream& out, size_t top = 10) const;
+};
@@ -0,0 +1,115 @@
+#pragma once
+#include "alloca.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A string value is one word. Strings of up to 7 bytes are immediates: the
+// low bit is set, bits 1-3 hold the length and bytes 1-7 the characters, so
+// they never allocate and equal ones are equal words. Longer strings point to
+//     OBJ_STR   flat: a Flat payload followed by the bytes
+//     OBJ_ROPE  concatenation: refs {left, right}, a Rope payload
+// Literals are OBJ_STR records in the chunk's string pool and are used in
+// place; they are OBJ_STATIC and already interned.
+namespace str {
+    constexpr size_t INLINE_MAX = 7;
+    constexpr size_t FLAT_MAX = 64;         // longer concatenations build ropes
+    constexpr uint32_t MAX_DEPTH = 32;      // deeper ropes are flattened eagerly
+
+    struct Flat {
+        uint32_t length;
+        uint32_t hash;
+    };
+
+    // Depth 0 marks a rope that was flattened: refs[0] is then the interned
+    // flat string and refs[1] is null.
+    struct Rope {
+        uint32_t length;
+        uint32_t depth;
+    };
+
+    inline bool is_inline(const Obj *s) { return reinterpret_cast<uintptr_t>(s) & 1; }
+    inline size_t inline_length(const Obj *s) { return (reinterpret_cast<uintptr_t>(s) >> 1) & 7; }
+    inline char inline_char(const Obj *s, size_t i) { return (char)(reinterpret_cast<uintptr_t>(s) >> (8 * (i + 1))); }
+
+    inline Obj *make_inline(const char *data, size_t len) {
+        uint64_t word = 1 | (len << 1);
+        for (size_t i = 0; i < len; i++) {
+            word |= (uint64_t)(uint8_t)data[i] << (8 * (i + 1));
+        }
+        return reinterpret_cast<Obj*>(word);
+    }
+
+    inline Flat *flat(Obj *s) { return reinterpret_cast<Flat*>(s->payload()); }
+    inline char *chars(Obj *s) { return reinterpret_cast<char*>(flat(s) + 1); }
+    inline Rope *rope(Obj *s) { return reinterpret_cast<Rope*>(s->payload()); }
+    inline size_t flat_size(size_t len) { return sizeof(Obj) + sizeof(Flat) + len; }
+
+    inline size_t length(Obj *s) {
+        if (is_inline(s)) {
+            return inline_length(s);
+        }
+        return s->kind == OBJ_STR ? flat(s)->length : rope(s)->length;
+    }
+
+    inline uint32_t depth(Obj *s) {
+        return is_inline(s) || s->kind == OBJ_STR ? 0 : rope(s)->depth;
+    }
+
+    uint32_t hash(const char *data, size_t len);
+
+    // Writes the bytes of any string value to `out`, which must have room
+    // for length(s) of them
+    void copy(Obj *s, char *out);
+
+    // Appends a literal record to a chunk's string pool and returns its offset
+    uint32_t add_literal(std::vector<uint8_t>& pool, std::string_view text);
+    bool valid_pool(const uint8_t *pool, size_t size);
+}
+
+// Canonical strings. Equal strings that went through canonical() are the
+// same word, so equality of interned strings is a pointer compare. Interned
+// copies are allocated in the old generation and are dropped by major
+// collections once nothing else refers to them.
+class StringTable : public WeakRefs {
+    Heap& heap;
+    std::vector<Obj*> table;                // open addressing, power of two
+    size_t count = 0;
+    std::string buf;                        // flattening scratch
+
+    Obj **find(const char *data, size_t len, uint32_t hash);
+    void insert(Obj *s);
+    void grow();
+
+public:
+    StringTable(Heap& h);
+    StringTable(const StringTable&) = delete;
+    StringTable& operator=(const StringTable&) = delete;
+    ~StringTable();
+
+    // Registers every literal of a chunk's string pool; allocates nothing
+    // but the table itself
+    void add_pool(const uint8_t *pool, size_t size);
+
+    Obj *intern(const char *data, size_t len, uint32_t hash);
+
+    // Never collects, so callers need not expose their values as roots
+    Obj *canonical(Obj *s);
+
+    bool equal(Obj *a, Obj *b) {
+        if (a == b) {
+            return true;
+        }
+        auto is_canonical = [](Obj *s) { return str::is_inline(s) || (s->flags & OBJ_INTERNED); };
+        if (is_canonical(a) && is_canonical(b)) {
+            return false;
+        }
+        return canonical(a) == canonical(b);
+    }
+
+    void write(std::ostream& out, Obj *s);
+
+    void sweep(const Heap& heap) override;
+};
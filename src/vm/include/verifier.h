@@ -0,0 +1,23 @@
+#pragma once
+#include "vm.h"
+
+// Load-time proof that a chunk cannot make the VM read or write out of
+// bounds, so that it can run without per-instruction checks. Chunks have no
+// jumps: the top-level code and every function body are straight-line blocks,
+// each walked once with the operand stack simulated exactly. For every block
+// it proves that
+//  - every instruction is known and lies inside the code;
+//  - every constant, global, function, frame slot and string pool index is in
+//    range, and no slot is read before it is written or passed in;
+//  - the stack never underflows;
+//  - operands are of the kind their instruction expects, and heap references
+//    go exactly where the ref map and the collector expect them;
+//  - functions only call earlier functions or themselves.
+// It also follows the calls to bound the stack the deepest call chain uses.
+// Register chunks only have their operands checked against the register file.
+namespace verifier {
+    // Sets chunk.max_stack and maps the chunk's safepoints (see Chunk) and
+    // returns true when the chunk verifies; otherwise leaves max_stack 0,
+    // and the VM keeps its checks
+    bool verify(Chunk& chunk);
+}
@@ -1,35 +1,218 @@
 #pragma once
+#include "alloca.h"
+#include "output.h"
+#include "str.h"
+#include <cstddef>
 #include <cstdint>
-#include <stack>
+#include <iosfwd>
+#include <memory>
 #include <vector>
 
 union StackSlot {
     int64_t ival;
     double fval;
-    void *objval;
+    Obj *objval;
+};
+
+enum ChunkKind : uint8_t {
+    CHUNK_STACK,        // OpCodes, operands on the VM stack
+    CHUNK_REG,          // RegOpCodes, operands in the register file
+};
+
+// Function table entry. All functions share their chunk's code and constants;
+// the first `arity` frame slots are the arguments.
+struct Function {
+    uint32_t entry;             // code offset
+    uint16_t arity;
+    uint16_t num_slots;         // arguments included
+    uint32_t param_refs;        // offset of the parameters' entries in the ref map
+    uint8_t ret_ref;            // returns a heap reference
+    uint8_t reserved[3];
+};
+
+// The heap references of a frame stopped at an instruction that can lead to
+// a collection: an OP_SCAT, or an OP_CALL whose callee is running. Found by
+// VM::collect_garbage from the frame's function and code offset.
+struct SafePoint {
+    uint32_t func;              // UINT32_MAX for top-level code
+    uint32_t pos;
+    uint32_t roots;             // first entry in Chunk::safepoint_roots
+    uint32_t num_roots;
 };
 
 struct Chunk {
     std::vector<StackSlot> constants;
     std::vector<uint8_t> code;
+    std::vector<Function> functions;
+
+    // One byte per global, then one per parameter of every function: 1 when
+    // the value is a heap reference. Together with the code this is enough
+    // to find every root precisely (see VM::collect_garbage).
+    std::vector<uint8_t> ref_map;
+
+    // String literals longer than str::INLINE_MAX, as ready-made static
+    // string objects; OP_PSTR pushes a pointer into the pool.
+    std::vector<uint8_t> strings;
+
+    // Names and types behind the global and function indices, encoded by the
+    // compiler (see LinkTable in module.h) for the linker and --emit-c. The
+    // VM never reads it.
+    std::vector<uint8_t> symbols;
+    ChunkKind kind = CHUNK_STACK;
+    uint32_t num_globals = 0;
+    uint32_t num_temps = 0;         // register chunks only
+    uint32_t num_locals = 0;        // frame 0 slots, for top-level blocks
+
+    // VM stack slots the deepest call chain reserves, stack[0] included, set
+    // by the verifier (see verifier.h); the register file size for register
+    // chunks. Every frame reserves its slots, its deepest operand stack and
+    // the slot the top of the stack spills to, as the JIT's checks do. 0
+    // until the chunk is verified, or when a function calls itself outside
+    // tail position, which recurses until the call stack overflows; the VM
+    // checks every push of such a chunk.
+    uint32_t max_stack = 0;
+
+    // Sorted by function, then code offset; every entry lists the frame
+    // slots, counted from its first one, that hold heap references there.
+    // The arguments of a call belong to the callee. Computed, never saved.
+    std::vector<SafePoint> safepoints;
+    std::vector<uint32_t> safepoint_roots;
+
+    // Set when the chunk is a view of a mapped bytecode file (see
+    // bytecode.h); code and constants are then read from the mapping and the
+    // vectors above stay empty.
+    void *mapping = nullptr;
+    size_t mapping_size = 0;
+    const uint8_t *mapped_code = nullptr;
+    const StackSlot *mapped_constants = nullptr;
+    const Function *mapped_functions = nullptr;
+    const uint8_t *mapped_ref_map = nullptr;
+    const uint8_t *mapped_strings = nullptr;
+    const uint8_t *mapped_symbols = nullptr;
+    size_t mapped_code_size = 0;
+    size_t mapped_const_count = 0;
+    size_t mapped_func_count = 0;
+    size_t mapped_ref_map_size = 0;
+    size_t mapped_strings_size = 0;
+    size_t mapped_symbols_size = 0;
+
+    Chunk() = default;
+    Chunk(const Chunk&) = delete;
+    Chunk& operator=(const Chunk&) = delete;
+    ~Chunk();
+
+    const uint8_t *code_data() const { return mapping ? mapped_code : code.data(); }
+    size_t code_size() const { return mapping ? mapped_code_size : code.size(); }
+    const StackSlot *const_data() const { return mapping ? mapped_constants : constants.data(); }
+    size_t const_count() const { return mapping ? mapped_const_count : constants.size(); }
+    const Function *func_data() const { return mapping ? mapped_functions : functions.data(); }
+    size_t func_count() const { return mapping ? mapped_func_count : functions.size(); }
+    const uint8_t *ref_data() const { return mapping ? mapped_ref_map : ref_map.data(); }
+    size_t ref_size() const { return mapping ? mapped_ref_map_size : ref_map.size(); }
+    const uint8_t *str_data() const { return mapping ? mapped_strings : strings.data(); }
+    size_t str_size() const { return mapping ? mapped_strings_size : strings.size(); }
+    const uint8_t *sym_data() const { return mapping ? mapped_symbols : symbols.data(); }
+    size_t sym_size() const { return mapping ? mapped_symbols_size : symbols.size(); }
+};
+
+// Host function, called by OP_NCALL with the caller's operands in place,
+// first argument first. Natives return plain values and must not allocate on
+// the VM heap or run code on the VM that called them. See psharp.h.
+struct Native {
+    StackSlot (*fn)(const StackSlot *args, void *data);
+    void *data;
 };
 
+// A compiled program. Nothing writes to a chunk once it is built, so one
+// Program can back any number of VMs, on any threads, at the same time.
+using Program = std::shared_ptr<const Chunk>;
+
+// Writes the instruction at `pos` with decoded operands and returns its size
+size_t disassemble(const Chunk& chunk, size_t pos, std::ostream& out);
+
+// Adds the safepoints of one block, the top-level code at `entry` for
+// UINT32_MAX or the body of `func`, to the chunk. The verifier maps every
+// block of the chunks it accepts; code run unverified must be mapped before
+// it can allocate.
+void map_safepoints(Chunk& chunk, uint32_t func, size_t entry = 0);
+
+struct Profiler;
+struct JitCode;
+
+// Call frames live in an array allocated with the VM, so calls never touch
+// the heap. Frame 0 belongs to the top-level code.
+struct Frame {
+    const uint8_t *ret_ip;
+    StackSlot *bp;              // first argument
+    uint32_t func;
+};
+
+// One execution of a Program: everything that changes while it runs. A VM
+// belongs to one thread at a time.
 struct VM {
-    std::stack<StackSlot> stack;
-    Chunk *chunk;
-    uint8_t *ip;
+    static constexpr size_t DEFAULT_STACK_SIZE = 1 << 16;
+    static constexpr size_t DEFAULT_FRAME_COUNT = 1 << 12;
+
+    // Flat operand stack. Every frame starts with its slots (arguments, then
+    // locals) and continues with its operands; execute() keeps the top operand
+    // in a register and spills it one slot up on a push. Frame 0 starts at
+    // stack[1]. A verified chunk gets max_stack slots and runs without stack
+    // checks.
+    size_t stack_size;
+    StackSlot *stack;
+    StackSlot *sp;
+    Frame *frames;
+    size_t frame_count;
+    Program program;
+    const Chunk *chunk;                 // program.get()
+    const uint8_t *ip;
+    size_t entry = 0;                   // code offset execute() starts at, see Repl
     std::vector<StackSlot> global_vars;
+    Profiler *profiler = nullptr;       // set to profile the next execute()
+
+    // Host functions by OP_NCALL index, bound by whoever compiled the chunk
+    const Native *natives = nullptr;
+    size_t native_count = 0;
 
-    VM(Chunk *c) : chunk(c), ip(c->code.data()) {}
-    ~VM() {
-        delete chunk;
+    // Run stack chunks as native code (see jit.h). Chunks the JIT declines,
+    // and profiled runs, are interpreted.
+    bool jit = false;
+    JitCode *jit_code = nullptr;
+
+    // Heap objects. Handlers that allocate store ip and the current frame
+    // and spill the top of the stack before they can collect.
+    Heap heap;
+    TLAB tlab;
+    Frame *frame = nullptr;
+    StringTable strings;
+
+    // PRINT output, flushed when execute() returns
+    Output output;
+
+    // `ss` only sizes the stack of unverified stack chunks
+    VM(Program p, size_t ss = DEFAULT_STACK_SIZE, size_t fc = DEFAULT_FRAME_COUNT, const HeapConfig& hc = HeapConfig()) : stack_size(p->kind == CHUNK_STACK && p->max_stack ? p->max_stack : ss), stack(new StackSlot[stack_size + 1]), sp(stack + 1), frames(new Frame[fc]), frame_count(fc), program(std::move(p)), chunk(program.get()), ip(chunk->code_data()), heap(hc), strings(heap) {
+        heap.attach(tlab);
+        strings.add_pool(chunk->str_data(), chunk->str_size());
     }
+    // Takes ownership of a chunk no other VM shares
+    VM(Chunk *c, size_t ss = DEFAULT_STACK_SIZE, size_t fc = DEFAULT_FRAME_COUNT, const HeapConfig& hc = HeapConfig()) : VM(Program(c), ss, fc, hc) {}
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+    ~VM();
 
-    void push_byte(Chunk *chunk, uint8_t byte);
-    uint8_t pop_byte(Chunk *chunk);
     void push_val(StackSlot slot);
     StackSlot pop_val();
-    uint32_t add_const(Chunk *chunk, StackSlot slot);
     void print_disassembly() const;
     void execute();
-};
\ No newline at end of file
+
+    // Allocation for handlers; may collect, see `frame` above
+    Obj *alloc(size_t size, uint16_t num_refs, uint8_t kind);
+    void collect_garbage(bool major = false);
+
+    // Concatenation of the strings ops[0] and ops[1]; may collect
+    Obj *concat(StackSlot *ops);
+
+private:
+    template<bool Profile, bool Checked> void execute_stack();
+    template<bool Profile> void execute_reg();
+};
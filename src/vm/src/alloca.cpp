@@ -0,0 +1,209 @@
+#include "../include/alloca.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+static void out_of_memory() {
+    std::cerr << "\033[31mRuntime error: Out of memory\033[0m\n";
+    exit(1);
+}
+
+static uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Heap::Heap(const HeapConfig& c) : config(c), next_major(c.old_size) {
+    // An empty nursery must always be able to hand out one TLAB
+    config.tlab_size = std::min(config.tlab_size, config.nursery_size);
+    nursery = static_cast<uint8_t*>(std::aligned_alloc(8, (config.nursery_size + 7) & ~size_t(7)));
+    if (nursery == nullptr) {
+        out_of_memory();
+    }
+    nursery_end = nursery + config.nursery_size;
+    nursery_top = nursery;
+}
+
+Heap::~Heap() {
+    for (Obj *obj : old_objects) {
+        std::free(obj);
+    }
+    std::free(nursery);
+}
+
+void Heap::attach(TLAB& tlab) {
+    tlab.cur = tlab.end = nullptr;
+    tlabs.push_back(&tlab);
+}
+
+void Heap::detach(TLAB& tlab) {
+    tlabs.erase(std::remove(tlabs.begin(), tlabs.end(), &tlab), tlabs.end());
+}
+
+void Heap::remove_weak(WeakRefs& refs) {
+    weak_refs.erase(std::remove(weak_refs.begin(), weak_refs.end(), &refs), weak_refs.end());
+}
+
+// Objects larger than half a TLAB go straight to the old generation, so one
+// of them can never waste most of a buffer. Once the old generation has
+// outgrown its budget, from either path or from alloc_old(), the next slow
+// allocation fails so that the caller collects, and the collection is major.
+Obj *Heap::alloc_slow(TLAB& tlab, size_t size, uint16_t num_refs, uint8_t kind) {
+    size = std::max<size_t>(size, sizeof(Obj) + sizeof(Obj*));
+    if (old_bytes >= next_major && next_major < config.max_heap_size) {
+        return nullptr;
+    }
+    if (size > config.tlab_size / 2) {
+        return alloc_old(size, num_refs, kind);
+    }
+    if ((size_t)(tlab.end - tlab.cur) >= size) {
+        return alloc(tlab, size, num_refs, kind);
+    }
+    uint8_t *start = nursery_top.fetch_add(config.tlab_size);
+    if (start + config.tlab_size > nursery_end) {
+        tlab.cur = tlab.end = nullptr;
+        return nullptr;
+    }
+    tlab.cur = start;
+    tlab.end = start + config.tlab_size;
+    return alloc(tlab, size, num_refs, kind);
+}
+
+Obj *Heap::alloc_old(size_t size, uint16_t num_refs, uint8_t kind) {
+    size = std::max<size_t>((size + 7) & ~size_t(7), sizeof(Obj) + sizeof(Obj*));
+    if (old_bytes + size > config.max_heap_size) {
+        out_of_memory();
+    }
+    Obj *obj = static_cast<Obj*>(std::malloc(size));
+    if (obj == nullptr) {
+        out_of_memory();
+    }
+    init(obj, size, num_refs, kind, OBJ_OLD);
+    old_objects.push_back(obj);
+    old_bytes += size;
+    return obj;
+}
+
+size_t Heap::nursery_used() const {
+    return std::min(nursery_top.load(), nursery_end) - nursery;
+}
+
+// Copies a nursery object into the old generation, once: the nursery copy
+// is left as a forwarding pointer.
+Obj *Heap::promote(Obj *obj, std::vector<Obj*>& worklist) {
+    if (!is_pointer(obj) || !in_nursery(obj)) {
+        return obj;
+    }
+    if (obj->flags & OBJ_FORWARDED) {
+        return obj->refs()[0];
+    }
+    if (old_bytes + obj->size > config.max_heap_size) {
+        out_of_memory();
+    }
+    Obj *copy = static_cast<Obj*>(std::malloc(obj->size));
+    if (copy == nullptr) {
+        out_of_memory();
+    }
+    std::memcpy(copy, obj, obj->size);
+    copy->flags = OBJ_OLD;
+    old_objects.push_back(copy);
+    old_bytes += copy->size;
+    stats.promoted_bytes += copy->size;
+    obj->flags |= OBJ_FORWARDED;
+    obj->refs()[0] = copy;
+    worklist.push_back(copy);
+    return copy;
+}
+
+void Heap::mark(std::vector<Obj*>& worklist) {
+    while (!worklist.empty()) {
+        Obj *obj = worklist.back();
+        worklist.pop_back();
+        for (uint16_t i = 0; i < obj->num_refs; i++) {
+            Obj *ref = obj->refs()[i];
+            if (is_pointer(ref) && !(ref->flags & (OBJ_MARKED | OBJ_STATIC))) {
+                ref->flags |= OBJ_MARKED;
+                worklist.push_back(ref);
+            }
+        }
+    }
+}
+
+void Heap::sweep() {
+    size_t live = 0;
+    for (Obj *obj : old_objects) {
+        if (obj->flags & OBJ_MARKED) {
+            obj->flags &= ~OBJ_MARKED;
+            old_objects[live++] = obj;
+        }
+        else {
+            old_bytes -= obj->size;
+            stats.freed_bytes += obj->size;
+            std::free(obj);
+        }
+    }
+    old_objects.resize(live);
+}
+
+void Heap::collect(const std::vector<Obj**>& roots, bool major) {
+    uint64_t start = now_ns();
+    uint64_t promoted_before = stats.promoted_bytes;
+
+    // Minor: promote everything reachable from the roots and from old
+    // objects that were written to since the last collection
+    std::vector<Obj*> worklist;
+    for (Obj **root : roots) {
+        *root = promote(*root, worklist);
+    }
+    for (Obj *obj : remembered) {
+        obj->flags &= ~OBJ_REMEMBERED;
+        worklist.push_back(obj);
+    }
+    remembered.clear();
+    while (!worklist.empty()) {
+        Obj *obj = worklist.back();
+        worklist.pop_back();
+        for (uint16_t i = 0; i < obj->num_refs; i++) {
+            obj->refs()[i] = promote(obj->refs()[i], worklist);
+        }
+    }
+    stats.freed_bytes += nursery_used() - std::min<uint64_t>(nursery_used(), stats.promoted_bytes - promoted_before);
+    nursery_top = nursery;
+    for (TLAB *tlab : tlabs) {
+        tlab->cur = tlab->end = nullptr;
+    }
+    uint64_t minor_end = now_ns();
+    stats.minor_count++;
+    stats.minor_pause_ns += minor_end - start;
+    stats.max_minor_pause_ns = std::max(stats.max_minor_pause_ns, minor_end - start);
+
+    if (!major && old_bytes < next_major) {
+        return;
+    }
+
+    // Major: mark from the roots, which all point to old objects by now
+    for (Obj **root : roots) {
+        if (is_pointer(*root) && !((*root)->flags & (OBJ_MARKED | OBJ_STATIC))) {
+            (*root)->flags |= OBJ_MARKED;
+            worklist.push_back(*root);
+        }
+    }
+    mark(worklist);
+    for (WeakRefs *refs : weak_refs) {
+        refs->sweep(*this);
+    }
+    sweep();
+    next_major = std::min(std::max(config.old_size, old_bytes * 2), config.max_heap_size);
+    uint64_t major_end = now_ns();
+    stats.major_count++;
+    stats.major_pause_ns += major_end - minor_end;
+    stats.max_major_pause_ns = std::max(stats.max_major_pause_ns, major_end - minor_end);
+}
+
+void Heap::print_stats(std::ostream& out) const {
+    auto us = [](uint64_t ns) { return ns / 1000.0; };
+    out << "minor collections: " << stats.minor_count << ", total " << us(stats.minor_pause_ns) << " us, max " << us(stats.max_minor_pause_ns) << " us\n";
+    out << "major collections: " << stats.major_count << ", total " << us(stats.major_pause_ns) << " us, max " << us(stats.max_major_pause_ns) << " us\n";
+    out << "promoted " << stats.promoted_bytes << " bytes, freed " << stats.freed_bytes << " bytes, old generation " << old_bytes << " bytes\n";
+}
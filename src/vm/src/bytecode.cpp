@@ -0,0 +1,219 @@
+#include "../include/bytecode.h"
+#include "../include/opcodes.h"
+#include "../include/verifier.h"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(sizeof(BytecodeHeader) % alignof(StackSlot) == 0, "constants must stay aligned after the header");
+
+Chunk::~Chunk() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+// FNV-1a
+uint64_t bytecode::hash(std::string_view data, uint64_t seed) {
+    uint64_t h = seed;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+SourceKey bytecode::key(std::string_view data, SourceKey seed) {
+    uint64_t size = data.size();
+    seed.check = hash(std::string_view(reinterpret_cast<const char*>(&size), sizeof(size)), seed.check);
+    return {hash(data, seed.hash), hash(data, seed.check)};
+}
+
+bool bytecode::is_bytecode(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    return file && memcmp(magic, BytecodeHeader::MAGIC, sizeof(magic)) == 0;
+}
+
+bool bytecode::save(const Chunk& chunk, const std::string& path, SourceKey source) {
+    BytecodeHeader header{};
+    memcpy(header.magic, BytecodeHeader::MAGIC, sizeof(header.magic));
+    header.version = BytecodeHeader::VERSION;
+    header.kind = chunk.kind;
+    header.endian_tag = BytecodeHeader::ENDIAN_TAG;
+    header.num_globals = chunk.num_globals;
+    header.num_temps = chunk.num_temps;
+    header.num_locals = chunk.num_locals;
+    header.max_stack = chunk.max_stack;
+    header.source_hash = source.hash;
+    header.source_check = source.check;
+    header.const_offset = sizeof(BytecodeHeader);
+    header.const_count = chunk.const_count();
+    header.func_offset = header.const_offset + header.const_count * sizeof(StackSlot);
+    header.func_count = chunk.func_count();
+    header.ref_map_offset = header.func_offset + header.func_count * sizeof(Function);
+    header.ref_map_size = chunk.ref_size();
+    header.strings_offset = (header.ref_map_offset + header.ref_map_size + 7) & ~uint64_t(7);
+    header.strings_size = chunk.str_size();
+    header.code_offset = header.strings_offset + header.strings_size;
+    header.code_size = chunk.code_size();
+    header.symbols_offset = header.code_offset + header.code_size;
+    header.symbols_size = chunk.sym_size();
+
+    // Write to a temporary and rename so that concurrent readers never see a
+    // partially written file. Threads of one process may save the same path.
+    static std::atomic<uint32_t> seq{0};
+    std::string tmp = path + ".tmp" + std::to_string(getpid()) + "." + std::to_string(seq++);
+    {
+        std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(chunk.const_data()), header.const_count * sizeof(StackSlot));
+        file.write(reinterpret_cast<const char*>(chunk.func_data()), header.func_count * sizeof(Function));
+        file.write(reinterpret_cast<const char*>(chunk.ref_data()), header.ref_map_size);
+        static const char padding[8] = {};
+        file.write(padding, header.strings_offset - header.ref_map_offset - header.ref_map_size);
+        file.write(reinterpret_cast<const char*>(chunk.str_data()), header.strings_size);
+        file.write(reinterpret_cast<const char*>(chunk.code_data()), header.code_size);
+        file.write(reinterpret_cast<const char*>(chunk.sym_data()), header.symbols_size);
+        if (!file) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+Chunk *bytecode::load(const std::string& path, SourceKey *source, bool verify) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BytecodeHeader)) {
+        close(fd);
+        return nullptr;
+    }
+    size_t size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto base = static_cast<const uint8_t*>(mapping);
+    auto header = reinterpret_cast<const BytecodeHeader*>(base);
+    uint8_t halt = header->kind == CHUNK_REG ? (uint8_t)ROP_HALT : (uint8_t)OP_HALT;
+    if (memcmp(header->magic, BytecodeHeader::MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BytecodeHeader::VERSION ||
+        header->endian_tag != BytecodeHeader::ENDIAN_TAG ||
+        header->kind > CHUNK_REG ||
+        header->const_offset % alignof(StackSlot) != 0 ||
+        header->const_offset > size || header->const_count > (size - header->const_offset) / sizeof(StackSlot) ||
+        header->func_offset % alignof(Function) != 0 ||
+        header->func_offset > size || header->func_count > (size - header->func_offset) / sizeof(Function) ||
+        header->ref_map_offset > size || header->ref_map_size > size - header->ref_map_offset ||
+        (header->kind == CHUNK_STACK && header->ref_map_size < header->num_globals) ||
+        header->strings_offset % 8 != 0 ||
+        header->strings_offset > size || header->strings_size > size - header->strings_offset ||
+        !str::valid_pool(base + header->strings_offset, header->strings_size) ||
+        header->code_offset > size || header->code_size > size - header->code_offset ||
+        header->code_size == 0 || base[header->code_offset + header->code_size - 1] != halt ||
+        header->symbols_offset > size || header->symbols_size > size - header->symbols_offset) {
+        munmap(mapping, size);
+        return nullptr;
+    }
+
+    auto functions = reinterpret_cast<const Function*>(base + header->func_offset);
+    for (size_t i = 0; i < header->func_count; i++) {
+        if (functions[i].entry >= header->code_size || functions[i].arity > functions[i].num_slots ||
+            functions[i].param_refs > header->ref_map_size || functions[i].arity > header->ref_map_size - functions[i].param_refs) {
+            munmap(mapping, size);
+            return nullptr;
+        }
+    }
+
+    Chunk *chunk = new Chunk();
+    chunk->kind = static_cast<ChunkKind>(header->kind);
+    chunk->num_globals = header->num_globals;
+    chunk->num_temps = header->num_temps;
+    chunk->num_locals = header->num_locals;
+    chunk->mapping = mapping;
+    chunk->mapping_size = size;
+    chunk->mapped_constants = reinterpret_cast<const StackSlot*>(base + header->const_offset);
+    chunk->mapped_const_count = header->const_count;
+    chunk->mapped_functions = functions;
+    chunk->mapped_func_count = header->func_count;
+    chunk->mapped_ref_map = base + header->ref_map_offset;
+    chunk->mapped_ref_map_size = header->ref_map_size;
+    chunk->mapped_strings = base + header->strings_offset;
+    chunk->mapped_strings_size = header->strings_size;
+    chunk->mapped_code = base + header->code_offset;
+    chunk->mapped_code_size = header->code_size;
+    chunk->mapped_symbols = base + header->symbols_offset;
+    chunk->mapped_symbols_size = header->symbols_size;
+    if (verify && (!verifier::verify(*chunk) || chunk->max_stack != header->max_stack)) {
+        delete chunk;
+        return nullptr;
+    }
+    if (source != nullptr) {
+        *source = {header->source_hash, header->source_check};
+    }
+    return chunk;
+}
+
+std::string bytecode::cache_path(uint64_t source_hash) {
+    std::string dir;
+    if (const char *env = getenv("PSHARP_CACHE_DIR")) {
+        dir = env;
+    }
+    else if (const char *env = getenv("XDG_CACHE_HOME")) {
+        dir = std::string(env) + "/psharp";
+    }
+    else if (const char *env = getenv("HOME")) {
+        dir = std::string(env) + "/.cache/psharp";
+    }
+    else {
+        return "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.psbc", (unsigned long long)source_hash);
+    return dir + name;
+}
+
+Chunk *bytecode::load_cached(SourceKey source) {
+    std::string path = cache_path(source.hash);
+    if (path.empty()) {
+        return nullptr;
+    }
+    SourceKey stored;
+    Chunk *chunk = load(path, &stored);
+    if (chunk != nullptr && stored != source) {
+        delete chunk;
+        return nullptr;
+    }
+    return chunk;
+}
+
+void bytecode::store_cached(const Chunk& chunk, SourceKey source) {
+    std::string path = cache_path(source.hash);
+    if (path.empty()) {
+        return;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+    save(chunk, path, source);
+}
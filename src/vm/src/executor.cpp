@@ -0,0 +1,94 @@
+#include "../include/executor.h"
+#include <algorithm>
+
+// The pool and worker the current thread belongs to, if any
+static thread_local const Executor *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+Executor::Executor(size_t count) {
+    if (count == 0) {
+        count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < count; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < count; i++) {
+        threads.emplace_back(&Executor::run, this, i);
+    }
+}
+
+Executor::~Executor() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void Executor::submit(Task task) {
+    size_t index = current_pool == this ? current_worker : next++ % workers.size();
+    pending++;
+    {
+        std::lock_guard<std::mutex> guard(workers[index]->lock);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queued++;
+    }
+    work_ready.notify_one();
+}
+
+void Executor::wait() {
+    std::unique_lock<std::mutex> guard(lock);
+    all_done.wait(guard, [&] { return pending == 0; });
+}
+
+// Own deque from the back, then the others' from the front, starting with
+// the next worker so thieves spread out
+bool Executor::take(size_t index, Task& task) {
+    for (size_t i = 0; i < workers.size(); i++) {
+        Worker& worker = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        }
+        else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void Executor::run(size_t index) {
+    current_pool = this;
+    current_worker = index;
+    Task task;
+    for (;;) {
+        if (take(index, task)) {
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> guard(lock);
+                all_done.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(lock);
+        work_ready.wait(guard, [&] { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
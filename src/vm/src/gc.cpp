@@ -0,0 +1,157 @@
+#include "../include/opcodes.h"
+#include "../include/vm.h"
+#include <algorithm>
+#include <iostream>
+
+// The order of Chunk::safepoints
+static bool before(const SafePoint& a, const SafePoint& b) {
+    return a.func != b.func ? a.func < b.func : a.pos < b.pos;
+}
+
+// Replays one block from its entry to the instruction that leaves it,
+// tracking which slots and operands hold heap references, and records them
+// at every OP_SCAT and OP_CALL. Chunks have no jumps, so each instruction is
+// reached with exactly one such state; a collection then looks the roots up
+// instead of replaying what every frame has run so far.
+void map_safepoints(Chunk& chunk, uint32_t func, size_t entry) {
+    const uint8_t *code = chunk.code_data();
+    const uint8_t *refs = chunk.ref_data();
+    const Function *functions = chunk.func_data();
+    size_t pos = entry;
+    std::vector<uint8_t> slots(chunk.num_locals, 0);
+    if (func != UINT32_MAX) {
+        const Function& fn = functions[func];
+        pos = fn.entry;
+        slots.assign(fn.num_slots, 0);
+        std::copy(refs + fn.param_refs, refs + fn.param_refs + fn.arity, slots.begin());
+    }
+    std::vector<uint8_t> operands;
+    std::vector<SafePoint> points;
+    auto record = [&](size_t live_operands) {
+        SafePoint point{func, (uint32_t)pos, (uint32_t)chunk.safepoint_roots.size(), 0};
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (slots[i]) {
+                chunk.safepoint_roots.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < live_operands; i++) {
+            if (operands[i]) {
+                chunk.safepoint_roots.push_back(slots.size() + 1 + i);
+            }
+        }
+        point.num_roots = chunk.safepoint_roots.size() - point.roots;
+        points.push_back(point);
+    };
+
+    for (bool done = false; !done && pos < chunk.code_size(); pos += op_size(code[pos])) {
+        uint8_t op = code[pos];
+        switch (op) {
+            case OP_PCONST:
+            case OP_IADD_GG:
+                operands.push_back(0);
+                break;
+            case OP_PSTR:
+                operands.push_back(1);
+                break;
+            case OP_SCAT:
+                record(operands.size());
+                operands.pop_back();
+                operands.back() = 1;
+                break;
+            case OP_IADD: case OP_FADD: case OP_ISUB: case OP_FSUB:
+            case OP_IMUL: case OP_FMUL: case OP_IDIV: case OP_FDIV:
+            case OP_IREM: case OP_FREM:
+            case OP_SEQ: case OP_SNE:
+                operands.pop_back();
+                operands.back() = 0;
+                break;
+            case OP_UIMINUS: case OP_UFMINUS: case OP_UNOT: case OP_ITOF:
+            case OP_ISHLK: case OP_IREMP2:
+            case OP_IADDK: case OP_ISUBK: case OP_IMULK:
+            case OP_FADDK: case OP_FSUBK: case OP_FMULK:
+                operands.back() = 0;
+                break;
+            case OP_PRINTI: case OP_PRINTF: case OP_PRINTO:
+            case OP_STGLOB:
+                operands.pop_back();
+                break;
+            case OP_LDGLOB:
+                operands.push_back(refs[read_operand(code + pos + 1)]);
+                break;
+            case OP_LDLOC:
+                operands.push_back(slots[code[pos + 1]]);
+                break;
+            case OP_LDLOC0: case OP_LDLOC1: case OP_LDLOC2: case OP_LDLOC3:
+                operands.push_back(slots[op - OP_LDLOC0]);
+                break;
+            case OP_STLOC:
+                slots[code[pos + 1]] = operands.back();
+                operands.pop_back();
+                break;
+            case OP_STLOC0: case OP_STLOC1: case OP_STLOC2: case OP_STLOC3:
+                slots[op - OP_STLOC0] = operands.back();
+                operands.pop_back();
+                break;
+            case OP_CALL: {
+                const Function& fn = functions[read_operand(code + pos + 1)];
+                record(operands.size() - fn.arity);
+                operands.resize(operands.size() - fn.arity);
+                operands.push_back(fn.ret_ref);
+                break;
+            }
+            case OP_NCALL:
+                operands.resize(operands.size() - code[pos + 4]);
+                operands.push_back(0);
+                break;
+            case OP_RET: case OP_TAILCALL: case OP_HALT:
+                done = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (!points.empty()) {
+        auto at = std::lower_bound(chunk.safepoints.begin(), chunk.safepoints.end(), points[0], before);
+        chunk.safepoints.insert(at, points.begin(), points.end());
+    }
+}
+
+// Roots are the reference globals and, frame by frame, the slots the frame's
+// safepoint lists: a caller stopped at its CALL, the running frame at the
+// instruction that allocates.
+void VM::collect_garbage(bool major) {
+    std::vector<Obj**> roots;
+    if (chunk->kind == CHUNK_STACK) {
+        const uint8_t *code = chunk->code_data();
+        const uint8_t *refs = chunk->ref_data();
+        for (uint32_t i = 0; i < chunk->num_globals; i++) {
+            if (refs[i]) {
+                roots.push_back(&global_vars[i].objval);
+            }
+        }
+        for (Frame *f = frames; f <= frame; f++) {
+            const uint8_t *at = f < frame ? f[1].ret_ip - op_size(OP_CALL) : ip;
+            SafePoint key{f->func, (uint32_t)(at - code), 0, 0};
+            auto point = std::lower_bound(chunk->safepoints.begin(), chunk->safepoints.end(), key, before);
+            if (point == chunk->safepoints.end() || point->func != key.func || point->pos != key.pos) {
+                std::cerr << "\033[31mRuntime error: No stack map for code offset " << key.pos << "\033[0m\n";
+                exit(1);
+            }
+            const uint32_t *slot = chunk->safepoint_roots.data() + point->roots;
+            for (uint32_t i = 0; i < point->num_roots; i++) {
+                roots.push_back(&f->bp[slot[i]].objval);
+            }
+        }
+    }
+    heap.collect(roots, major);
+}
+
+Obj *VM::alloc(size_t size, uint16_t num_refs, uint8_t kind) {
+    Obj *obj = heap.alloc(tlab, size, num_refs, kind);
+    if (obj == nullptr) [[unlikely]] {
+        collect_garbage();
+        obj = heap.alloc(tlab, size, num_refs, kind);
+    }
+    return obj;
+}
@@ -0,0 +1,581 @@
+#include "../include/jit.h"
+#include "../include/opcodes.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define PSHARP_JIT
+#endif
+
+JitCode::~JitCode() {
+#ifdef PSHARP_JIT
+    if (mem != nullptr) {
+        munmap(mem, size);
+    }
+#endif
+}
+
+#ifndef PSHARP_JIT
+
+bool jit::available() {
+    return false;
+}
+
+JitCode *jit::compile(const Chunk&) {
+    return nullptr;
+}
+
+#else
+
+bool jit::available() {
+    return true;
+}
+
+namespace {
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// The few x86-64 encodings the translator needs. Memory operands are always
+// [base + disp32].
+class Assembler {
+public:
+    std::vector<uint8_t> buf;
+
+    size_t pos() const { return buf.size(); }
+    void byte(uint8_t b) { buf.push_back(b); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) byte(v >> (8 * i)); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) byte(v >> (8 * i)); }
+
+    void rex(bool w, uint8_t reg, uint8_t rm) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+        if (r != 0x40) {
+            byte(r);
+        }
+    }
+    void modrm(uint8_t reg, uint8_t rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+    void modrm_mem(uint8_t reg, Reg base, int32_t disp) {
+        byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        if ((base & 7) == RSP) {
+            byte(0x24);
+        }
+        u32(disp);
+    }
+
+    // `op` is the r/m64, r64 form: 0x01 add, 0x21 and, 0x29 sub, 0x31 xor, 0x85 test, 0x89 mov
+    void alu(uint8_t op, Reg dst, Reg src) { rex(true, src, dst); byte(op); modrm(src, dst); }
+    // `ext` selects the 0x81 group: 0 add, 4 and, 5 sub, 7 cmp
+    void alu_imm(uint8_t ext, Reg dst, int32_t imm) { rex(true, 0, dst); byte(0x81); modrm(ext, dst); u32(imm); }
+    // `ext` selects the 0xF7 group: 3 neg, 7 idiv
+    void unary(uint8_t ext, Reg r) { rex(true, 0, r); byte(0xF7); modrm(ext, r); }
+    void imul(Reg dst, Reg src) { rex(true, dst, src); byte(0x0F); byte(0xAF); modrm(dst, src); }
+    void imul_imm(Reg dst, int32_t imm) { rex(true, dst, dst); byte(0x69); modrm(dst, dst); u32(imm); }
+    void cqo() { byte(0x48); byte(0x99); }
+    // `ext` selects the 0xC1 group: 4 shl, 5 shr, 7 sar
+    void shift_imm(uint8_t ext, Reg r, uint8_t n) { rex(true, 0, r); byte(0xC1); modrm(ext, r); byte(n); }
+
+    void mov(Reg dst, Reg src) {
+        if (dst != src) {
+            alu(0x89, dst, src);
+        }
+    }
+    void mov_imm(Reg dst, uint64_t imm) {
+        if (imm == 0) {
+            rex(false, dst, dst);
+            byte(0x31);
+            modrm(dst, dst);
+        }
+        else if ((int64_t)imm == (int32_t)imm) {
+            rex(true, 0, dst);
+            byte(0xC7);
+            modrm(0, dst);
+            u32(imm);
+        }
+        else {
+            rex(true, 0, dst);
+            byte(0xB8 | (dst & 7));
+            u64(imm);
+        }
+    }
+    void load(Reg dst, Reg base, int32_t disp) { rex(true, dst, base); byte(0x8B); modrm_mem(dst, base, disp); }
+    void store(Reg base, int32_t disp, Reg src) { rex(true, src, base); byte(0x89); modrm_mem(src, base, disp); }
+    void lea(Reg dst, Reg base, int32_t disp) { rex(true, dst, base); byte(0x8D); modrm_mem(dst, base, disp); }
+    void cmp_mem(Reg r, Reg base, int32_t disp) { rex(true, r, base); byte(0x3B); modrm_mem(r, base, disp); }
+
+    // Scalar doubles in xmm0-xmm7; `op` is 0x58 add, 0x5C sub, 0x59 mul, 0x5E div
+    void movq_to_xmm(uint8_t xmm, Reg src) { byte(0x66); rex(true, xmm, src); byte(0x0F); byte(0x6E); modrm(xmm, src); }
+    void movq_from_xmm(Reg dst, uint8_t xmm) { byte(0x66); rex(true, xmm, dst); byte(0x0F); byte(0x7E); modrm(xmm, dst); }
+    void sse(uint8_t op, uint8_t dst, uint8_t src) { byte(0xF2); byte(0x0F); byte(op); modrm(dst, src); }
+    void cvtsi2sd(uint8_t xmm, Reg src) { byte(0xF2); rex(true, xmm, src); byte(0x0F); byte(0x2A); modrm(xmm, src); }
+
+    // eax = (r == 0)
+    void is_zero(Reg r) {
+        alu(0x85, r, r);
+        byte(0x0F); byte(0x94); byte(0xC0);     // sete al
+        byte(0x0F); byte(0xB6); byte(0xC0);     // movzx eax, al
+    }
+
+    void push(Reg r) { rex(false, 0, r); byte(0x50 | (r & 7)); }
+    void pop(Reg r) { rex(false, 0, r); byte(0x58 | (r & 7)); }
+    void ret() { byte(0xC3); }
+    void ud2() { byte(0x0F); byte(0x0B); }
+    void call_abs(const void *fn) { mov_imm(RAX, reinterpret_cast<uint64_t>(fn)); byte(0xFF); byte(0xD0); }
+
+    // Branches return the position of their displacement for patching
+    size_t call_rel() { byte(0xE8); u32(0); return pos() - 4; }
+    size_t jmp_rel() { byte(0xE9); u32(0); return pos() - 4; }
+    size_t jcc_short(uint8_t cc) { byte(0x70 | cc); byte(0); return pos() - 1; }
+    void patch_rel32(size_t at, size_t target) {
+        int32_t rel = (int32_t)(target - (at + 4));
+        memcpy(buf.data() + at, &rel, 4);
+    }
+    void patch_rel8(size_t at, size_t target) { buf[at] = (uint8_t)(target - (at + 1)); }
+    void patch_u32(size_t at, uint32_t v) { memcpy(buf.data() + at, &v, 4); }
+};
+
+constexpr uint8_t CC_B = 0x2;
+constexpr uint8_t CC_BE = 0x6;
+
+void jit_error(const char *msg) {
+    std::cerr << "\033[31mRuntime error: " << msg << "\033[0m\n";
+    exit(1);
+}
+
+void jit_print_int(int64_t v, const JitContext *ctx) {
+    ctx->output->print_int(v);
+}
+
+void jit_print_float(double v, const JitContext *ctx) {
+    ctx->output->print_float(v);
+}
+
+double jit_fmod(double a, double b) {
+    return std::fmod(a, b);
+}
+
+// Register use:
+//     rbx      call depth
+//     r12      bp of the running frame, laid out exactly as for the interpreter
+//     r13      globals
+//     r15      JitContext
+//     rax, rcx, rdx, xmm0, xmm1    scratch
+// Code between two jumps is straight-line, so the operand stack depth at
+// every instruction is known while translating. Operand i lives in
+// CACHED[i] when i < NUM_CACHED and in its interpreter home
+// bp[num_slots + 1 + i] otherwise. Cached operands are spilled to their
+// homes around calls. The native stack stays 16-byte aligned in every body.
+constexpr Reg CACHED[] = {RSI, RDI, R8, R9, R10, R11};
+constexpr uint32_t NUM_CACHED = sizeof(CACHED) / sizeof(*CACHED);
+
+class Translator {
+    const Chunk& chunk;
+    Assembler a;
+    std::vector<size_t> entries;                // per function, counts the call
+    std::vector<size_t> bodies;                 // per function, after the call depth check
+    std::vector<std::pair<size_t, uint32_t>> calls;
+    std::vector<std::pair<size_t, uint32_t>> tail_calls;
+    uint32_t num_slots = 0;
+    uint32_t depth = 0;
+    uint32_t max_depth = 0;
+
+    int32_t home(uint32_t i) const { return 8 * (num_slots + 1 + i); }
+
+    // The register holding operand i, loading it into `scratch` if needed
+    Reg operand(uint32_t i, Reg scratch) {
+        if (i < NUM_CACHED) {
+            return CACHED[i];
+        }
+        a.load(scratch, R12, home(i));
+        return scratch;
+    }
+    // Where a result for operand i should be computed
+    Reg target(uint32_t i) const { return i < NUM_CACHED ? CACHED[i] : RAX; }
+    void put(uint32_t i, Reg r) {
+        if (i < NUM_CACHED) {
+            a.mov(CACHED[i], r);
+        }
+        else {
+            a.store(R12, home(i), r);
+        }
+    }
+    void push_operand(Reg r) {
+        put(depth++, r);
+        max_depth = std::max(max_depth, depth);
+    }
+
+    void spill(uint32_t from, uint32_t to) {
+        for (uint32_t i = from; i < std::min(to, NUM_CACHED); i++) {
+            a.store(R12, home(i), CACHED[i]);
+        }
+    }
+    void reload(uint32_t from, uint32_t to) {
+        for (uint32_t i = from; i < std::min(to, NUM_CACHED); i++) {
+            a.load(CACHED[i], R12, home(i));
+        }
+    }
+
+    void error_unless(uint8_t cc, const char *msg) {
+        size_t skip = a.jcc_short(cc);
+        a.mov_imm(RDI, reinterpret_cast<uint64_t>(msg));
+        a.call_abs(reinterpret_cast<const void*>(jit_error));
+        a.patch_rel8(skip, a.pos());
+    }
+
+    // Frame size check; the displacement is patched once the body's
+    // maximum operand depth is known
+    size_t stack_check() {
+        a.lea(RAX, R12, 0);
+        size_t disp = a.pos() - 4;
+        a.cmp_mem(RAX, R15, offsetof(JitContext, stack_end));
+        error_unless(CC_BE, "Stack overflow");
+        return disp;
+    }
+
+    void int_binary(uint8_t op) {
+        Reg b = operand(depth - 1, RCX);
+        Reg t = operand(depth - 2, RAX);
+        if (op == OP_IMUL) {
+            a.imul(t, b);
+        }
+        else {
+            a.alu(op == OP_IADD ? 0x01 : 0x29, t, b);
+        }
+        put(depth - 2, t);
+        depth--;
+    }
+
+    void int_divide(bool rem) {
+        a.mov(RAX, operand(depth - 2, RAX));
+        Reg b = operand(depth - 1, RCX);
+        a.cqo();
+        a.unary(7, b);
+        put(depth - 2, rem ? RDX : RAX);
+        depth--;
+    }
+
+    void float_binary(uint8_t sse_op) {
+        a.movq_to_xmm(0, operand(depth - 2, RAX));
+        a.movq_to_xmm(1, operand(depth - 1, RCX));
+        a.sse(sse_op, 0, 1);
+        a.movq_from_xmm(target(depth - 2), 0);
+        put(depth - 2, target(depth - 2));
+        depth--;
+    }
+
+    void int_constant(uint8_t op, int64_t k) {
+        Reg t = operand(depth - 1, RAX);
+        if (k == (int32_t)k) {
+            if (op == OP_IMULK) {
+                a.imul_imm(t, (int32_t)k);
+            }
+            else {
+                a.alu_imm(op == OP_IADDK ? 0 : 5, t, (int32_t)k);
+            }
+        }
+        else {
+            a.mov_imm(RCX, k);
+            if (op == OP_IMULK) {
+                a.imul(t, RCX);
+            }
+            else {
+                a.alu(op == OP_IADDK ? 0x01 : 0x29, t, RCX);
+            }
+        }
+        put(depth - 1, t);
+    }
+
+    void float_constant(uint8_t sse_op, int64_t bits) {
+        a.movq_to_xmm(0, operand(depth - 1, RAX));
+        a.mov_imm(RCX, bits);
+        a.movq_to_xmm(1, RCX);
+        a.sse(sse_op, 0, 1);
+        a.movq_from_xmm(target(depth - 1), 0);
+        put(depth - 1, target(depth - 1));
+    }
+
+    bool translate(size_t start, bool top_level);
+
+public:
+    // Most instructions translate to well under 16 bytes
+    Translator(const Chunk& c) : chunk(c) { a.buf.reserve(16 * c.code_size() + 64); }
+
+    bool run();
+    std::vector<uint8_t>& code() { return a.buf; }
+};
+
+// Translates the block at `start` up to the instruction that leaves it. The
+// verifier walks blocks the same way and accepts function bodies in any
+// order, so the next function's entry says nothing about where this one ends.
+bool Translator::translate(size_t start, bool top_level) {
+    const uint8_t *code = chunk.code_data();
+    const StackSlot *constants = chunk.const_data();
+    const Function *functions = chunk.func_data();
+    for (size_t pos = start; pos < chunk.code_size(); pos += op_size(code[pos])) {
+        uint8_t op = code[pos];
+        const uint8_t *operands = code + pos + 1;
+        switch (op) {
+            case OP_PCONST:
+                a.mov_imm(target(depth), constants[read_operand(operands)].ival);
+                push_operand(target(depth));
+                break;
+            case OP_LDGLOB:
+                a.load(target(depth), R13, 8 * read_operand(operands));
+                push_operand(target(depth));
+                break;
+            case OP_STGLOB:
+                a.store(R13, 8 * read_operand(operands), operand(depth - 1, RAX));
+                depth--;
+                break;
+            case OP_LDLOC:
+            case OP_LDLOC0: case OP_LDLOC1: case OP_LDLOC2: case OP_LDLOC3: {
+                uint32_t slot = op == OP_LDLOC ? operands[0] : op - OP_LDLOC0;
+                a.load(target(depth), R12, 8 * slot);
+                push_operand(target(depth));
+                break;
+            }
+            case OP_STLOC:
+            case OP_STLOC0: case OP_STLOC1: case OP_STLOC2: case OP_STLOC3: {
+                uint32_t slot = op == OP_STLOC ? operands[0] : op - OP_STLOC0;
+                a.store(R12, 8 * slot, operand(depth - 1, RAX));
+                depth--;
+                break;
+            }
+            case OP_IADD: case OP_ISUB: case OP_IMUL:
+                int_binary(op);
+                break;
+            case OP_IDIV:
+            case OP_IREM:
+                int_divide(op == OP_IREM);
+                break;
+            case OP_FADD: float_binary(0x58); break;
+            case OP_FSUB: float_binary(0x5C); break;
+            case OP_FMUL: float_binary(0x59); break;
+            case OP_FDIV: float_binary(0x5E); break;
+            case OP_FREM:
+                spill(0, depth - 2);
+                a.movq_to_xmm(0, operand(depth - 2, RAX));
+                a.movq_to_xmm(1, operand(depth - 1, RCX));
+                a.call_abs(reinterpret_cast<const void*>(jit_fmod));
+                a.movq_from_xmm(RAX, 0);
+                reload(0, depth - 2);
+                put(depth - 2, RAX);
+                depth--;
+                break;
+            case OP_UIMINUS: {
+                Reg t = operand(depth - 1, RAX);
+                a.unary(3, t);
+                put(depth - 1, t);
+                break;
+            }
+            case OP_UFMINUS: {
+                Reg t = operand(depth - 1, RAX);
+                a.mov_imm(RCX, 0x8000000000000000ull);
+                a.alu(0x31, t, RCX);
+                put(depth - 1, t);
+                break;
+            }
+            case OP_UNOT:
+                a.is_zero(operand(depth - 1, RAX));
+                put(depth - 1, RAX);
+                break;
+            case OP_ITOF:
+                a.cvtsi2sd(0, operand(depth - 1, RAX));
+                a.movq_from_xmm(target(depth - 1), 0);
+                put(depth - 1, target(depth - 1));
+                break;
+            case OP_PRINTI:
+            case OP_PRINTF: {
+                spill(0, depth - 1);
+                Reg v = operand(depth - 1, RAX);
+                if (op == OP_PRINTI) {
+                    a.mov(RDI, v);
+                    a.mov(RSI, R15);
+                    a.call_abs(reinterpret_cast<const void*>(jit_print_int));
+                }
+                else {
+                    a.movq_to_xmm(0, v);
+                    a.mov(RDI, R15);
+                    a.call_abs(reinterpret_cast<const void*>(jit_print_float));
+                }
+                reload(0, depth - 1);
+                depth--;
+                break;
+            }
+            // Arguments are spilled to their homes, which become the first
+            // slots of the callee's frame, as in the interpreter
+            case OP_CALL: {
+                uint32_t index = read_operand(operands);
+                uint32_t base = depth - functions[index].arity;
+                spill(0, depth);
+                a.push(R12);
+                a.lea(R12, R12, home(base));
+                calls.push_back({a.call_rel(), index});
+                a.pop(R12);
+                reload(0, base);
+                depth = base;
+                push_operand(RAX);
+                break;
+            }
+            case OP_TAILCALL: {
+                uint32_t index = read_operand(operands);
+                uint32_t arity = functions[index].arity;
+                for (uint32_t i = 0; i < arity; i++) {
+                    a.store(R12, 8 * i, operand(depth - arity + i, RAX));
+                }
+                tail_calls.push_back({a.jmp_rel(), index});
+                depth = 0;
+                break;
+            }
+            case OP_RET:
+                a.mov(RAX, operand(depth - 1, RAX));
+                a.alu_imm(5, RBX, 1);
+                a.ret();
+                depth = 0;
+                break;
+            case OP_HALT:
+                if (top_level) {
+                    a.pop(R15);
+                    a.pop(R14);
+                    a.pop(R13);
+                    a.pop(R12);
+                    a.pop(RBX);
+                    a.ret();
+                }
+                else {
+                    a.ud2();
+                }
+                depth = 0;
+                break;
+            case OP_IADD_GG: {
+                Reg t = target(depth);
+                a.load(t, R13, 8 * read_operand(operands));
+                a.load(RCX, R13, 8 * read_operand(operands + 3));
+                a.alu(0x01, t, RCX);
+                push_operand(t);
+                break;
+            }
+            case OP_IADDK: case OP_ISUBK: case OP_IMULK:
+                int_constant(op, constants[read_operand(operands)].ival);
+                break;
+            case OP_FADDK: float_constant(0x58, constants[read_operand(operands)].ival); break;
+            case OP_FSUBK: float_constant(0x5C, constants[read_operand(operands)].ival); break;
+            case OP_FMULK: float_constant(0x59, constants[read_operand(operands)].ival); break;
+            case OP_ISHLK: {
+                Reg t = operand(depth - 1, RAX);
+                a.shift_imm(4, t, operands[0]);
+                put(depth - 1, t);
+                break;
+            }
+            case OP_IREMP2: {
+                // rcx = 2^n - 1 for negative dividends, as in the interpreter
+                uint8_t n = operands[0];
+                int64_t mask = ((int64_t)1 << n) - 1;
+                Reg t = operand(depth - 1, RAX);
+                a.mov(RCX, t);
+                a.shift_imm(7, RCX, 63);
+                a.shift_imm(5, RCX, 64 - n);
+                a.alu(0x01, t, RCX);
+                if (mask == (int32_t)mask) {
+                    a.alu_imm(4, t, (int32_t)mask);
+                }
+                else {
+                    a.mov_imm(RDX, mask);
+                    a.alu(0x21, t, RDX);
+                }
+                a.alu(0x29, t, RCX);
+                put(depth - 1, t);
+                break;
+            }
+            case OP_STGLOBK:
+                a.mov_imm(RAX, constants[read_operand(operands)].ival);
+                a.store(R13, 8 * read_operand(operands + 3), RAX);
+                break;
+            default:
+                return false;
+        }
+        // Code after the instruction that leaves the block never runs, and
+        // its operands must not count toward the frame check: a verified
+        // chunk's stack is sized from the live code only
+        if (op == OP_RET || op == OP_TAILCALL || op == OP_HALT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Translator::run() {
+    const Function *functions = chunk.func_data();
+    size_t func_count = chunk.func_count();
+
+    // entry(bp, globals, ctx), called from C++
+    a.push(RBX);
+    a.push(R12);
+    a.push(R13);
+    a.push(R14);
+    a.push(R15);
+    a.mov(R12, RDI);
+    a.mov(R13, RSI);
+    a.mov(R15, RDX);
+    a.mov_imm(RBX, 0);
+    num_slots = chunk.num_locals;
+    depth = max_depth = 0;
+    size_t check = stack_check();
+    if (!translate(0, true)) {
+        return false;
+    }
+    a.patch_u32(check, 8 * (num_slots + 1 + max_depth));
+
+    for (size_t i = 0; i < func_count; i++) {
+        entries.push_back(a.pos());
+        a.alu_imm(0, RBX, 1);
+        a.cmp_mem(RBX, R15, offsetof(JitContext, frame_count));
+        error_unless(CC_B, "Call stack overflow");
+        bodies.push_back(a.pos());
+        num_slots = functions[i].num_slots;
+        depth = max_depth = 0;
+        check = stack_check();
+        if (!translate(functions[i].entry, false)) {
+            return false;
+        }
+        a.patch_u32(check, 8 * (num_slots + 1 + max_depth));
+    }
+    for (auto [at, index] : calls) {
+        a.patch_rel32(at, entries[index]);
+    }
+    for (auto [at, index] : tail_calls) {
+        a.patch_rel32(at, bodies[index]);
+    }
+    return true;
+}
+
+} // namespace
+
+JitCode *jit::compile(const Chunk& chunk) {
+    if (chunk.kind != CHUNK_STACK) {
+        return nullptr;
+    }
+    Translator translator(chunk);
+    if (!translator.run()) {
+        return nullptr;
+    }
+    std::vector<uint8_t>& code = translator.code();
+    size_t size = (code.size() + 4095) & ~size_t(4095);
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        return nullptr;
+    }
+    memcpy(mem, code.data(), code.size());
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return nullptr;
+    }
+    JitCode *jc = new JitCode();
+    jc->mem = mem;
+    jc->size = size;
+    jc->entry = reinterpret_cast<decltype(jc->entry)>(mem);
+    return jc;
+}
+
+#endif
@@ -0,0 +1,96 @@
+#include "../include/output.h"
+#include "../include/str.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <ostream>
+#include <unistd.h>
+#include <vector>
+
+// The innermost Scope's Output on the exiting thread
+static thread_local Output *current = nullptr;
+
+static void flush_current() {
+    if (current != nullptr) {
+        current->flush();
+    }
+}
+
+Output::Scope::Scope(Output& out) : prev(current) {
+    static bool registered = std::atexit(flush_current) == 0;
+    (void)registered;
+    current = &out;
+}
+
+Output::Scope::~Scope() {
+    current = prev;
+}
+
+Output::Output(const OutputConfig& config, int f) : buf(nullptr), cap(0), fd(f) {
+    configure(config);
+}
+
+Output::~Output() {
+    flush();
+    delete[] buf;
+}
+
+void Output::configure(const OutputConfig& config) {
+    flush();
+    delete[] buf;
+    cap = std::max(config.buffer_size, MAX_NUMBER);
+    buf = new char[cap];
+    line = config.policy == FLUSH_LINE || (config.policy == FLUSH_AUTO && isatty(fd));
+}
+
+void Output::attach(std::ostream *s) {
+    flush();
+    stream = s;
+}
+
+// Strings that do not fit the buffer are written on their own
+void Output::print_str(Obj *s) {
+    size_t n = str::length(s) + 1;
+    if (n > cap) {
+        flush();
+        std::vector<char> tmp(n);
+        str::copy(s, tmp.data());
+        tmp[n - 1] = '\n';
+        emit(tmp.data(), n);
+        return;
+    }
+    ensure(n);
+    str::copy(s, buf + len);
+    len += n - 1;
+    end_value();
+}
+
+void Output::flush() {
+    if (len > 0) {
+        emit(buf, len);
+        len = 0;
+    }
+}
+
+void Output::emit(const char *p, size_t left) {
+    if (stream != nullptr) {
+        stream->write(p, left);
+        return;
+    }
+    // Keeps the order of anything written through stdio before
+    if (fd == STDOUT_FILENO) {
+        fflush(stdout);
+    }
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        p += n;
+        left -= n;
+    }
+}
@@ -0,0 +1,67 @@
+#include "../include/opcodes.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+void Profiler::report(const Chunk& chunk, std::ostream& out, size_t top) const {
+    auto name = [&](uint8_t op) {
+        return chunk.kind == CHUNK_REG ? reg_op_name(op) : op_name(op);
+    };
+    uint64_t total_count = 0;
+    uint64_t total_time = 0;
+    std::vector<uint8_t> ops;
+    for (size_t op = 0; op < 256; op++) {
+        if (op_counts[op] != 0) {
+            ops.push_back(op);
+            total_count += op_counts[op];
+            total_time += op_time[op];
+        }
+    }
+    std::sort(ops.begin(), ops.end(), [&](uint8_t a, uint8_t b) {
+        return op_time[a] != op_time[b] ? op_time[a] > op_time[b] : op_counts[a] > op_counts[b];
+    });
+
+    out << std::fixed << std::setprecision(2);
+    out << "opcode        count        time    time%   time/op\n";
+    for (uint8_t op : ops) {
+        out << std::left << std::setw(10) << name(op) << std::right
+            << std::setw(9) << op_counts[op]
+            << std::setw(12) << op_time[op]
+            << std::setw(8) << (total_time ? 100.0 * op_time[op] / total_time : 0.0) << '%'
+            << std::setw(10) << (double)op_time[op] / op_counts[op] << '\n';
+    }
+    out << "total     " << std::setw(9) << total_count << std::setw(12) << total_time << '\n';
+
+    std::vector<size_t> addrs;
+    for (size_t pos = 0; pos < addr_counts.size(); pos++) {
+        if (addr_counts[pos] != 0) {
+            addrs.push_back(pos);
+        }
+    }
+    size_t n = std::min(top, addrs.size());
+    std::partial_sort(addrs.begin(), addrs.begin() + n, addrs.end(), [&](size_t a, size_t b) {
+        return addr_counts[a] > addr_counts[b];
+    });
+    out << "\nhottest addresses\n";
+    for (size_t i = 0; i < n; i++) {
+        out << std::setw(9) << addr_counts[addrs[i]] << "  ";
+        disassemble(chunk, addrs[i], out);
+    }
+
+    std::vector<uint32_t> pairs;
+    for (uint32_t pair = 0; pair < pair_counts.size(); pair++) {
+        if (pair_counts[pair] != 0) {
+            pairs.push_back(pair);
+        }
+    }
+    n = std::min(top, pairs.size());
+    std::partial_sort(pairs.begin(), pairs.begin() + n, pairs.end(), [&](uint32_t a, uint32_t b) {
+        return pair_counts[a] > pair_counts[b];
+    });
+    out << "\nopcode pairs\n";
+    for (size_t i = 0; i < n; i++) {
+        out << std::setw(9) << pair_counts[pairs[i]] << "  " << name(pairs[i] >> 8) << ' ' << name(pairs[i] & 0xFF) << '\n';
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,211 @@
+#include "../include/str.h"
+#include "../include/vm.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+uint32_t str::hash(const char *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return h;
+}
+
+// In-order walk with an explicit stack of pending right halves; rope depth
+// is bounded, so the stack is too.
+void str::copy(Obj *s, char *out) {
+    Obj *pending[MAX_DEPTH + 1];
+    size_t top = 0;
+    for (;;) {
+        if (is_inline(s)) {
+            for (size_t i = 0; i < inline_length(s); i++) {
+                *out++ = inline_char(s, i);
+            }
+        }
+        else if (s->kind == OBJ_STR) {
+            memcpy(out, chars(s), flat(s)->length);
+            out += flat(s)->length;
+        }
+        else if (rope(s)->depth == 0) {
+            s = s->refs()[0];
+            continue;
+        }
+        else {
+            pending[top++] = s->refs()[1];
+            s = s->refs()[0];
+            continue;
+        }
+        if (top == 0) {
+            return;
+        }
+        s = pending[--top];
+    }
+}
+
+uint32_t str::add_literal(std::vector<uint8_t>& pool, std::string_view text) {
+    uint32_t offset = pool.size();
+    size_t size = (flat_size(text.size()) + 7) & ~size_t(7);
+    pool.resize(offset + size);
+    Obj *s = reinterpret_cast<Obj*>(pool.data() + offset);
+    s->size = size;
+    s->num_refs = 0;
+    s->kind = OBJ_STR;
+    s->flags = OBJ_OLD | OBJ_STATIC | OBJ_INTERNED;
+    *flat(s) = {(uint32_t)text.size(), hash(text.data(), text.size())};
+    memcpy(chars(s), text.data(), text.size());
+    return offset;
+}
+
+// Short strings must never be pool records: they are immediates, and a
+// second representation would break pointer equality.
+bool str::valid_pool(const uint8_t *pool, size_t size) {
+    for (size_t pos = 0; pos < size;) {
+        if (size - pos < flat_size(0)) {
+            return false;
+        }
+        const Obj *s = reinterpret_cast<const Obj*>(pool + pos);
+        const Flat *f = reinterpret_cast<const Flat*>(s + 1);
+        if (s->kind != OBJ_STR || s->num_refs != 0 || s->flags != (OBJ_OLD | OBJ_STATIC | OBJ_INTERNED) ||
+            s->size % 8 != 0 || s->size > size - pos || f->length <= INLINE_MAX || flat_size(f->length) > s->size ||
+            f->hash != hash(reinterpret_cast<const char*>(f + 1), f->length)) {
+            return false;
+        }
+        pos += s->size;
+    }
+    return true;
+}
+
+StringTable::StringTable(Heap& h) : heap(h), table(64, nullptr) {
+    heap.add_weak(*this);
+}
+
+StringTable::~StringTable() {
+    heap.remove_weak(*this);
+}
+
+Obj **StringTable::find(const char *data, size_t len, uint32_t hash) {
+    size_t mask = table.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Obj *s = table[i];
+        if (s == nullptr || (str::flat(s)->hash == hash && str::flat(s)->length == len && memcmp(str::chars(s), data, len) == 0)) {
+            return &table[i];
+        }
+    }
+}
+
+void StringTable::insert(Obj *s) {
+    if ((count + 1) * 2 > table.size()) {
+        grow();
+    }
+    *find(str::chars(s), str::flat(s)->length, str::flat(s)->hash) = s;
+    count++;
+}
+
+void StringTable::grow() {
+    std::vector<Obj*> old(table.size() * 2, nullptr);
+    std::swap(table, old);
+    for (Obj *s : old) {
+        if (s != nullptr) {
+            *find(str::chars(s), str::flat(s)->length, str::flat(s)->hash) = s;
+        }
+    }
+}
+
+void StringTable::add_pool(const uint8_t *pool, size_t size) {
+    for (size_t pos = 0; pos < size;) {
+        Obj *s = reinterpret_cast<Obj*>(const_cast<uint8_t*>(pool + pos));
+        if (*find(str::chars(s), str::flat(s)->length, str::flat(s)->hash) == nullptr) {
+            insert(s);
+        }
+        pos += s->size;
+    }
+}
+
+Obj *StringTable::intern(const char *data, size_t len, uint32_t hash) {
+    if (len <= str::INLINE_MAX) {
+        return str::make_inline(data, len);
+    }
+    Obj **slot = find(data, len, hash);
+    if (*slot != nullptr) {
+        return *slot;
+    }
+    Obj *s = heap.alloc_old(str::flat_size(len), 0, OBJ_STR);
+    s->flags |= OBJ_INTERNED;
+    *str::flat(s) = {(uint32_t)len, hash};
+    memcpy(str::chars(s), data, len);
+    insert(s);
+    return s;
+}
+
+// A flattened rope remembers its canonical string, so comparing the same
+// rope again is a pointer compare.
+Obj *StringTable::canonical(Obj *s) {
+    if (str::is_inline(s) || (s->flags & OBJ_INTERNED)) {
+        return s;
+    }
+    if (s->kind == OBJ_STR) {
+        return intern(str::chars(s), str::flat(s)->length, str::flat(s)->hash);
+    }
+    if (str::rope(s)->depth == 0) {
+        return s->refs()[0];
+    }
+    buf.resize(str::rope(s)->length);
+    str::copy(s, buf.data());
+    Obj *c = intern(buf.data(), buf.size(), str::hash(buf.data(), buf.size()));
+    // `c` is old, so the stores need no write barrier
+    s->refs()[0] = c;
+    s->refs()[1] = nullptr;
+    str::rope(s)->depth = 0;
+    return c;
+}
+
+void StringTable::write(std::ostream& out, Obj *s) {
+    buf.resize(str::length(s));
+    str::copy(s, buf.data());
+    out.write(buf.data(), buf.size());
+}
+
+void StringTable::sweep(const Heap&) {
+    std::vector<Obj*> old(table.size(), nullptr);
+    std::swap(table, old);
+    count = 0;
+    for (Obj *s : old) {
+        if (s != nullptr && Heap::live(s)) {
+            insert(s);
+        }
+    }
+}
+
+// Short results are immediates and medium ones are copied; longer ones
+// become rope nodes unless the rope would get too deep. The operands stay
+// in `ops`, where the collector can update them, until they are copied.
+Obj *VM::concat(StackSlot *ops) {
+    size_t a_len = str::length(ops[0].objval);
+    size_t len = a_len + str::length(ops[1].objval);
+    if (len > UINT32_MAX) {
+        std::cerr << "\033[31mRuntime error: String is too long\033[0m\n";
+        exit(1);
+    }
+    if (len <= str::INLINE_MAX) {
+        char data[str::INLINE_MAX];
+        str::copy(ops[0].objval, data);
+        str::copy(ops[1].objval, data + a_len);
+        return str::make_inline(data, len);
+    }
+    uint32_t depth = std::max(str::depth(ops[0].objval), str::depth(ops[1].objval)) + 1;
+    if (len <= str::FLAT_MAX || depth > str::MAX_DEPTH) {
+        Obj *s = alloc(str::flat_size(len), 0, OBJ_STR);
+        str::copy(ops[0].objval, str::chars(s));
+        str::copy(ops[1].objval, str::chars(s) + a_len);
+        *str::flat(s) = {(uint32_t)len, str::hash(str::chars(s), len)};
+        return s;
+    }
+    Obj *s = alloc(sizeof(Obj) + 2 * sizeof(Obj*) + sizeof(str::Rope), 2, OBJ_ROPE);
+    s->refs()[0] = ops[0].objval;
+    s->refs()[1] = ops[1].objval;
+    heap.write_barrier(s, ops[0].objval);
+    heap.write_barrier(s, ops[1].objval);
+    *str::rope(s) = {(uint32_t)len, depth};
+    return s;
+}
@@ -0,0 +1,348 @@
+#include "../include/opcodes.h"
+#include "../include/verifier.h"
+#include <algorithm>
+#include <vector>
+
+namespace {
+// What is known about a value. Constants carry no type tag, so one may stand
+// for an integer or a double, and its bits may also be a short string,
+// which is an immediate the collector never follows.
+enum Kind : uint8_t {
+    K_NONE,             // a frame slot nothing was stored into yet
+    K_ANY,              // wanted: any value
+    K_WORD,             // an integer or a double
+    K_INT,
+    K_FLOAT,
+    K_REF,              // a string the collector follows
+    K_INLINE,           // a constant that is also a short string
+};
+
+bool fits(Kind have, Kind want) {
+    if (have == K_INLINE || want == K_ANY) {
+        return true;
+    }
+    if (have == K_REF || want == K_REF) {
+        return have == want;
+    }
+    return have == want || have == K_WORD || want == K_WORD;
+}
+
+Kind ref_kind(uint8_t ref) {
+    return ref ? K_REF : K_WORD;
+}
+
+// Stack need of a call chain that recurses, which only the call-depth check
+// ends
+constexpr uint32_t UNBOUNDED = UINT32_MAX;
+}
+
+// Walks the top-level code, for UINT32_MAX, or the body of `func` up to the
+// instruction that leaves it, and sets `need` to the stack slots it can
+// touch from its frame's first slot on, calls included. Its own frame takes
+// its slots, its deepest operand stack and one more, for the top of the
+// stack the VM spills one slot up; a callee's frame starts at the caller's
+// first argument and needs `needs[callee]` from there. Functions only call
+// earlier functions or themselves, so those are known; a function that calls
+// itself other than in tail position recurses until the call stack
+// overflows, and needs UNBOUNDED.
+static bool verify_block(const Chunk& chunk, uint32_t func, const std::vector<uint32_t>& records, const std::vector<uint32_t>& needs, uint32_t& need) {
+    const uint8_t *code = chunk.code_data();
+    size_t size = chunk.code_size();
+    const uint8_t *refs = chunk.ref_data();
+    const Function *functions = chunk.func_data();
+    bool top_level = func == UINT32_MAX;
+    size_t pos = top_level ? 0 : functions[func].entry;
+    uint32_t num_slots = top_level ? chunk.num_locals : functions[func].num_slots;
+
+    std::vector<Kind> stack;
+    std::vector<Kind> slots(num_slots, K_NONE);
+    if (!top_level) {
+        for (uint32_t i = 0; i < functions[func].arity; i++) {
+            slots[i] = ref_kind(refs[functions[func].param_refs + i]);
+        }
+    }
+    size_t max_depth = 0;
+    uint64_t deepest = 0;               // of the frames it calls
+    auto call = [&](uint32_t callee, uint64_t offset) {
+        if (callee == func || needs[callee] == UNBOUNDED) {
+            deepest = UNBOUNDED;
+        }
+        else if (deepest != UNBOUNDED) {
+            deepest = std::min<uint64_t>(std::max(deepest, offset + needs[callee]), UNBOUNDED);
+        }
+    };
+    auto push = [&](Kind kind) {
+        stack.push_back(kind);
+        max_depth = std::max(max_depth, stack.size());
+    };
+    auto pop = [&](Kind want) {
+        if (stack.empty()) {
+            return false;
+        }
+        Kind have = stack.back();
+        stack.pop_back();
+        return fits(have, want);
+    };
+    auto pop_args = [&](const Function& fn) {
+        for (uint32_t i = fn.arity; i-- > 0;) {
+            if (!pop(ref_kind(refs[fn.param_refs + i]))) {
+                return false;
+            }
+        }
+        return true;
+    };
+    auto constant = [&](uint32_t index, Kind& kind) {
+        if (index >= chunk.const_count()) {
+            return false;
+        }
+        kind = str::is_inline(chunk.const_data()[index].objval) ? K_INLINE : K_WORD;
+        return true;
+    };
+    auto load_slot = [&](uint32_t slot) {
+        if (slot >= num_slots || slots[slot] == K_NONE) {
+            return false;
+        }
+        push(slots[slot]);
+        return true;
+    };
+    auto store_slot = [&](uint32_t slot) {
+        if (slot >= num_slots || stack.empty()) {
+            return false;
+        }
+        slots[slot] = stack.back();
+        stack.pop_back();
+        return true;
+    };
+
+    for (;;) {
+        if (pos >= size || code[pos] >= OP_COUNT || op_size(code[pos]) > size - pos) {
+            return false;
+        }
+        uint8_t op = code[pos];
+        const uint8_t *operands = code + pos + 1;
+        pos += op_size(op);
+        Kind kind;
+        bool ok = true, done = false;
+        switch (op) {
+            case OP_PCONST:
+                ok = constant(read_operand(operands), kind);
+                push(kind);
+                break;
+            case OP_PSTR:
+                ok = std::binary_search(records.begin(), records.end(), read_operand(operands));
+                push(K_REF);
+                break;
+            case OP_LDGLOB:
+            case OP_STGLOB: {
+                uint32_t global = read_operand(operands);
+                if (global >= chunk.num_globals) {
+                    return false;
+                }
+                if (op == OP_LDGLOB) {
+                    push(ref_kind(refs[global]));
+                }
+                else {
+                    ok = pop(ref_kind(refs[global]));
+                }
+                break;
+            }
+            case OP_IADD_GG: {
+                uint32_t a = read_operand(operands), b = read_operand(operands + 3);
+                ok = a < chunk.num_globals && b < chunk.num_globals && !refs[a] && !refs[b];
+                push(K_INT);
+                break;
+            }
+            case OP_STGLOBK: {
+                uint32_t global = read_operand(operands + 3);
+                ok = global < chunk.num_globals && constant(read_operand(operands), kind) && fits(kind, ref_kind(refs[global]));
+                break;
+            }
+            case OP_LDLOC:
+                ok = load_slot(operands[0]);
+                break;
+            case OP_LDLOC0: case OP_LDLOC1: case OP_LDLOC2: case OP_LDLOC3:
+                ok = load_slot(op - OP_LDLOC0);
+                break;
+            case OP_STLOC:
+                ok = store_slot(operands[0]);
+                break;
+            case OP_STLOC0: case OP_STLOC1: case OP_STLOC2: case OP_STLOC3:
+                ok = store_slot(op - OP_STLOC0);
+                break;
+            case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IREM:
+                ok = pop(K_INT) && pop(K_INT);
+                push(K_INT);
+                break;
+            case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV: case OP_FREM:
+                ok = pop(K_FLOAT) && pop(K_FLOAT);
+                push(K_FLOAT);
+                break;
+            case OP_SCAT: case OP_SEQ: case OP_SNE:
+                ok = pop(K_REF) && pop(K_REF);
+                push(op == OP_SCAT ? K_REF : K_INT);
+                break;
+            // Shift counts outside 0..63 are undefined behaviour in the handlers
+            case OP_ISHLK:
+            case OP_IREMP2:
+                ok = operands[0] < 64 && (op == OP_ISHLK || operands[0] > 0);
+                [[fallthrough]];
+            case OP_UIMINUS: case OP_UNOT:
+                ok = ok && pop(K_INT);
+                push(K_INT);
+                break;
+            case OP_IADDK: case OP_ISUBK: case OP_IMULK:
+                ok = constant(read_operand(operands), kind) && pop(K_INT);
+                push(K_INT);
+                break;
+            case OP_FADDK: case OP_FSUBK: case OP_FMULK:
+                ok = constant(read_operand(operands), kind) && pop(K_FLOAT);
+                push(K_FLOAT);
+                break;
+            case OP_UFMINUS:
+                ok = pop(K_FLOAT);
+                push(K_FLOAT);
+                break;
+            case OP_ITOF:
+                ok = pop(K_INT);
+                push(K_FLOAT);
+                break;
+            case OP_PRINTI:
+                ok = pop(K_INT);
+                break;
+            case OP_PRINTF:
+                ok = pop(K_FLOAT);
+                break;
+            case OP_PRINTO:
+                ok = pop(K_REF);
+                break;
+            case OP_CALL:
+            case OP_TAILCALL: {
+                uint32_t callee = read_operand(operands);
+                if (callee >= chunk.func_count() || (!top_level && callee > func)) {
+                    return false;
+                }
+                const Function& fn = functions[callee];
+                uint64_t offset = num_slots + stack.size() + 1 - fn.arity;
+                ok = pop_args(fn);
+                if (op == OP_TAILCALL) {
+                    // The callee reuses this frame and returns to this
+                    // function's caller; calling itself loops in place
+                    ok = ok && !top_level && !fn.ret_ref == !functions[func].ret_ref;
+                    if (callee != func) {
+                        call(callee, 0);
+                    }
+                    done = true;
+                }
+                else {
+                    call(callee, offset);
+                    push(ref_kind(fn.ret_ref));
+                }
+                break;
+            }
+            // Natives are bound after loading; their index is checked when
+            // they are called
+            case OP_NCALL:
+                for (uint32_t i = 0; ok && i < operands[3]; i++) {
+                    ok = pop(K_ANY);
+                }
+                push(K_WORD);
+                break;
+            case OP_RET:
+                ok = !top_level && pop(ref_kind(functions[func].ret_ref));
+                done = true;
+                break;
+            case OP_HALT:
+                ok = top_level;
+                done = true;
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+        if (done) {
+            need = deepest == UNBOUNDED ? UNBOUNDED : std::max<uint64_t>(deepest, num_slots + max_depth + 1);
+            return true;
+        }
+    }
+}
+
+// Register chunks run from offset 0 to their HALT, and every operand indexes
+// the register file
+static bool verify_reg(const Chunk& chunk, uint32_t& registers) {
+    const uint8_t *code = chunk.code_data();
+    size_t size = chunk.code_size();
+    uint64_t count = (uint64_t)chunk.const_count() + chunk.num_globals + chunk.num_temps;
+    if (count > UINT32_MAX) {
+        return false;
+    }
+    for (size_t pos = 0;;) {
+        if (pos >= size || code[pos] >= ROP_COUNT || reg_op_size(code[pos]) > size - pos) {
+            return false;
+        }
+        uint8_t op = code[pos];
+        for (uint32_t i = 0; i < reg_op_operands(op); i++) {
+            if (read_operand(code + pos + 1 + 3 * i) >= count) {
+                return false;
+            }
+        }
+        if (op == ROP_HALT) {
+            registers = count;
+            return true;
+        }
+        pos += reg_op_size(op);
+    }
+}
+
+bool verifier::verify(Chunk& chunk) {
+    chunk.max_stack = 0;
+    chunk.safepoints.clear();
+    chunk.safepoint_roots.clear();
+    if (chunk.kind == CHUNK_REG) {
+        uint32_t registers;
+        if (!verify_reg(chunk, registers)) {
+            return false;
+        }
+        chunk.max_stack = registers;
+        return true;
+    }
+
+    if (chunk.ref_size() < chunk.num_globals) {
+        return false;
+    }
+    const Function *functions = chunk.func_data();
+    for (size_t i = 0; i < chunk.func_count(); i++) {
+        const Function& fn = functions[i];
+        if (fn.entry >= chunk.code_size() || fn.arity > fn.num_slots || fn.param_refs > chunk.ref_size() || fn.arity > chunk.ref_size() - fn.param_refs) {
+            return false;
+        }
+    }
+    // OP_PSTR must point at the start of a pool record
+    std::vector<uint32_t> records;
+    const uint8_t *pool = chunk.str_data();
+    for (size_t pos = 0; pos < chunk.str_size();) {
+        const Obj *s = reinterpret_cast<const Obj*>(pool + pos);
+        if (chunk.str_size() - pos < sizeof(Obj) || s->size == 0) {
+            return false;
+        }
+        records.push_back(pos);
+        pos += s->size;
+    }
+
+    std::vector<uint32_t> needs(chunk.func_count());
+    for (uint32_t i = 0; i < chunk.func_count(); i++) {
+        if (!verify_block(chunk, i, records, needs, needs[i])) {
+            return false;
+        }
+    }
+    // Frame 0 starts at stack[1]
+    uint32_t need;
+    if (!verify_block(chunk, UINT32_MAX, records, needs, need)) {
+        return false;
+    }
+    chunk.max_stack = need == UNBOUNDED ? 0 : need + 1;
+    for (uint32_t i = 0; i < chunk.func_count(); i++) {
+        map_safepoints(chunk, i);
+    }
+    map_safepoints(chunk, UINT32_MAX);
+    return true;
+}
@@ -1,165 +1,677 @@
+#include "../include/jit.h"
 #include "../include/opcodes.h"
+#include "../include/profiler.h"
+#include "../include/str.h"
 #include "../include/vm.h"
+#include <algorithm>
+#include <array>
 #include <iomanip>
 #include <iostream>
 #include <cmath>
 
-void VM::push_byte(Chunk *chunk, uint8_t byte) {
-    chunk->code.push_back(byte);
-    ip++;
+static void runtime_error(std::string_view msg) {
+    std::cerr << "\033[31mRuntime error: " << msg << "\033[0m\n";
+    exit(1);
 }
 
-uint8_t VM::pop_byte(Chunk *chunk) {
-    auto byte = *ip++;
-    return byte;
+VM::~VM() {
+    heap.detach(tlab);
+    delete jit_code;
+    delete[] stack;
+    delete[] frames;
 }
 
 void VM::push_val(StackSlot slot) {
-    stack.push(slot);
+    if (sp > stack + stack_size) {
+        runtime_error("Stack overflow");
+    }
+    *sp++ = slot;
 }
 
 StackSlot VM::pop_val() {
-    auto val = stack.top();
-    stack.pop();
-    return val;
-}
-
-uint32_t VM::add_const(Chunk *chunk, StackSlot slot) {
-    uint32_t index = chunk->constants.size();
-    chunk->constants.push_back(slot);
-    int minor2 = index & 0xFF;
-    int minor1 = (index >> 8) & 0xFF;
-    int major = (index >> 16) & 0xFF;
-    push_byte(chunk, OP_PCONST);
-    push_byte(chunk, major);
-    push_byte(chunk, minor1);
-    push_byte(chunk, minor2);
-    return index;
+    return *--sp;
 }
 
-void VM::print_disassembly() const {
-    for (auto& code : chunk->code) {
-        std::cout << std::setfill('0') << std::setw(4) << (uint16_t)code << '\n';
+// Constants carry no type tag: bit patterns with a zero or all-ones top 12
+// bits (an exponent that would make a denormal or NaN double) are shown as
+// integers, everything else as a double.
+static void print_const(std::ostream& out, StackSlot slot) {
+    uint64_t top = (uint64_t)slot.ival >> 52;
+    if (top == 0 || top == 0xFFF) {
+        out << slot.ival;
+    }
+    else {
+        out << slot.fval;
+        if (std::abs(slot.fval) < 1e15 && slot.fval == std::trunc(slot.fval)) {
+            out << ".0";
+        }
     }
 }
 
-void VM::execute() {
-    ip = &chunk->code.front();
-    while (*ip != OP_HALT) {
-        switch (static_cast<OpCodes>(*(ip++))) {
-            case OP_PCONST: {
-                uint8_t minor2 = pop_byte(chunk);
-                uint8_t minor1 = pop_byte(chunk);
-                uint8_t major = pop_byte(chunk);
-                uint32_t index = (major) | (minor1 << 8) | (minor2 << 16);
-                push_val(chunk->constants[index]);
-                break;
-            }
-            case OP_IADD: {
-                int64_t b = pop_val().ival;
-                int64_t a = pop_val().ival;
-                push_val({.ival = a + b});
-                break;
-            }
-            case OP_FADD: {
-                double b = pop_val().fval;
-                double a = pop_val().fval;
-                push_val({.fval = a + b});
-                break;
-            }
-            case OP_ISUB: {
-                int64_t b = pop_val().ival;
-                int64_t a = pop_val().ival;
-                push_val({.ival = a - b});
-                break;
-            }
-            case OP_FSUB: {
-                double b = pop_val().fval;
-                double a = pop_val().fval;
-                push_val({.fval = a - b});
-                break;
-            }
-            case OP_IMUL: {
-                int64_t b = pop_val().ival;
-                int64_t a = pop_val().ival;
-                push_val({.ival = a * b});
-                break;
-            }
-            case OP_FMUL: {
-                double b = pop_val().fval;
-                double a = pop_val().fval;
-                push_val({.fval = a * b});
-                break;
-            }
-            case OP_IDIV: {
-                int64_t b = pop_val().ival;
-                int64_t a = pop_val().ival;
-                push_val({.ival = a / b});
-                break;
+size_t disassemble(const Chunk& chunk, size_t pos, std::ostream& out) {
+    const uint8_t *code = chunk.code_data() + pos;
+    const StackSlot *constants = chunk.const_data();
+    auto constant = [&](uint32_t index) {
+        out << 'k' << index;
+        if (index < chunk.const_count()) {
+            out << " (";
+            print_const(out, constants[index]);
+            out << ')';
+        }
+        else {
+            out << " (out of range)";
+        }
+    };
+    out << std::setfill('0') << std::setw(6) << pos << std::setfill(' ') << "  ";
+
+    if (chunk.kind == CHUNK_REG) {
+        out << std::left << std::setw(10) << reg_op_name(code[0]) << std::right;
+        size_t num_consts = chunk.const_count();
+        for (uint8_t i = 0; i < reg_op_operands(code[0]); i++) {
+            uint32_t reg = read_operand(code + 1 + 3 * i);
+            out << (i ? ", " : " ");
+            if (reg < num_consts) {
+                constant(reg);
             }
-            case OP_FDIV: {
-                double b = pop_val().fval;
-                double a = pop_val().fval;
-                push_val({.fval = a / b});
-                break;
+            else if (reg < num_consts + chunk.num_globals) {
+                out << 'g' << reg - num_consts;
             }
-            case OP_IREM: {
-                int64_t b = pop_val().ival;
-                int64_t a = pop_val().ival;
-                push_val({.ival = a % b});
-                break;
+            else {
+                out << 't' << reg - num_consts - chunk.num_globals;
             }
-            case OP_FREM: {
-                double b = pop_val().fval;
-                double a = pop_val().fval;
-                push_val({.fval = std::fmod(a, b)});
-                break;
+        }
+        out << '\n';
+        return reg_op_size(code[0]);
+    }
+
+    out << std::left << std::setw(10) << op_name(code[0]) << std::right;
+    switch (code[0]) {
+        case OP_PCONST:
+        case OP_IADDK:
+        case OP_ISUBK:
+        case OP_IMULK:
+        case OP_FADDK:
+        case OP_FSUBK:
+        case OP_FMULK:
+            out << ' ';
+            constant(read_operand(code + 1));
+            break;
+        case OP_LDGLOB:
+        case OP_STGLOB:
+            out << " g" << read_operand(code + 1);
+            break;
+        case OP_PSTR: {
+            uint32_t offset = read_operand(code + 1);
+            out << " s" << offset;
+            if (offset < chunk.str_size()) {
+                Obj *s = reinterpret_cast<Obj*>(const_cast<uint8_t*>(chunk.str_data() + offset));
+                std::string_view text(str::chars(s), str::flat(s)->length);
+                out << " (\"" << text.substr(0, 32) << (text.size() > 32 ? "...\")" : "\")");
             }
-            case OP_UIMINUS: {
-                int64_t val = pop_val().ival;
-                push_val({.ival = -val});
-                break;
+            else {
+                out << " (out of range)";
             }
-            case OP_UFMINUS: {
-                double val = pop_val().fval;
-                push_val({.fval = -val});
-                break;
+            break;
+        }
+        case OP_CALL:
+        case OP_TAILCALL:
+            out << " f" << read_operand(code + 1);
+            break;
+        case OP_NCALL:
+            out << " n" << read_operand(code + 1) << ", " << (uint32_t)code[4] << " args";
+            break;
+        case OP_LDLOC:
+        case OP_STLOC:
+            out << " l" << (uint32_t)code[1];
+            break;
+        case OP_ISHLK:
+        case OP_IREMP2:
+            out << " #" << (uint32_t)code[1];
+            break;
+        case OP_IADD_GG:
+            out << " g" << read_operand(code + 1) << ", g" << read_operand(code + 4);
+            break;
+        case OP_STGLOBK:
+            out << ' ';
+            constant(read_operand(code + 1));
+            out << ", g" << read_operand(code + 4);
+            break;
+    }
+    out << '\n';
+    return op_size(code[0]);
+}
+
+void VM::print_disassembly() const {
+    const Function *functions = chunk->func_data();
+    for (size_t pos = 0; pos < chunk->code_size();) {
+        for (size_t i = 0; i < chunk->func_count(); i++) {
+            if (functions[i].entry == pos) {
+                std::cout << "f" << i << " (" << functions[i].arity << " args, " << functions[i].num_slots << " slots):\n";
             }
-            case OP_UNOT: {
-                int64_t val = pop_val().ival;
-                push_val({.ival = !val});
-                break;
+        }
+        pos += disassemble(*chunk, pos, std::cout);
+    }
+}
+
+// Dispatch mode is chosen at build time: GCC/Clang get a direct-threaded
+// loop (one indirect jump at the end of every handler, indexed by opcode),
+// every other compiler falls back to the portable switch loop.
+#if defined(PSHARP_THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#define PSHARP_COMPUTED_GOTO
+#endif
+
+#define READ_INDEX() \
+    (ip += 3, (uint32_t)ip[-1] | ((uint32_t)ip[-2] << 8) | ((uint32_t)ip[-3] << 16))
+
+// PSHARP_STACK_CHECK guards every handler that grows the stack; with it off
+// the bytecode is trusted to stay within stack_size slots. Verified chunks
+// are proven to (see verifier.h) and skip the checks either way.
+#ifdef PSHARP_STACK_CHECK
+#define STACK_CHECK() \
+    if constexpr (Checked) if (sp >= stack_end) [[unlikely]] runtime_error("Stack overflow")
+#else
+#define STACK_CHECK()
+#endif
+
+// The top of the stack lives in `tos`, everything below it in stack[1 .. sp).
+#define PUSH(v) \
+    do { STACK_CHECK(); *sp++ = tos; tos = (v); } while (0)
+#define DROP() (tos = *--sp)
+
+// Before a handler allocates: the collector finds the roots of the running
+// frame from the start of the current instruction, `size` bytes back, and
+// expects tos to be spilled to *sp.
+#define SAVE_STATE(size) \
+    do { this->ip = const_cast<uint8_t*>(ip - (size)); frame = fp; } while (0)
+
+// Profiling hooks compile away entirely in the Profile = false instantiations.
+#define PROFILE_STEP() \
+    if constexpr (Profile) profiler->step(ip)
+
+#ifdef PSHARP_COMPUTED_GOTO
+// One entry per byte value: the handlers in opcode order, then `unknown` for
+// every byte past the last opcode, so a corrupt chunk lands on the error
+// instead of jumping through whatever follows the handlers
+template<size_t N>
+static std::array<const void*, 256> dispatch_table_of(const void *const (&handlers)[N], const void *unknown) {
+    static_assert(N <= 256, "opcodes must fit in a byte");
+    std::array<const void*, 256> table;
+    table.fill(unknown);
+    std::copy(handlers, handlers + N, table.begin());
+    return table;
+}
+
+#define VM_CASE(op) L_##op:
+#define VM_NEXT() do { PROFILE_STEP(); goto *dispatch_table[*ip++]; } while (0)
+#define VM_DISPATCH(type)
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT() continue
+#define VM_DISPATCH(type) PROFILE_STEP(); switch (static_cast<type>(*ip++))
+#endif
+
+void VM::execute() {
+    Output::Scope scope(output);
+    if (global_vars.size() < chunk->num_globals) {
+        global_vars.resize(chunk->num_globals);
+    }
+    if (jit && profiler == nullptr && entry == 0 && chunk->kind == CHUNK_STACK) {
+        if (jit_code == nullptr) {
+            jit_code = jit::compile(*chunk);
+            jit = jit_code != nullptr;
+        }
+        if (jit_code != nullptr) {
+            JitContext ctx{stack + stack_size, frame_count, &output};
+            jit_code->entry(stack + 1, global_vars.data(), &ctx);
+            output.flush();
+            return;
+        }
+    }
+    if (profiler != nullptr) {
+        profiler->start(*chunk);
+    }
+    if (chunk->kind == CHUNK_REG) {
+        profiler ? execute_reg<true>() : execute_reg<false>();
+    }
+    else {
+        bool checked = chunk->max_stack == 0;
+        if (profiler) {
+            checked ? execute_stack<true, true>() : execute_stack<true, false>();
+        }
+        else {
+            checked ? execute_stack<false, true>() : execute_stack<false, false>();
+        }
+    }
+    output.flush();
+}
+
+template<bool Profile, bool Checked>
+void VM::execute_stack() {
+    const uint8_t *const code = chunk->code_data();
+    const uint8_t *ip = code + entry;
+    const StackSlot *constants = chunk->const_data();
+    const Function *functions = chunk->func_data();
+    uint8_t *const str_pool = const_cast<uint8_t*>(chunk->str_data());
+    StackSlot *globals = global_vars.data();
+    [[maybe_unused]] StackSlot *const stack_end = stack + stack_size;
+    Frame *fp = frames;
+    Frame *const frames_end = frames + frame_count;
+    StackSlot *bp = stack + 1;
+    StackSlot *sp = bp + chunk->num_locals;
+    StackSlot tos{};
+    STACK_CHECK();
+    *fp = {nullptr, bp, UINT32_MAX};
+
+#ifdef PSHARP_COMPUTED_GOTO
+    static const void *const handlers[] = {
+        &&L_OP_HALT,
+        &&L_OP_PCONST,
+        &&L_OP_IADD,
+        &&L_OP_FADD,
+        &&L_OP_ISUB,
+        &&L_OP_FSUB,
+        &&L_OP_IMUL,
+        &&L_OP_FMUL,
+        &&L_OP_IDIV,
+        &&L_OP_FDIV,
+        &&L_OP_IREM,
+        &&L_OP_FREM,
+        &&L_OP_UIMINUS,
+        &&L_OP_UFMINUS,
+        &&L_OP_UNOT,
+        &&L_OP_PRINTI,
+        &&L_OP_PRINTF,
+        &&L_OP_PRINTO,
+        &&L_OP_LDGLOB,
+        &&L_OP_STGLOB,
+        &&L_OP_RET,
+        &&L_OP_CALL,
+        &&L_OP_TAILCALL,
+        &&L_OP_LDLOC,
+        &&L_OP_STLOC,
+        &&L_OP_LDLOC0,
+        &&L_OP_LDLOC1,
+        &&L_OP_LDLOC2,
+        &&L_OP_LDLOC3,
+        &&L_OP_STLOC0,
+        &&L_OP_STLOC1,
+        &&L_OP_STLOC2,
+        &&L_OP_STLOC3,
+        &&L_OP_PSTR,
+        &&L_OP_SCAT,
+        &&L_OP_SEQ,
+        &&L_OP_SNE,
+        &&L_OP_NCALL,
+        &&L_OP_ITOF,
+        &&L_OP_ISHLK,
+        &&L_OP_IREMP2,
+        &&L_OP_IADD_GG,
+        &&L_OP_IADDK,
+        &&L_OP_ISUBK,
+        &&L_OP_IMULK,
+        &&L_OP_FADDK,
+        &&L_OP_FSUBK,
+        &&L_OP_FMULK,
+        &&L_OP_STGLOBK,
+    };
+    static_assert(sizeof(handlers) / sizeof(*handlers) == OP_COUNT, "dispatch table is out of sync with OpCodes");
+    static const auto dispatch_table = dispatch_table_of(handlers, &&L_OP_UNKNOWN);
+    VM_NEXT();
+#else
+    for (;;) {
+    VM_DISPATCH(OpCodes) {
+#endif
+        VM_CASE(OP_HALT) {
+            *sp++ = tos;
+            this->sp = sp;
+            this->ip = const_cast<uint8_t*>(ip - 1);
+            return;
+        }
+        VM_CASE(OP_PCONST) {
+            uint32_t index = READ_INDEX();
+            PUSH(constants[index]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_IADD) {
+            tos.ival = (--sp)->ival + tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_FADD) {
+            tos.fval = (--sp)->fval + tos.fval;
+            VM_NEXT();
+        }
+        VM_CASE(OP_ISUB) {
+            tos.ival = (--sp)->ival - tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_FSUB) {
+            tos.fval = (--sp)->fval - tos.fval;
+            VM_NEXT();
+        }
+        VM_CASE(OP_IMUL) {
+            tos.ival = (--sp)->ival * tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_FMUL) {
+            tos.fval = (--sp)->fval * tos.fval;
+            VM_NEXT();
+        }
+        VM_CASE(OP_IDIV) {
+            tos.ival = (--sp)->ival / tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_FDIV) {
+            tos.fval = (--sp)->fval / tos.fval;
+            VM_NEXT();
+        }
+        VM_CASE(OP_IREM) {
+            tos.ival = (--sp)->ival % tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_FREM) {
+            tos.fval = std::fmod((--sp)->fval, tos.fval);
+            VM_NEXT();
+        }
+        VM_CASE(OP_UIMINUS) {
+            tos.ival = -tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_UFMINUS) {
+            tos.fval = -tos.fval;
+            VM_NEXT();
+        }
+        VM_CASE(OP_UNOT) {
+            tos.ival = !tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_PRINTI) {
+            output.print_int(tos.ival);
+            DROP();
+            VM_NEXT();
+        }
+        VM_CASE(OP_PRINTF) {
+            output.print_float(tos.fval);
+            DROP();
+            VM_NEXT();
+        }
+        VM_CASE(OP_PRINTO) {
+            output.print_str(tos.objval);
+            DROP();
+            VM_NEXT();
+        }
+        VM_CASE(OP_LDGLOB) {
+            uint32_t index = READ_INDEX();
+            PUSH(globals[index]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_STGLOB) {
+            uint32_t index = READ_INDEX();
+            globals[index] = tos;
+            DROP();
+            VM_NEXT();
+        }
+        // Arguments stay where the caller pushed them and become the first
+        // slots of the callee's frame; the operand stack continues above the
+        // remaining slots.
+        VM_CASE(OP_CALL) {
+            uint32_t index = READ_INDEX();
+            const Function& fn = functions[index];
+            if (++fp == frames_end) [[unlikely]] {
+                runtime_error("Call stack overflow");
             }
-            case OP_PRINTI:
-                std::cout << pop_val().ival << '\n';
-                break;
-            case OP_PRINTF:
-                std::cout << pop_val().fval << '\n';
-                break;
-            case OP_PRINTO:
-                std::cout << pop_val().objval << '\n';
-                break;
-            case OP_DEFGLOB: {
-                global_vars.push_back({});
-                break;
+            *sp++ = tos;
+            bp = sp - fn.arity;
+            sp = bp + fn.num_slots;
+            STACK_CHECK();
+            *fp = {ip, bp, index};
+            ip = code + fn.entry;
+            VM_NEXT();
+        }
+        VM_CASE(OP_TAILCALL) {
+            uint32_t index = READ_INDEX();
+            const Function& fn = functions[index];
+            *sp++ = tos;
+            std::copy(sp - fn.arity, sp, bp);
+            sp = bp + fn.num_slots;
+            STACK_CHECK();
+            fp->func = index;
+            ip = code + fn.entry;
+            VM_NEXT();
+        }
+        VM_CASE(OP_RET) {
+            // The result is already in tos and replaces the arguments
+            sp = bp;
+            ip = fp->ret_ip;
+            bp = (--fp)->bp;
+            VM_NEXT();
+        }
+        VM_CASE(OP_LDLOC) {
+            uint8_t slot = *ip++;
+            PUSH(bp[slot]);
+            VM_NEXT();
+        }
+        VM_CASE(OP_STLOC) {
+            uint8_t slot = *ip++;
+            bp[slot] = tos;
+            DROP();
+            VM_NEXT();
+        }
+        #define LOCAL_N(n) \
+        VM_CASE(OP_LDLOC##n) { \
+            PUSH(bp[n]); \
+            VM_NEXT(); \
+        } \
+        VM_CASE(OP_STLOC##n) { \
+            bp[n] = tos; \
+            DROP(); \
+            VM_NEXT(); \
+        }
+        LOCAL_N(0)
+        LOCAL_N(1)
+        LOCAL_N(2)
+        LOCAL_N(3)
+        #undef LOCAL_N
+        VM_CASE(OP_PSTR) {
+            uint32_t offset = READ_INDEX();
+            PUSH(StackSlot{.objval = reinterpret_cast<Obj*>(str_pool + offset)});
+            VM_NEXT();
+        }
+        VM_CASE(OP_SCAT) {
+            *sp = tos;
+            SAVE_STATE(1);
+            tos.objval = concat(sp - 1);
+            sp--;
+            VM_NEXT();
+        }
+        VM_CASE(OP_SEQ) {
+            Obj *b = tos.objval;
+            DROP();
+            tos.ival = strings.equal(tos.objval, b);
+            VM_NEXT();
+        }
+        VM_CASE(OP_SNE) {
+            Obj *b = tos.objval;
+            DROP();
+            tos.ival = !strings.equal(tos.objval, b);
+            VM_NEXT();
+        }
+        // The arguments are spilled next to the ones below them, so the
+        // native reads them straight off the stack
+        VM_CASE(OP_NCALL) {
+            uint32_t index = READ_INDEX();
+            uint32_t argc = *ip++;
+            if (index >= native_count) [[unlikely]] {
+                runtime_error("Unbound native function");
             }
-            case OP_LDGLOB: {
-                uint8_t minor2 = pop_byte(chunk);
-                uint8_t minor1 = pop_byte(chunk);
-                uint8_t major = pop_byte(chunk);
-                uint32_t index = (major) | (minor1 << 8) | (minor2 << 16);
-                push_val(global_vars[index]);
-                break;
+            const Native& native = natives[index];
+            if (argc == 0) {
+                PUSH(native.fn(sp, native.data));
             }
-            case OP_STGLOB: {
-                StackSlot val = pop_val();
-                uint8_t minor1 = pop_byte(chunk);
-                uint8_t minor2 = pop_byte(chunk);
-                uint8_t major = pop_byte(chunk);
-                uint32_t index = (major) | (minor1 << 8) | (minor2 << 16);
-                global_vars[index] = val;
-                break;
+            else {
+                *sp = tos;
+                sp -= argc - 1;
+                tos = native.fn(sp, native.data);
             }
+            VM_NEXT();
+        }
+        VM_CASE(OP_ITOF) {
+            tos.fval = (double)tos.ival;
+            VM_NEXT();
+        }
+        VM_CASE(OP_ISHLK) {
+            tos.ival = (int64_t)((uint64_t)tos.ival << *ip++);
+            VM_NEXT();
+        }
+        // Negative dividends are biased by 2^n - 1 so that the mask rounds
+        // toward zero like IREM
+        VM_CASE(OP_IREMP2) {
+            uint32_t n = *ip++;
+            int64_t bias = (int64_t)((uint64_t)(tos.ival >> 63) >> (64 - n));
+            tos.ival = ((tos.ival + bias) & (((int64_t)1 << n) - 1)) - bias;
+            VM_NEXT();
+        }
+        VM_CASE(OP_IADD_GG) {
+            uint32_t a = READ_INDEX();
+            uint32_t b = READ_INDEX();
+            PUSH(StackSlot{.ival = globals[a].ival + globals[b].ival});
+            VM_NEXT();
         }
+        #define BINARY_K(op, field, expr) \
+        VM_CASE(op) { \
+            auto b = constants[READ_INDEX()].field; \
+            tos.field = expr; \
+            VM_NEXT(); \
+        }
+        BINARY_K(OP_IADDK, ival, tos.ival + b)
+        BINARY_K(OP_ISUBK, ival, tos.ival - b)
+        BINARY_K(OP_IMULK, ival, tos.ival * b)
+        BINARY_K(OP_FADDK, fval, tos.fval + b)
+        BINARY_K(OP_FSUBK, fval, tos.fval - b)
+        BINARY_K(OP_FMULK, fval, tos.fval * b)
+        #undef BINARY_K
+        VM_CASE(OP_STGLOBK) {
+            uint32_t k = READ_INDEX();
+            globals[READ_INDEX()] = constants[k];
+            VM_NEXT();
+        }
+#ifdef PSHARP_COMPUTED_GOTO
+        L_OP_UNKNOWN:
+#else
+        default:
+#endif
+            runtime_error("Unsupported opcode " + std::to_string(ip[-1]));
+#ifndef PSHARP_COMPUTED_GOTO
+    }
     }
-}
\ No newline at end of file
+#endif
+}
+
+#undef PUSH
+#undef DROP
+#undef SAVE_STATE
+#undef STACK_CHECK
+
+// Register file layout: [constants | globals | temporaries]. Globals are
+// copied back into global_vars on halt so callers see the same state as
+// after a stack chunk.
+template<bool Profile>
+void VM::execute_reg() {
+    const uint8_t *ip = chunk->code_data() + entry;
+    size_t num_consts = chunk->const_count();
+    std::vector<StackSlot> file(num_consts + chunk->num_globals + chunk->num_temps);
+    std::copy(chunk->const_data(), chunk->const_data() + num_consts, file.begin());
+    std::copy(global_vars.begin(), global_vars.begin() + std::min<size_t>(global_vars.size(), chunk->num_globals), file.begin() + num_consts);
+    StackSlot *R = file.data();
+
+#ifdef PSHARP_COMPUTED_GOTO
+    static const void *const handlers[] = {
+        &&L_ROP_HALT,
+        &&L_ROP_MOV,
+        &&L_ROP_IADD,
+        &&L_ROP_FADD,
+        &&L_ROP_ISUB,
+        &&L_ROP_FSUB,
+        &&L_ROP_IMUL,
+        &&L_ROP_FMUL,
+        &&L_ROP_IDIV,
+        &&L_ROP_FDIV,
+        &&L_ROP_IREM,
+        &&L_ROP_FREM,
+        &&L_ROP_UIMINUS,
+        &&L_ROP_UFMINUS,
+        &&L_ROP_UNOT,
+        &&L_ROP_ITOF,
+    };
+    static_assert(sizeof(handlers) / sizeof(*handlers) == ROP_COUNT, "dispatch table is out of sync with RegOpCodes");
+    static const auto dispatch_table = dispatch_table_of(handlers, &&L_ROP_UNKNOWN);
+    VM_NEXT();
+#else
+    for (;;) {
+    VM_DISPATCH(RegOpCodes) {
+#endif
+        VM_CASE(ROP_HALT) {
+            global_vars.assign(file.begin() + num_consts, file.begin() + num_consts + chunk->num_globals);
+            this->ip = const_cast<uint8_t*>(ip - 1);
+            return;
+        }
+        VM_CASE(ROP_MOV) {
+            uint32_t dst = READ_INDEX();
+            R[dst] = R[READ_INDEX()];
+            VM_NEXT();
+        }
+        #define BINARY(op, field, expr) \
+        VM_CASE(op) { \
+            uint32_t dst = READ_INDEX(); \
+            auto a = R[READ_INDEX()].field; \
+            auto b = R[READ_INDEX()].field; \
+            R[dst].field = expr; \
+            VM_NEXT(); \
+        }
+        BINARY(ROP_IADD, ival, a + b)
+        BINARY(ROP_FADD, fval, a + b)
+        BINARY(ROP_ISUB, ival, a - b)
+        BINARY(ROP_FSUB, fval, a - b)
+        BINARY(ROP_IMUL, ival, a * b)
+        BINARY(ROP_FMUL, fval, a * b)
+        BINARY(ROP_IDIV, ival, a / b)
+        BINARY(ROP_FDIV, fval, a / b)
+        BINARY(ROP_IREM, ival, a % b)
+        BINARY(ROP_FREM, fval, std::fmod(a, b))
+        #undef BINARY
+        VM_CASE(ROP_UIMINUS) {
+            uint32_t dst = READ_INDEX();
+            R[dst].ival = -R[READ_INDEX()].ival;
+            VM_NEXT();
+        }
+        VM_CASE(ROP_UFMINUS) {
+            uint32_t dst = READ_INDEX();
+            R[dst].fval = -R[READ_INDEX()].fval;
+            VM_NEXT();
+        }
+        VM_CASE(ROP_UNOT) {
+            uint32_t dst = READ_INDEX();
+            R[dst].ival = !R[READ_INDEX()].ival;
+            VM_NEXT();
+        }
+        VM_CASE(ROP_ITOF) {
+            uint32_t dst = READ_INDEX();
+            R[dst].fval = (double)R[READ_INDEX()].ival;
+            VM_NEXT();
+        }
+#ifdef PSHARP_COMPUTED_GOTO
+        L_ROP_UNKNOWN:
+#else
+        default:
+#endif
+            runtime_error("Unsupported opcode " + std::to_string(ip[-1]));
+#ifndef PSHARP_COMPUTED_GOTO
+    }
+    }
+#endif
+}
+
+#undef VM_DISPATCH
+#undef VM_NEXT
+#undef VM_CASE
+#undef PROFILE_STEP
+#undef READ_INDEX
@@ -0,0 +1,19 @@
+# Runs every program in tests/jit through psharp --jit-check at each
+# optimization level, so the JIT and the interpreter must agree on the
+# output and on every global. A chunk the JIT declines fails the test.
+# Usage: cmake -DPSHARP=path/to/psharp -DSOURCE_DIR=tests/jit -P jit_check.cmake
+file(GLOB programs "${SOURCE_DIR}/*.ps")
+if(NOT programs)
+    message(FATAL_ERROR "no programs in ${SOURCE_DIR}")
+endif()
+foreach(program ${programs})
+    foreach(level -O0 -O1 -O2)
+        execute_process(COMMAND "${PSHARP}" --no-cache ${level} --jit-check "${program}"
+            OUTPUT_VARIABLE output
+            ERROR_VARIABLE errors
+            RESULT_VARIABLE result)
+        if(NOT result EQUAL 0 OR NOT errors MATCHES "globals match")
+            message(FATAL_ERROR "psharp ${level} --jit-check ${program} exited with ${result}\n${errors}")
+        endif()
+    endforeach()
+endforeach()
@@ -0,0 +1,151 @@
+// Runs the same scripts at -O0, -O1 and -O2 through libpsharp and compares
+// the globals. Operands come from a host function, so the optimizer cannot
+// fold them and has to strength-reduce. Exits non-zero if any check fails.
+#include "embed/include/psharp.h"
+#include "vm/include/opcodes.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << '\n';
+        failures++;
+    }
+}
+
+// Negative dividends are where the IREMP2 bias matters
+static const int64_t VALUES[] = {-13, -9, -8, -7, -1, 0, 1, 7, 13, INT64_MIN, INT64_MIN + 1, INT64_MAX};
+static const size_t VALUE_COUNT = sizeof(VALUES) / sizeof(*VALUES);
+
+static int64_t value(int64_t i) {
+    return VALUES[i];
+}
+
+static std::shared_ptr<const psharp::Script> compile(const std::string& source, uint8_t level) {
+    psharp::Engine engine(false, level);
+    engine.bind<&value>("value");
+    auto script = engine.compile(source, "optimizer_test.ps");
+    check(script != nullptr, "-O" + std::to_string(level) + " compiles: " + engine.error());
+    return script;
+}
+
+static bool uses(const Chunk& chunk, uint8_t op) {
+    const uint8_t *code = chunk.code_data();
+    for (size_t pos = 0; pos < chunk.code_size(); pos += op_size(code[pos])) {
+        if (code[pos] == op) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64_t get(const psharp::Script& script, psharp::Instance& instance, const std::string& name) {
+    psharp::Global<int64_t> global;
+    check(script.global(name, global), "global " + name + " exists");
+    return instance.get(global);
+}
+
+// Multiplications and remainders by powers of two, on every value. A
+// function reads the results, so -O2 keeps their stores.
+static void test_strength_reduction() {
+    struct Case {
+        const char *name, *expr;
+        int64_t (*expect)(int64_t);
+    };
+    static const Case CASES[] = {
+        {"mul8", "a * 8", [](int64_t a) { return (int64_t)((uint64_t)a * 8); }},
+        {"mul2", "2 * a", [](int64_t a) { return (int64_t)((uint64_t)a * 2); }},
+        {"mul62", "a * 4611686018427387904l", [](int64_t a) { return (int64_t)((uint64_t)a << 62); }},
+        {"rem2", "a % 2", [](int64_t a) { return a % 2; }},
+        {"rem8", "a % 8", [](int64_t a) { return a % 8; }},
+        {"rem2p30", "a % 1073741824", [](int64_t a) { return a % 1073741824; }},
+        {"rem2p62", "a % 4611686018427387904l", [](int64_t a) { return a % 4611686018427387904; }},
+    };
+    std::string source, sink = "fun i64 sink() { return 0";
+    for (size_t i = 0; i < VALUE_COUNT; i++) {
+        std::string a = "a" + std::to_string(i);
+        source += "let i64 " + a + " = value(" + std::to_string(i) + "l);\n";
+        for (const Case& c : CASES) {
+            std::string name = c.name + std::to_string(i);
+            std::string expr = c.expr;
+            expr.replace(expr.find('a'), 1, a);
+            source += "let i64 " + name + " = " + expr + ";\n";
+            sink += " + " + name;
+        }
+    }
+    source += sink + "; }\n";
+
+    for (uint8_t level = 0; level <= 2; level++) {
+        auto script = compile(source, level);
+        if (script == nullptr) {
+            continue;
+        }
+        std::string O = "-O" + std::to_string(level);
+        if (level > 0) {
+            check(uses(script->chunk(), OP_ISHLK), O + " reduces multiplications to ISHLK");
+            check(uses(script->chunk(), OP_IREMP2), O + " reduces remainders to IREMP2");
+        }
+        psharp::Instance instance(script);
+        instance.run();
+        for (size_t i = 0; i < VALUE_COUNT; i++) {
+            for (const Case& c : CASES) {
+                std::string name = c.name + std::to_string(i);
+                int64_t actual = get(*script, instance, name), expected = c.expect(VALUES[i]);
+                check(actual == expected, O + ": " + name + " (a = " + std::to_string(VALUES[i]) + ") is " +
+                      std::to_string(actual) + ", expected " + std::to_string(expected));
+            }
+        }
+    }
+}
+
+// -O2 drops stores to globals no code reads, and with them the loads that
+// only fed those stores. Globals a function reads keep their stores.
+static void test_unread_globals() {
+    static const char *SOURCE = R"(
+let i64 w = value(7l);
+fun i64 read_w() { return w + 1; }
+let i64 dead = value(8l) + 5;
+let i64 x = value(7l);
+let i64 y = x * 3;
+let i64 z = y + 1;
+let i64 v = read_w();
+)";
+    struct Expect {
+        const char *name;
+        int64_t kept, dropped;
+    };
+    static const Expect EXPECT[] = {
+        {"w", 7, 7},
+        {"dead", 18, 0},
+        {"x", 7, 0},
+        {"y", 21, 0},
+        {"z", 22, 0},
+        {"v", 8, 0},
+    };
+    for (uint8_t level = 0; level <= 2; level++) {
+        auto script = compile(SOURCE, level);
+        if (script == nullptr) {
+            continue;
+        }
+        psharp::Instance instance(script);
+        instance.run();
+        for (const Expect& e : EXPECT) {
+            int64_t actual = get(*script, instance, e.name), expected = level == 2 ? e.dropped : e.kept;
+            check(actual == expected, "-O" + std::to_string(level) + ": " + e.name + " is " +
+                  std::to_string(actual) + ", expected " + std::to_string(expected));
+        }
+    }
+}
+
+int main() {
+    test_strength_reduction();
+    test_unread_globals();
+    if (failures == 0) {
+        std::cout << "optimizer: all checks passed\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,21 @@
+# Runs enough REPL entries through a small nursery that collections happen
+# while string globals from earlier entries are live, then checks that they
+# survived. Usage: cmake -DPSHARP=path/to/psharp -DWORK_DIR=dir -P repl_gc.cmake
+set(input "${WORK_DIR}/repl_gc.in")
+file(WRITE "${input}" "let str keep = \"a string that outlives every collection\";\n")
+foreach(i RANGE 3000)
+    file(APPEND "${input}" "{ let str t = \"zz${i}\" + \"yy\"; let str u = t + t; }\n")
+endforeach()
+file(APPEND "${input}" "let str copy = keep + \"!\";\n")
+
+execute_process(COMMAND "${PSHARP}" --repl --nursery 16K
+    INPUT_FILE "${input}"
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE errors
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "psharp --repl exited with ${result}\n${errors}")
+endif()
+if(NOT output MATCHES "copy: str = \"a string that outlives every collection!\"")
+    message(FATAL_ERROR "unexpected REPL output:\n${output}")
+endif()
@@ -0,0 +1,177 @@
+// Chunks assembled by hand, each with one defect the verifier must reject,
+// and the max_stack it computes for a call chain. Exits non-zero if any
+// check fails.
+#include "vm/include/bytecode.h"
+#include "vm/include/opcodes.h"
+#include "vm/include/verifier.h"
+#include "vm/include/vm.h"
+#include <filesystem>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+#include <string>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAIL: " << what << '\n';
+        failures++;
+    }
+}
+
+// Appends instructions to a chunk's code; `operand` is encoded the way
+// op_size() says the opcode takes it
+struct Assembler {
+    Chunk& chunk;
+
+    void op(uint8_t op) { chunk.code.push_back(op); }
+    void op(uint8_t op, uint32_t operand) {
+        chunk.code.push_back(op);
+        if (op_size(op) == 2) {
+            chunk.code.push_back(operand);
+        }
+        else {
+            chunk.code.insert(chunk.code.end(), {uint8_t(operand >> 16), uint8_t(operand >> 8), uint8_t(operand)});
+        }
+    }
+    // Starts the body of a function with `arity` i64 arguments
+    void function(uint16_t arity, uint16_t num_slots) {
+        chunk.functions.push_back({(uint32_t)chunk.code.size(), arity, num_slots, (uint32_t)chunk.ref_map.size(), 0, {}});
+        chunk.ref_map.insert(chunk.ref_map.end(), arity, 0);
+    }
+};
+
+// i64 global 0, str global 1, and the constants 1 and 2
+static Chunk *new_chunk() {
+    Chunk *chunk = new Chunk();
+    chunk->num_globals = 2;
+    chunk->ref_map = {0, 1};
+    chunk->constants = {StackSlot{.ival = 1}, StackSlot{.ival = 2}};
+    return chunk;
+}
+
+// One top-level block built by `body`, followed by HALT
+static bool verifies(const std::function<void(Assembler&)>& body) {
+    Chunk *chunk = new_chunk();
+    Assembler a{*chunk};
+    body(a);
+    a.op(OP_HALT);
+    bool ok = verifier::verify(*chunk);
+    delete chunk;
+    return ok;
+}
+
+// f0(x) = x + 2
+// f1(x) = f0(x) + 1
+// g0 = f1(1)
+static Chunk *call_chain() {
+    Chunk *chunk = new_chunk();
+    Assembler a{*chunk};
+    a.op(OP_PCONST, 0);
+    a.op(OP_CALL, 1);
+    a.op(OP_STGLOB, 0);
+    a.op(OP_HALT);
+    a.function(1, 1);
+    a.op(OP_LDLOC0);
+    a.op(OP_PCONST, 1);
+    a.op(OP_IADD);
+    a.op(OP_RET);
+    a.function(1, 1);
+    a.op(OP_LDLOC0);
+    a.op(OP_CALL, 0);
+    a.op(OP_PCONST, 0);
+    a.op(OP_IADD);
+    a.op(OP_RET);
+    a.op(OP_HALT);
+    return chunk;
+}
+
+// Makes f0's body `return callee(x);`, not in tail position
+static void call_from_f0(Chunk& chunk, uint32_t callee) {
+    uint8_t *body = chunk.code.data() + chunk.functions[0].entry;
+    body[1] = OP_CALL;
+    body[2] = callee >> 16;
+    body[3] = callee >> 8;
+    body[4] = callee;
+    body[5] = OP_RET;
+}
+
+static void test_indices() {
+    check(verifies([](Assembler& a) { a.op(OP_PCONST, 1); a.op(OP_STGLOB, 0); }), "valid constant and global");
+    check(!verifies([](Assembler& a) { a.op(OP_PCONST, 2); a.op(OP_STGLOB, 0); }), "constant index out of range");
+    check(!verifies([](Assembler& a) { a.op(OP_PCONST, 0); a.op(OP_STGLOB, 2); }), "global index out of range");
+    check(!verifies([](Assembler& a) { a.op(OP_LDGLOB, 2); a.op(OP_STGLOB, 0); }), "loaded global index out of range");
+    check(!verifies([](Assembler& a) { a.op(OP_PCONST, 0); a.op(OP_CALL, 0); a.op(OP_STGLOB, 0); }), "function index out of range");
+    check(!verifies([](Assembler& a) { a.op(OP_PSTR, 0); a.op(OP_STGLOB, 1); }), "string pool offset out of range");
+    check(!verifies([](Assembler& a) { a.op(OP_LDLOC0); a.op(OP_STGLOB, 0); }), "frame slot out of range");
+}
+
+static void test_underflow() {
+    check(!verifies([](Assembler& a) { a.op(OP_STGLOB, 0); }), "store from an empty stack");
+    check(!verifies([](Assembler& a) { a.op(OP_PCONST, 0); a.op(OP_IADD); a.op(OP_STGLOB, 0); }), "binary operator with one operand");
+}
+
+static void test_kinds() {
+    check(verifies([](Assembler& a) { a.op(OP_LDGLOB, 1); a.op(OP_LDGLOB, 1); a.op(OP_SCAT); a.op(OP_STGLOB, 1); }), "concatenation of strings");
+    check(!verifies([](Assembler& a) { a.op(OP_LDGLOB, 1); a.op(OP_PCONST, 0); a.op(OP_IADD); a.op(OP_STGLOB, 0); }), "string as an integer operand");
+    check(!verifies([](Assembler& a) { a.op(OP_LDGLOB, 0); a.op(OP_LDGLOB, 0); a.op(OP_SCAT); a.op(OP_STGLOB, 1); }), "integers concatenated");
+    check(!verifies([](Assembler& a) { a.op(OP_LDGLOB, 0); a.op(OP_STGLOB, 1); }), "integer stored into a string global");
+    check(!verifies([](Assembler& a) { a.op(OP_LDGLOB, 1); a.op(OP_STGLOB, 0); }), "string stored into an integer global");
+}
+
+static void test_calls() {
+    Chunk *chunk = call_chain();
+    check(verifier::verify(*chunk), "call chain verifies");
+    // Each frame reserves its slots, its deepest operand stack and the spill
+    // slot: f0 needs 1 + 2 + 1 = 4 from its first slot, f1 calls it 2 slots
+    // in, for 6, and the top level calls f1 1 slot in, for 7, after stack[0]
+    check(chunk->max_stack == 8, "call chain max_stack is " + std::to_string(chunk->max_stack) + ", expected 8");
+    VM vm(chunk);
+    vm.execute();
+    check(vm.global_vars[0].ival == 4, "call chain result");
+
+    // f0 calling itself other than in tail position recurses until the call
+    // stack overflows, so the stack stays checked
+    chunk = call_chain();
+    call_from_f0(*chunk, 0);
+    check(verifier::verify(*chunk) && chunk->max_stack == 0, "recursive call leaves max_stack 0");
+    delete chunk;
+
+    // Functions may only call earlier functions or themselves
+    chunk = call_chain();
+    call_from_f0(*chunk, 1);
+    check(!verifier::verify(*chunk), "forward call rejected");
+    delete chunk;
+}
+
+// The header's max_stack must be the one the verifier computes
+static void test_header() {
+    std::string path = (std::filesystem::temp_directory_path() / "psharp_verifier_test.psbc").string();
+    Chunk *chunk = call_chain();
+    verifier::verify(*chunk);
+    check(bytecode::save(*chunk, path), "saving the call chain");
+    Chunk *loaded = bytecode::load(path, nullptr, true);
+    check(loaded != nullptr && loaded->max_stack == chunk->max_stack, "saved call chain loads");
+    delete loaded;
+
+    chunk->max_stack++;
+    check(bytecode::save(*chunk, path), "saving with a wrong max_stack");
+    loaded = bytecode::load(path, nullptr, true);
+    check(loaded == nullptr, "header max_stack that differs from the computed one");
+    delete loaded;
+    delete chunk;
+    std::filesystem::remove(path);
+}
+
+int main() {
+    test_indices();
+    test_underflow();
+    test_kinds();
+    test_calls();
+    test_header();
+    if (failures == 0) {
+        std::cout << "verifier: all checks passed\n";
+    }
+    return failures == 0 ? 0 : 1;
+}
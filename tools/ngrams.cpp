@@ -0,0 +1,87 @@
+// Counts the most frequent opcode n-grams in the unoptimized bytecode of a
+// corpus of .ps files. Used to pick the superinstruction set in opcodes.h.
+//
+//     psharp_ngrams [-n MAX_N] [-k TOP] files...
+#include "../src/compiler/include/codegen.h"
+#include "../src/compiler/include/lexer.h"
+#include "../src/compiler/include/parser.h"
+#include "../src/compiler/include/sema.h"
+#include "../src/compiler/include/source.h"
+#include "../src/vm/include/opcodes.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <map>
+
+int main(int argc, char **argv) {
+    size_t max_n = 3;
+    size_t top = 20;
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "-n" && i + 1 < argc) {
+            max_n = std::max(2, std::atoi(argv[++i]));
+        }
+        else if (arg == "-k" && i + 1 < argc) {
+            top = std::atoi(argv[++i]);
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "\033[31mUsage: psharp_ngrams [-n MAX_N] [-k TOP] files...\033[0m\n";
+        return 1;
+    }
+
+    std::vector<std::map<std::vector<uint8_t>, uint64_t>> counts(max_n + 1);
+    uint64_t total = 0;
+    for (auto path : paths) {
+        SourceBuffer source;
+        if (!source.open(path)) {
+            std::cerr << "\033[31mError openning file: " << path << "\033[0m\n";
+            return 1;
+        }
+        auto file_name = std::filesystem::absolute(path).string();
+        Lexer lex(source.text(), file_name);
+        ASTContext ctx;
+        Parser parser(file_name, lex, ctx);
+        std::vector<ASTNodePtr> stmts(parser.parse());
+        Sema sema(file_name, stmts, ctx);
+        stmts = sema.analyze();
+        CodeGen codegen(file_name, stmts, ctx, sema);
+        Chunk *chunk = codegen.generate();
+
+        std::vector<uint8_t> ops;
+        // Top-level code and function bodies, HALT excluded
+        for (size_t pos = 0; pos < chunk->code.size(); pos += op_size(chunk->code[pos])) {
+            if (chunk->code[pos] != OP_HALT) {
+                ops.push_back(chunk->code[pos]);
+            }
+        }
+        total += ops.size();
+        for (size_t n = 2; n <= max_n; n++) {
+            for (size_t i = 0; i + n <= ops.size(); i++) {
+                counts[n][std::vector<uint8_t>(ops.begin() + i, ops.begin() + i + n)]++;
+            }
+        }
+        delete chunk;
+    }
+
+    std::cout << "instructions: " << total << '\n';
+    for (size_t n = 2; n <= max_n; n++) {
+        std::vector<std::pair<uint64_t, const std::vector<uint8_t>*>> sorted;
+        for (auto& [gram, count] : counts[n]) {
+            sorted.push_back({count, &gram});
+        }
+        std::sort(sorted.begin(), sorted.end(), [](auto& a, auto& b) { return a.first > b.first; });
+        std::cout << '\n' << n << "-grams:\n";
+        for (size_t i = 0; i < sorted.size() && i < top; i++) {
+            std::cout << "  " << sorted[i].first << '\t';
+            for (auto op : *sorted[i].second) {
+                std::cout << op_name(op) << ' ';
+            }
+            std::cout << '\n';
+        }
+    }
+}